@@ -0,0 +1,96 @@
+//=================================================================================================
+// Copyright (c) 2016, Martin Oehler, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef BAG_READER_H
+#define BAG_READER_H
+
+#include <hector_calibration_msgs/RequestScans.h>
+#include <hector_calibration_msgs/RequestCompactScans.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include <rosbag/bag.h>
+#include <tf2/buffer_core.h>
+
+#include <Eigen/Geometry>
+
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+#include <vector>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+class CalibrationCloudAggregator;
+
+// Number of points of a compact scan, the sum of its run counts
+size_t compactScanSize(const hector_calibration_msgs::CompactScan& scan);
+
+/**
+ * Reads calibration data from a recorded bag without a ROS graph. All
+ * transforms of /tf and /tf_static are loaded on open, so that clouds can be
+ * transformed regardless of the message order in the bag.
+ */
+class BagReader {
+public:
+  // Throws rosbag::BagException if the bag cannot be opened
+  explicit BagReader(const std::string& path);
+  ~BagReader();
+
+  // Splits the clouds on cloud_topic into half scans like cloud_aggregator_node.
+  // Returns false if the bag does not contain enough rotations.
+  bool readScans(const std::string& cloud_topic, const std::string& target_frame, int rotations,
+                 hector_calibration_msgs::RequestScansResponse& scans);
+  // Same as readScans, but keeps the run of each cloud like request_compact_scans. The scan lines of the
+  // runs survive deskewing, so this is the input for the organized normal estimation.
+  bool readCompactScans(const std::string& cloud_topic, const std::string& target_frame, int rotations,
+                        hector_calibration_msgs::RequestCompactScansResponse& scans);
+  // Cloud number index (starting at 0) on topic
+  bool readCloud(const std::string& topic, unsigned int index, sensor_msgs::PointCloud2& cloud);
+  // Transform from source to target frame at time
+  bool lookupTransform(const std::string& target_frame, const std::string& source_frame, const ros::Time& time,
+                       Eigen::Affine3d& transform) const;
+
+private:
+  void loadTransforms();
+  // Feeds the clouds on cloud_topic to aggregator until it is complete
+  bool aggregate(const std::string& cloud_topic, const std::string& target_frame, int rotations,
+                 CalibrationCloudAggregator& aggregator);
+  // Actuator roll angle of frame at time, used to deskew clouds with per-point times
+  bool lookupActuatorAngle(const std::string& target_frame, const std::string& frame, const ros::Time& time,
+                           double& angle) const;
+
+  rosbag::Bag bag_;
+  boost::shared_ptr<tf2::BufferCore> buffer_;
+};
+
+}
+}
+
+#endif
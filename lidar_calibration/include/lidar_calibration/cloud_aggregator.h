@@ -35,9 +35,14 @@
 #include <std_msgs/Float64MultiArray.h>
 #include <std_srvs/Empty.h>
 #include <hector_calibration_msgs/RequestScans.h>
+#include <hector_calibration_msgs/RequestCompactScans.h>
+#include <hector_calibration_msgs/CompactScans.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
 
 // tf
 #include <tf/transform_listener.h>
+#include <tf/message_filter.h>
+#include <message_filters/subscriber.h>
 
 // pcl
 #include <pcl/point_cloud.h>
@@ -47,12 +52,15 @@
 
 #include <pcl_ros/transforms.h>
 
+#include <lidar_calibration_lib/profiler.h>
+#include <lidar_calibration/point_arena.h>
+
+#include <boost/function.hpp>
+
 namespace hector_calibration {
 
 namespace lidar_calibration {
 
-typedef std::pair<boost::shared_ptr<pcl::PointCloud<pcl::PointXYZ>>, double> pc_roll_tuple;
-
 /**
  * Subscribes to rotating LIDAR clouds and publishes and asssembles
  * aggregated clouds 
@@ -60,46 +68,96 @@ typedef std::pair<boost::shared_ptr<pcl::PointCloud<pcl::PointXYZ>>, double> pc_
 class CalibrationCloudAggregator
 {
 public:
+  // Actuator roll angle of frame at time, false if it is not known (yet)
+  typedef boost::function<bool (const std::string& frame, const ros::Time& time, double& angle)> ActuatorAngleLookup;
+
   CalibrationCloudAggregator();
+  CalibrationCloudAggregator(const ros::NodeHandle& nh, const ros::NodeHandle& pnh);
+  // Without a ROS graph: no topics, services or tf. Clouds are passed to addCloud() with their transform.
+  CalibrationCloudAggregator(const std::string& target_frame, int rotations);
   void publishClouds();
 
   void setPeriodicPublishing(bool status, double period);
+
+  // Sorts a cloud into the half scans by the sign change of the actuator roll angle in transform
+  // (target frame to cloud frame). Returns true if the cloud completed the last half scan.
+  // If lookup is given and the cloud has per-point times, each point gets its own angle (deskew).
+  bool addCloud(const sensor_msgs::PointCloud2::ConstPtr& cloud_in, const tf::StampedTransform& transform,
+                const ActuatorAngleLookup& lookup = ActuatorAngleLookup());
+  // True once all half scans are captured
+  bool complete() const;
+  // Half scans in the laser frame, as served by request_scans
+  void getScans(hector_calibration_msgs::RequestScans::Response& response) const;
+  // Half scans with one angle per captured cloud, as served by request_compact_scans
+  void getCompactScans(hector_calibration_msgs::RequestCompactScans::Response& response) const;
+  void resetClouds();
 private:
   void timerCallback(const ros::TimerEvent&);
+  // Called by the tf filter once the transform of the cloud is available
   void cloudCallback (const sensor_msgs::PointCloud2::ConstPtr& cloud_in);
+  void transformFailureCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud_in,
+                                tf::filter_failure_reasons::FilterFailureReason reason);
   void resetCallback(const std_msgs::Empty::ConstPtr&);
   bool requestScansCallback(hector_calibration_msgs::RequestScans::Request& request,
                               hector_calibration_msgs::RequestScans::Response& response);
+  bool requestCompactScansCallback(hector_calibration_msgs::RequestCompactScans::Request& request,
+                                   hector_calibration_msgs::RequestCompactScans::Response& response);
   bool resetSrvCallback(std_srvs::Empty::Request&, std_srvs::Empty::Response&);
   void publishCloud(const ros::Publisher& pub, sensor_msgs::PointCloud2 &cloud_msg);
 
 protected:
-  void resetClouds();
-  void savePointCloud(const sensor_msgs::PointCloud2::ConstPtr& pc_msg, const tf::StampedTransform& transform);
-  void transformCloud(const std::vector<pc_roll_tuple>& cloud_agg, sensor_msgs::PointCloud2& cloud);
-  void scanToMsg(const std::vector<pc_roll_tuple>& cloud_agg, sensor_msgs::PointCloud2& scan, std_msgs::Float64MultiArray& angles);
-  ros::NodeHandle nh_;
-  ros::Subscriber scan_sub_;
+  void savePointCloud(const sensor_msgs::PointCloud2::ConstPtr& pc_msg, const tf::StampedTransform& transform,
+                      const ActuatorAngleLookup& lookup);
+  // Fills angle_offsets_ relative to angle by interpolating the actuator angle between the
+  // first and last point time of cloud. False if the cloud has no time field or tf is missing.
+  bool deskew(const sensor_msgs::PointCloud2& cloud, double angle, const ActuatorAngleLookup& lookup);
+  bool lookupActuatorAngle(const std::string& frame, const ros::Time& time, double& angle) const;
+  void transformCloud(const PointArena& cloud_agg, sensor_msgs::PointCloud2& cloud);
+  void scanToMsg(const PointArena& cloud_agg, sensor_msgs::PointCloud2& scan, std_msgs::Float64MultiArray& angles) const;
+  void scanToCompactMsg(const PointArena& cloud_agg, hector_calibration_msgs::CompactScan& scan) const;
+  // Preallocates the arenas for the number of points seen in the largest half scan so far
+  void reserveHalfScans();
+  boost::shared_ptr<ros::NodeHandle> nh_;
+  message_filters::Subscriber<sensor_msgs::PointCloud2> scan_sub_;
   ros::Subscriber reset_sub_;
   ros::Publisher point_cloud1_pub_;
   ros::Publisher point_cloud2_pub_;
+  ros::Publisher compact_scans_pub_;
+  ros::Publisher diagnostics_pub_;
 
   ros::ServiceServer request_scans_srv_;
+  ros::ServiceServer request_compact_scans_srv_;
   ros::ServiceServer reset_clouds_srv_;
 
   boost::shared_ptr<tf::TransformListener> tfl_;
-  ros::Duration wait_duration_;
+  // Queues the clouds until their transform arrives, declared after tfl_ so it is destroyed first
+  boost::shared_ptr<tf::MessageFilter<sensor_msgs::PointCloud2> > tf_filter_;
 
   // bool p_use_high_fidelity_projection_;
   std::string p_target_frame_;
+  // Resolution of quantized points in compact scans, 0 for float32
+  double p_quantization_step_;
+  bool p_deskew_;
+  // Keeps one point per voxel of the half scans, 0 to keep all
+  double p_voxel_leaf_size_;
+  std::string p_point_time_field_;
+  // Largest point time after the header stamp, the tf filter waits for it
+  double max_point_time_;
+  double tf_tolerance_;
+  std::vector<float> point_times_;
+  std::vector<float> angle_offsets_;
 
   double prior_roll_angle_;
 
   unsigned int captured_clouds_;
   int rotations_;
 
-  std::vector<pc_roll_tuple> cloud_agg1_;
-  std::vector<pc_roll_tuple> cloud_agg2_;
+  // Points of the current half scan, including the skipped first one
+  size_t half_scan_points_;
+  size_t max_half_scan_points_;
+
+  PointArena cloud_agg1_;
+  PointArena cloud_agg2_;
 
   sensor_msgs::PointCloud2 half_scan1_;
   std::vector<double> angles1_;
@@ -0,0 +1,107 @@
+//=================================================================================================
+// Copyright (c) 2016, Martin Oehler, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef GAUSS_NEWTON_SOLVER_H
+#define GAUSS_NEWTON_SOLVER_H
+
+#include <lidar_calibration_lib/lidar_calibration_common.h>
+#include <lidar_calibration/point_plane_error.h>
+
+#include <Eigen/Core>
+
+#include <string>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+enum SolverBackendType {
+  CERES_SOLVER,
+  GAUSS_NEWTON_SOLVER
+};
+
+bool solverBackendFromString(const std::string& name, SolverBackendType& type);
+std::string solverBackendToString(SolverBackendType type);
+
+struct GaussNewtonOptions {
+  GaussNewtonOptions() {
+    max_iterations = 50;
+    function_tolerance = 1e-6;
+    parameter_tolerance = 1e-8;
+  }
+
+  unsigned int max_iterations;
+  // Stops if the relative decrease of the cost is smaller
+  double function_tolerance;
+  // Stops if the step is smaller, relative to the parameter norm
+  double parameter_tolerance;
+};
+
+struct GaussNewtonSummary {
+  GaussNewtonSummary() {
+    iterations = 0;
+    initial_cost = 0;
+    final_cost = 0;
+    converged = false;
+  }
+
+  std::string briefReport() const;
+
+  unsigned int iterations;
+  double initial_cost;
+  double final_cost;
+  bool converged;
+};
+
+/**
+ * Damped Gauss-Newton solver for the spinning lidar problem with the four
+ * parameters (pitch, yaw, y, z). Each iteration accumulates the 4x4 normal
+ * equations J'J and J'r in a single pass over the point to plane
+ * coefficients. The pass is split into fixed blocks whose partial sums are
+ * added in order, so the result does not depend on the number of threads.
+ */
+class GaussNewtonSolver {
+public:
+  GaussNewtonSolver(const GaussNewtonOptions& options = GaussNewtonOptions());
+
+  // Rotation (pitch, yaw) and translation (y, z) are updated in place
+  void solve(const PointPlaneCoefficients& coefficients, double* rotation, double* translation,
+             GaussNewtonSummary* summary) const;
+
+private:
+  // Returns the cost 0.5*r'r and the normal equations at parameters (pitch, yaw, y, z)
+  double accumulate(const PointPlaneCoefficients& coefficients, const Eigen::Vector4d& parameters,
+                    Eigen::Matrix4d& jtj, Eigen::Vector4d& jtr) const;
+
+  GaussNewtonOptions options_;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,76 @@
+//=================================================================================================
+// Copyright (c) 2016, Martin Oehler, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef LASER_SCAN_BUFFER_H
+#define LASER_SCAN_BUFFER_H
+
+#include <lidar_calibration_lib/lidar_calibration_common.h>
+#include <lidar_calibration/point_plane_error.h>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+
+#include <vector>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+/**
+ * Half scan as structure of arrays: x, y, z in the laser frame and the
+ * cosine and sine of the actuator angle, each in its own aligned array. The
+ * angles are constant during the calibration, so their sine and cosine are
+ * computed once in assign() instead of in every iteration.
+ */
+class LaserScanBuffer {
+public:
+  LaserScanBuffer() {}
+  explicit LaserScanBuffer(const std::vector<LaserPoint<double> >& scan);
+
+  void assign(const std::vector<LaserPoint<double> >& scan);
+  size_t size() const { return x_.size(); }
+
+  // Writes angle * calibration * point of every point to cloud, which is resized to size()
+  void toActuatorCloud(const Eigen::Affine3d& calibration, pcl::PointCloud<pcl::PointXYZ>& cloud) const;
+
+private:
+  typedef std::vector<double, Eigen::aligned_allocator<double> > AlignedVector;
+
+  AlignedVector x_;
+  AlignedVector y_;
+  AlignedVector z_;
+  AlignedVector cos_angle_;
+  AlignedVector sin_angle_;
+};
+
+}
+}
+
+#endif
@@ -30,19 +30,29 @@
 #define LIDAR_CALIBRATION_H
 
 #include <lidar_calibration/calibration.h>
+#include <lidar_calibration/laser_scan_buffer.h>
+#include <lidar_calibration/scan_crop.h>
+#include <lidar_calibration/scan_pyramid.h>
 #include <hector_calibration_msgs/RequestScans.h>
+#include <hector_calibration_msgs/RequestCompactScans.h>
+#include <hector_calibration_msgs/CompactScans.h>
 
 #include <lidar_calibration_lib/lidar_calibration_common.h>
+#include <lidar_calibration_lib/organized_normals.h>
+#include <lidar_calibration_lib/chunked_problem.h>
+#include <lidar_calibration_lib/correspondence_sampling.h>
+#include <lidar_calibration_lib/profiler.h>
 
 #include <boost/date_time.hpp>
+#include <boost/thread/mutex.hpp>
 
 // standard
+#include <atomic>
 
 // pcl
 #include <pcl_ros/point_cloud.h>
 #include <pcl/common/transforms.h>
 #include <pcl/filters/filter.h>
-#include <pcl/filters/crop_box.h>
 #include <pcl/filters/passthrough.h>
 
 // pcl segmentation
@@ -56,6 +66,7 @@
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <std_srvs/Empty.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
 
 // tf
 #include <tf/transform_listener.h>
@@ -64,6 +75,7 @@
 // ceres solver
 #include <ceres/ceres.h>
 #include <lidar_calibration/point_plane_error.h>
+#include <lidar_calibration/gauss_newton_solver.h>
 
 namespace hector_calibration {
 
@@ -77,6 +89,10 @@ public:
       max_sqrt_neighbor_dist = 0.1;
       sqrt_convergence_diff_thres = 1e-6;
       normals_radius = 0.07;
+      normals_search_backend = KDTREE;
+      organized_normals = false;
+      solver_backend = CERES_SOLVER;
+      solver_options = defaultSolverOptions();
       detect_ground_plane = false;
       detect_ceiling = false;
     }
@@ -85,32 +101,100 @@ public:
     double max_sqrt_neighbor_dist;
     double sqrt_convergence_diff_thres;
     double normals_radius;
+    SearchBackendType normals_search_backend;
+    bool organized_normals;
+    SolverBackendType solver_backend;
+    ceres::Solver::Options solver_options;
     bool detect_ground_plane;
     bool detect_ceiling;
+    CropOptions crop;
+    CorrespondenceSamplingOptions sampling;
+    // Downsampled levels that run before the full resolution, from coarse to fine. Empty for full resolution only.
+    std::vector<PyramidLevel> pyramid;
     Calibration init_calibration;
   };
 
+  // Without a ROS graph: no topics, services or tf. For offline tools and benchmarks.
+  LidarCalibration();
   LidarCalibration(const ros::NodeHandle& nh);
+  // Parameters are read from pnh, e.g. the private node handle of a nodelet
+  LidarCalibration(const ros::NodeHandle& nh, const ros::NodeHandle& pnh);
 
   void setOptions(CalibrationOptions options);
+  // Saves the result of calibrate() as urdf origin-block, empty to disable
+  void setSavePath(const std::string& path);
   bool loadOptionsFromParamServer();
+  // Requests the half scans from the cloud aggregator
   void calibrate();
+  // Calibrates with given half scans, also without a ROS graph. Returns the result with rotation offset applied.
+  Calibration calibrate(const hector_calibration_msgs::RequestScansResponse& scans);
+  Calibration calibrate(const hector_calibration_msgs::RequestCompactScansResponse& scans);
+  // Scan lines are taken from the point angles, which only works without deskewing
+  Calibration calibrate(std::vector<LaserPoint<double> > scan1, std::vector<LaserPoint<double> > scan2);
+  // scan1_lines are the scan lines of scan1 for the organized normal estimation, empty to search spatially
+  Calibration calibrate(std::vector<LaserPoint<double> > scan1, std::vector<LaserPoint<double> > scan2,
+                        ScanLines scan1_lines);
   void setManualMode(bool manual);
+  // Makes a running calibrate() return early, e.g. when its nodelet is unloaded. Thread safe.
+  void stop();
   void setPeriodicPublishing(bool status, double period);
   void enableNormalVisualization(bool normals);
 
 protected:
+  // Publishes cloud1_msg_ and cloud2_msg_
   void publishResults();
+  // Converts and publishes the clouds that have subscribers
+  void publishResults(const pcl::PointCloud<pcl::PointXYZ>& cloud1, const pcl::PointCloud<pcl::PointXYZ>& cloud2);
   void timerCallback(const ros::TimerEvent&);
 
-  void requestScans(std::vector<LaserPoint<double> >& scan1,
-                    std::vector<LaserPoint<double> >& scan2);
+  // False if stopped before the scans arrived
+  bool requestScans(std::vector<LaserPoint<double> >& scan1,
+                    std::vector<LaserPoint<double> >& scan2,
+                    ScanLines& scan1_lines);
+  // Waits for client in short steps, false if stopped first
+  bool waitForService(ros::ServiceClient& client) const;
+  // Waits for a line on stdin in manual mode, false if stopped first
+  bool waitForEnter() const;
+  // The smaller half scan becomes scan1, scan1_lines are its scan lines
+  void scansFromResponse(const hector_calibration_msgs::RequestScansResponse& response,
+                         std::vector<LaserPoint<double> >& scan1,
+                         std::vector<LaserPoint<double> >& scan2,
+                         ScanLines& scan1_lines);
+  void scansFromResponse(const hector_calibration_msgs::RequestCompactScansResponse& response,
+                         std::vector<LaserPoint<double> >& scan1,
+                         std::vector<LaserPoint<double> >& scan2,
+                         ScanLines& scan1_lines);
+  void scansFromCompactScans(const hector_calibration_msgs::CompactScan& compact_scan1,
+                             const hector_calibration_msgs::CompactScan& compact_scan2,
+                             std::vector<LaserPoint<double> >& scan1,
+                             std::vector<LaserPoint<double> >& scan2,
+                             ScanLines& scan1_lines);
+  void compactScansCallback(const hector_calibration_msgs::CompactScansConstPtr& scans);
+  // ros::ok() and not stopped, without a ROS graph only stop() ends the calibration
+  bool ok() const;
   std::vector<LaserPoint<double> > msgToLaserPoints(const sensor_msgs::PointCloud2& scan, const std_msgs::Float64MultiArray& angles);
-
-  std::vector<LaserPoint<double> > cropCloud(const std::vector<LaserPoint<double> >& scan, double range);
-
-  void applyCalibration(const std::vector<LaserPoint<double> >& scan1,
-                        const std::vector<LaserPoint<double> >& scan2,
+  // Expands the angle runs of a compact scan, lines receives the scan lines of the runs
+  std::vector<LaserPoint<double> > msgToLaserPoints(const hector_calibration_msgs::CompactScan& scan, ScanLines& lines);
+  // Scan lines from the point angles, empty if organized normals are disabled or the angles are deskewed
+  ScanLines scanLinesFromLaserPoints(const std::vector<LaserPoint<double> >& scan) const;
+
+  // Crops the scan in place with options_.crop and the initial calibration, the lines are moved along
+  void cropCloud(std::vector<LaserPoint<double> >& scan, ScanLines* lines = NULL) const;
+
+  // Outer iterations on one pyramid level until convergence. cloud1 and cloud2 hold the scans in the actuator frame
+  // with the calibration of the last iteration, iteration_counter counts over all levels. Normals are estimated
+  // along scan1_lines if organized normals are enabled and the lines are not empty.
+  Calibration iterate(const std::vector<LaserPoint<double> >& scan1,
+                      const std::vector<LaserPoint<double> >& scan2,
+                      const ScanLines& scan1_lines,
+                      const PyramidLevel& level,
+                      const Calibration& init_calibration,
+                      pcl::PointCloud<pcl::PointXYZ>& cloud1,
+                      pcl::PointCloud<pcl::PointXYZ>& cloud2,
+                      unsigned int& iteration_counter);
+
+  void applyCalibration(const LaserScanBuffer& scan1,
+                        const LaserScanBuffer& scan2,
                         pcl::PointCloud<pcl::PointXYZ>& cloud1,
                         pcl::PointCloud<pcl::PointXYZ>& cloud2,
                         const Calibration& calibration);
@@ -122,36 +206,51 @@ protected:
                                    const std::vector<LaserPoint<double> >& scan2,
                                    const Calibration& current_calibration,
                                    const std::vector<WeightedNormal> & normals,
-                                   const std::map<unsigned int, unsigned int> neighbor_mapping) const;
+                                   const Correspondences& correspondences);
+
+  void solveCeres(const std::vector<LaserPoint<double> >& scan1,
+                  const std::vector<LaserPoint<double> >& scan2,
+                  const std::vector<WeightedNormal>& normals,
+                  const Correspondences& correspondences,
+                  double* rotation, double* translation);
+  void solveGaussNewton(const std::vector<LaserPoint<double> >& scan1,
+                        const std::vector<LaserPoint<double> >& scan2,
+                        const std::vector<WeightedNormal>& normals,
+                        const Correspondences& correspondences,
+                        double* rotation, double* translation) const;
 
   bool detectGroundPlane(const pcl::PointCloud<pcl::PointXYZ> &cloud1,
                                              const pcl::PointCloud<pcl::PointXYZ> &cloud2,
                                              double& roll,
                                              double& pitch) const;
 
-  bool checkConvergence(const Calibration& prev_calibration, const Calibration& current_calibration) const;
-  bool maxIterationsReached(unsigned int current_iterations) const;
+  bool checkConvergence(const Calibration& prev_calibration, const Calibration& current_calibration, double threshold) const;
+  bool maxIterationsReached(unsigned int current_iterations, unsigned int max_iterations) const;
 
   bool saveToDisk(std::string path, const Calibration& calibration) const;
 
   Eigen::Affine3d getTransform(std::string frame_base, std::string frame_target) const;
 
-  tf::TransformListener tfl_;
+  boost::shared_ptr<tf::TransformListener> tfl_;
   ros::Duration tf_wait_duration_;
 
   CalibrationOptions options_;
   bool save_calibration_;
   std::string save_path_;
 
-  ros::NodeHandle nh_;
+  boost::shared_ptr<ros::NodeHandle> nh_;
+  boost::shared_ptr<ros::NodeHandle> pnh_;
   ros::Publisher cloud1_pub_;
   ros::Publisher cloud2_pub_;
   ros::Publisher neighbor_pub_;
   ros::Publisher planarity_pub_;
   ros::Publisher ground_plane_pub_;
+  ros::Publisher diagnostics_pub_;
 
+  // Guarded by cloud_msgs_mutex_, the periodic timer publishes them while calibrate() runs in a worker thread
   sensor_msgs::PointCloud2 cloud1_msg_;
   sensor_msgs::PointCloud2 cloud2_msg_;
+  boost::mutex cloud_msgs_mutex_;
 
   std::string actuator_frame_;
   std::string laser_frame_;
@@ -164,11 +263,22 @@ protected:
 
   Eigen::Affine3d rotation_offset_;
 
+  typedef ChunkedProblem<PointPlaneChunkError, 2, 2> PointPlaneProblem;
+  PointPlaneProblem ceres_problem_;
+
   ros::ServiceClient request_scans_client_;
+  ros::ServiceClient request_compact_scans_client_;
   ros::ServiceClient reset_clouds_client_;
+  bool compact_scans_;
+  // Wait for the latched compact_scans topic instead of calling a service
+  bool subscribe_scans_;
+  ros::Subscriber compact_scans_sub_;
+  hector_calibration_msgs::CompactScansConstPtr compact_scans_msg_;
+  boost::mutex compact_scans_mutex_;
 
   bool manual_mode_;
   bool vis_normals_;
+  std::atomic<bool> stop_requested_;
   ros::Timer timer_;
 };
 
@@ -0,0 +1,118 @@
+//=================================================================================================
+// Copyright (c) 2016, Martin Oehler, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef POINT_ARENA_H
+#define POINT_ARENA_H
+
+#include <sensor_msgs/PointCloud2.h>
+#include <lidar_calibration_lib/cloud_view.h>
+
+#include <pcl/point_types.h>
+#include <Eigen/StdVector>
+
+#include <stdint.h>
+#include <unordered_set>
+#include <vector>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+/**
+ * Growable point storage for a half scan of the cloud aggregator. Points are
+ * kept in fixed size chunks that are never moved, so appending a cloud does
+ * not copy the points before it. Each appended cloud becomes one or more runs
+ * with the actuator angle of the cloud, a run ends at the end of a chunk.
+ * Deskewed clouds additionally store a per-point offset to the run angle.
+ * With a voxel leaf size, only the first point in each voxel of the actuator
+ * frame is stored, so the size is bounded by the scene instead of the capture.
+ * Chunks are kept on clear() and reused for the next half scan.
+ */
+class PointArena {
+public:
+  struct Run {
+    Run(size_t chunk, size_t offset, size_t count, double angle) :
+      chunk(chunk), offset(offset), count(count), angle(angle) {}
+
+    size_t chunk;
+    size_t offset;
+    size_t count;
+    double angle;
+  };
+
+  // 65536 points (1 MiB) per chunk
+  explicit PointArena(size_t chunk_size = 1 << 16);
+
+  // Enables the voxel filter of append() if leaf_size > 0, 0 to disable
+  void setVoxelLeafSize(double leaf_size);
+  // Allocates chunks for at least num_points
+  void reserve(size_t num_points);
+  void clear();
+  // Copies the x, y and z fields of cloud in a single pass. angle_offsets holds one
+  // correction of angle per point, or is NULL if all points share angle. Returns false and
+  // appends nothing if the cloud has no float32 x, y and z fields or is truncated.
+  bool append(const sensor_msgs::PointCloud2& cloud, double angle, const float* angle_offsets = NULL);
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  size_t capacity() const { return chunks_.size() * chunk_size_; }
+  const std::vector<Run>& runs() const { return runs_; }
+  const pcl::PointXYZ* points(const Run& run) const { return &chunks_[run.chunk][run.offset]; }
+  // True if any cloud was appended with angle offsets
+  bool hasAngleOffsets() const { return has_angle_offsets_; }
+  const float* angleOffsets(const Run& run) const { return &angle_offset_chunks_[run.chunk][run.offset]; }
+
+  // Exactly sized cloud with the layout of pcl::PointXYZ. If rotate is set, each point is
+  // rotated by its angle around the x-axis (laser to actuator frame).
+  void toMsg(sensor_msgs::PointCloud2& cloud, bool rotate = false) const;
+  // One angle per point
+  void anglesToMsg(std::vector<double>& angles) const;
+
+private:
+  typedef std::vector<pcl::PointXYZ, Eigen::aligned_allocator<pcl::PointXYZ> > Chunk;
+
+  void addChunk();
+  void appendVoxelFiltered(const ConstXYZView& view, double angle, const float* angle_offsets);
+
+  size_t chunk_size_;
+  std::vector<Chunk> chunks_;
+  std::vector<std::vector<float> > angle_offset_chunks_;
+  std::vector<Run> runs_;
+  size_t size_;
+  bool is_dense_;
+  bool has_angle_offsets_;
+
+  double voxel_leaf_size_;
+  // Occupied voxels in the actuator frame
+  std::unordered_set<uint64_t> voxels_;
+};
+
+}
+}
+
+#endif
@@ -31,6 +31,9 @@
 
 #include <ceres/ceres.h>
 #include <pcl/point_types.h>
+#include <cmath>
+#include <limits>
+#include <vector>
 
 namespace hector_calibration {
 
@@ -65,45 +68,301 @@ struct LaserPoint {
   Scalar angle;
 };
 
-struct PointPlaneError {
-  PointPlaneError(const LaserPoint<double>& s1, const LaserPoint<double>& s2, const WeightedNormal& normal) {
-    s1_ = s1;
-    s2_ = s2;
-    normal_ = normal;
+/**
+ * Actuator rotation Rx(angle) of LaserPoint::getInActuatorFrame for loops over
+ * many points. cos and sin are only recomputed if the angle differs from the
+ * previous point, which skips them along a scan line without deskewing.
+ */
+struct ActuatorRotation {
+  ActuatorRotation() :
+    angle(std::numeric_limits<double>::quiet_NaN()),
+    cos_angle(0),
+    sin_angle(0)
+  {
+  }
+
+  void setAngle(double new_angle) {
+    if (new_angle != angle) {
+      angle = new_angle;
+      cos_angle = std::cos(angle);
+      sin_angle = std::sin(angle);
+    }
+  }
+
+  // Rx(angle) * p
+  Eigen::Vector3d rotate(const Eigen::Vector3d& p) const {
+    return Eigen::Vector3d(p.x(), cos_angle*p.y() - sin_angle*p.z(), sin_angle*p.y() + cos_angle*p.z());
+  }
+
+  // Same as point.getInActuatorFrame(calibration)
+  Eigen::Vector3d inActuatorFrame(const LaserPoint<double>& point, const Eigen::Affine3d& calibration) {
+    setAngle(point.angle);
+    return rotate(calibration * point.point);
   }
 
-  template<typename T>
-  bool operator()(const T* const rpy_rotation, const T* const translation, T* residuals) const{
-    // residual = n' * (Rx*H*s1 - Rx*H*s2)
-    Affine3T<T> calibration(Eigen::AngleAxis<T>(T(rpy_rotation[1]), Vector3T<T>::UnitZ())
-        * Eigen::AngleAxis<T>(T(rpy_rotation[0]), Vector3T<T>::UnitY()));
-    calibration.translation() = Vector3T<T>(T(0.0), T(translation[0]), T(translation[1]));
+  double angle;
+  double cos_angle;
+  double sin_angle;
+};
 
-    LaserPoint<T> s1t(s1_);
-    LaserPoint<T> s2t(s2_);
+/**
+ * Calibration rotation H = Rz(yaw)*Ry(pitch) and its partial derivatives.
+ * Computed once per evaluation and shared by all residuals.
+ */
+struct CalibrationRotation {
+  CalibrationRotation(double pitch, double yaw) {
+    double cp = std::cos(pitch), sp = std::sin(pitch);
+    double cy = std::cos(yaw), sy = std::sin(yaw);
+    Eigen::Matrix3d rz, ry, drz, dry;
+    rz << cy, -sy, 0,
+          sy,  cy, 0,
+           0,   0, 1;
+    ry <<  cp, 0, sp,
+            0, 1,  0,
+          -sp, 0, cp;
+    drz << -sy, -cy, 0,
+            cy, -sy, 0,
+             0,   0, 0;
+    dry << -sp, 0,  cp,
+             0, 0,   0,
+           -cp, 0, -sp;
+    rotation = rz * ry;
+    d_pitch = rz * dry;
+    d_yaw = drz * ry;
+  }
 
-    Vector3T<T> nt(T(normal_.normal(0)), T(normal_.normal(1)), T(normal_.normal(2)));
+  Eigen::Matrix3d rotation;
+  Eigen::Matrix3d d_pitch;
+  Eigen::Matrix3d d_yaw;
+};
 
-    Vector3T<T> x1 = s1t.getInActuatorFrame(calibration);
-    Vector3T<T> x2 = s2t.getInActuatorFrame(calibration);
+/**
+ * Point to plane residual of one correspondence with analytic derivatives.
+ * With x = Rx(angle)*(H*p + t), the residual w*n'*(x1 - x2) is rewritten as
+ * m1'*(H*p1 + t) - m2'*(H*p2 + t) with m = w*Rx(angle)'*n, so the actuator
+ * rotations and the normal are folded into m at construction.
+ */
+struct PointPlaneTerm {
+  PointPlaneTerm() {}
 
-    residuals[0] = T(normal_.weight) * nt.transpose() * (x1 - x2);
+  PointPlaneTerm(const LaserPoint<double>& s1, const LaserPoint<double>& s2, const WeightedNormal& normal) {
+    Eigen::Matrix3d rx1(Eigen::AngleAxisd(s1.angle, Eigen::Vector3d::UnitX()));
+    Eigen::Matrix3d rx2(Eigen::AngleAxisd(s2.angle, Eigen::Vector3d::UnitX()));
+    m1 = normal.weight * (rx1.transpose() * normal.normal);
+    m2 = normal.weight * (rx2.transpose() * normal.normal);
+    p1 = s1.point;
+    p2 = s2.point;
+  }
 
+  // Jacobian is ordered (pitch, yaw, y, z) and may be NULL
+  double evaluate(const CalibrationRotation& rotation, const double* translation, double* jacobian) const {
+    Eigen::Vector3d dm = m1 - m2;
+    double residual = m1.dot(rotation.rotation * p1) - m2.dot(rotation.rotation * p2)
+        + dm(1) * translation[0] + dm(2) * translation[1];
+    if (jacobian) {
+      jacobian[0] = m1.dot(rotation.d_pitch * p1) - m2.dot(rotation.d_pitch * p2);
+      jacobian[1] = m1.dot(rotation.d_yaw * p1) - m2.dot(rotation.d_yaw * p2);
+      jacobian[2] = dm(1);
+      jacobian[3] = dm(2);
+    }
+    return residual;
+  }
+
+  Eigen::Vector3d m1;
+  Eigen::Vector3d m2;
+  Eigen::Vector3d p1;
+  Eigen::Vector3d p2;
+};
+
+/**
+ * Point to plane error with analytic jacobians for the parameter blocks
+ * (pitch, yaw) and (y, z).
+ */
+class PointPlaneError : public ceres::SizedCostFunction<1, 2, 2> {
+public:
+  PointPlaneError(const LaserPoint<double>& s1, const LaserPoint<double>& s2, const WeightedNormal& normal)
+    : term_(s1, s2, normal) {}
+
+  virtual bool Evaluate(double const* const* parameters, double* residuals, double** jacobians) const {
+    CalibrationRotation rotation(parameters[0][0], parameters[0][1]);
+    double jacobian[4];
+    bool need_jacobian = jacobians != NULL && (jacobians[0] != NULL || jacobians[1] != NULL);
+    residuals[0] = term_.evaluate(rotation, parameters[1], need_jacobian ? jacobian : NULL);
+    if (need_jacobian) {
+      if (jacobians[0] != NULL) {
+        jacobians[0][0] = jacobian[0];
+        jacobians[0][1] = jacobian[1];
+      }
+      if (jacobians[1] != NULL) {
+        jacobians[1][0] = jacobian[2];
+        jacobians[1][1] = jacobian[3];
+      }
+    }
     return true;
   }
 
   static ceres::CostFunction* Create(const LaserPoint<double>& s1, const LaserPoint<double>& s2, const WeightedNormal& normal)
   {
-    ceres::CostFunction* cost_function =
-        new ceres::AutoDiffCostFunction<PointPlaneError, 1, 2, 2>(
-          new PointPlaneError(s1, s2, normal));
+    return new PointPlaneError(s1, s2, normal);
+  }
+
+private:
+  PointPlaneTerm term_;
+};
+
+/**
+ * Point to plane terms reduced to the coefficients of their linear form.
+ * Every residual is linear in H, r = sum(H .* A) + (m1 - m2)'*t with
+ * A = m1*p1' - m2*p2', so a term is fully described by A (row major) and the
+ * y and z components of m1 - m2. Coefficients are kept in structure of arrays
+ * layout for vectorized evaluation loops.
+ */
+struct PointPlaneCoefficients {
+  static const unsigned int NUM_COEFFS = 11;
+
+  size_t size() const {
+    return values[0].size();
+  }
+
+  void clear() {
+    for (unsigned int c = 0; c < NUM_COEFFS; c++) {
+      values[c].clear();
+    }
+  }
+
+  void reserve(size_t n) {
+    for (unsigned int c = 0; c < NUM_COEFFS; c++) {
+      values[c].reserve(n);
+    }
+  }
+
+  void resize(size_t n) {
+    for (unsigned int c = 0; c < NUM_COEFFS; c++) {
+      values[c].resize(n);
+    }
+  }
+
+  void set(size_t i, const PointPlaneTerm& term) {
+    Eigen::Matrix3d a = term.m1 * term.p1.transpose() - term.m2 * term.p2.transpose();
+    for (unsigned int j = 0; j < 9; j++) {
+      values[j][i] = a(j / 3, j % 3);
+    }
+    values[9][i] = term.m1(1) - term.m2(1);
+    values[10][i] = term.m1(2) - term.m2(2);
+  }
+
+  void setZero(size_t i) {
+    for (unsigned int c = 0; c < NUM_COEFFS; c++) {
+      values[c][i] = 0;
+    }
+  }
+
+  void push_back(const PointPlaneTerm& term) {
+    resize(size() + 1);
+    set(size() - 1, term);
+  }
+
+  std::vector<double> values[NUM_COEFFS];
+};
+
+// Number of correspondences evaluated by one PointPlaneChunkError
+const unsigned int RESIDUAL_CHUNK_SIZE = 1024;
+
+/**
+ * Evaluates a span of point to plane residuals in one residual block, so the
+ * problem size scales with the number of chunks instead of correspondences.
+ */
+class PointPlaneChunkError : public ceres::CostFunction {
+public:
+  PointPlaneChunkError(unsigned int capacity = RESIDUAL_CHUNK_SIZE) {
+    mutable_parameter_block_sizes()->push_back(2);
+    mutable_parameter_block_sizes()->push_back(2);
+    set_num_residuals(0);
+    coeffs_.reserve(capacity);
+  }
+
+  // Adds a residual. All residuals have to be added before the chunk is added to a problem.
+  void add(const LaserPoint<double>& s1, const LaserPoint<double>& s2, const WeightedNormal& normal) {
+    coeffs_.push_back(PointPlaneTerm(s1, s2, normal));
+    set_num_residuals(coeffs_.size());
+  }
 
-    return cost_function;
+  // Sets a fixed number of residuals, which are then filled with set() and setZero()
+  void resize(size_t n) {
+    coeffs_.resize(n);
+    set_num_residuals(n);
+  }
+
+  void set(size_t i, const LaserPoint<double>& s1, const LaserPoint<double>& s2, const WeightedNormal& normal) {
+    coeffs_.set(i, PointPlaneTerm(s1, s2, normal));
+  }
+
+  // A zero term has zero residual and jacobian
+  void setZero(size_t i) {
+    coeffs_.setZero(i);
+  }
+
+  size_t size() const {
+    return coeffs_.size();
+  }
+
+  virtual bool Evaluate(double const* const* parameters, double* residuals, double** jacobians) const {
+    CalibrationRotation rotation(parameters[0][0], parameters[0][1]);
+    const double* h = rotation.rotation.data();
+    const double* hp = rotation.d_pitch.data();
+    const double* hy = rotation.d_yaw.data();
+    // Eigen matrices are column major, coefficients are row major
+    const double h00 = h[0], h01 = h[3], h02 = h[6], h10 = h[1], h11 = h[4], h12 = h[7], h20 = h[2], h21 = h[5], h22 = h[8];
+    const double t0 = parameters[1][0], t1 = parameters[1][1];
+    const std::vector<double>* c = coeffs_.values;
+    const double* a00 = c[0].data(); const double* a01 = c[1].data(); const double* a02 = c[2].data();
+    const double* a10 = c[3].data(); const double* a11 = c[4].data(); const double* a12 = c[5].data();
+    const double* a20 = c[6].data(); const double* a21 = c[7].data(); const double* a22 = c[8].data();
+    const double* dy = c[9].data(); const double* dz = c[10].data();
+    const int n = (int) size();
+
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for (int i = 0; i < n; i++) {
+      residuals[i] = h00*a00[i] + h01*a01[i] + h02*a02[i]
+                   + h10*a10[i] + h11*a11[i] + h12*a12[i]
+                   + h20*a20[i] + h21*a21[i] + h22*a22[i]
+                   + dy[i]*t0 + dz[i]*t1;
+    }
+
+    if (jacobians == NULL) {
+      return true;
+    }
+    if (jacobians[0] != NULL) {
+      // Row major n x 2
+      double* j = jacobians[0];
+      const double p00 = hp[0], p01 = hp[3], p02 = hp[6], p10 = hp[1], p11 = hp[4], p12 = hp[7], p20 = hp[2], p21 = hp[5], p22 = hp[8];
+      const double y00 = hy[0], y01 = hy[3], y02 = hy[6], y10 = hy[1], y11 = hy[4], y12 = hy[7], y20 = hy[2], y21 = hy[5], y22 = hy[8];
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+      for (int i = 0; i < n; i++) {
+        j[2*i] = p00*a00[i] + p01*a01[i] + p02*a02[i]
+               + p10*a10[i] + p11*a11[i] + p12*a12[i]
+               + p20*a20[i] + p21*a21[i] + p22*a22[i];
+        j[2*i + 1] = y00*a00[i] + y01*a01[i] + y02*a02[i]
+                   + y10*a10[i] + y11*a11[i] + y12*a12[i]
+                   + y20*a20[i] + y21*a21[i] + y22*a22[i];
+      }
+    }
+    if (jacobians[1] != NULL) {
+      double* j = jacobians[1];
+      for (int i = 0; i < n; i++) {
+        j[2*i] = dy[i];
+        j[2*i + 1] = dz[i];
+      }
+    }
+    return true;
   }
 
-  LaserPoint<double> s1_;
-  LaserPoint<double> s2_;
-  WeightedNormal normal_;
+private:
+  PointPlaneCoefficients coeffs_;
 };
 
 }
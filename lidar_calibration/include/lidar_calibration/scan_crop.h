@@ -0,0 +1,85 @@
+//=================================================================================================
+// Copyright (c) 2016, Martin Oehler, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef SCAN_CROP_H
+#define SCAN_CROP_H
+
+#include <lidar_calibration/point_plane_error.h>
+#include <lidar_calibration_lib/organized_normals.h>
+
+#include <Eigen/Geometry>
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+/**
+ * Limits of the points used for the calibration, all in the actuator frame
+ * with the initial calibration applied.
+ */
+struct CropOptions {
+  CropOptions() {
+    box_size = 1.0;
+    min_range = 0.0;
+    max_range = 0.0;
+    min_azimuth = -M_PI;
+    max_azimuth = M_PI;
+    min_height = -std::numeric_limits<double>::infinity();
+    max_height = std::numeric_limits<double>::infinity();
+  }
+
+  // Points inside the cube [-box_size, box_size]^3 are removed (robot body), 0 to disable
+  double box_size;
+  // Distance to the actuator origin, max_range 0 for no limit
+  double min_range;
+  double max_range;
+  // Sector of atan2(y, x) that is kept. If min_azimuth > max_azimuth, the sector wraps around +-pi.
+  double min_azimuth;
+  double max_azimuth;
+  // Limits of z
+  double min_height;
+  double max_height;
+};
+
+/**
+ * Removes all points of scan outside of the crop limits in place and keeps
+ * the order of the remaining points. Non-finite points are removed as well.
+ * If given, the scan lines are moved along, lines without points are removed.
+ * Returns the number of removed points.
+ */
+size_t cropScan(std::vector<LaserPoint<double> >& scan, const Eigen::Affine3d& calibration, const CropOptions& options,
+                ScanLines* lines = NULL);
+
+}
+}
+
+#endif
@@ -0,0 +1,97 @@
+//=================================================================================================
+// Copyright (c) 2016, Martin Oehler, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef SCAN_PYRAMID_H
+#define SCAN_PYRAMID_H
+
+#include <lidar_calibration/point_plane_error.h>
+
+#include <Eigen/Geometry>
+
+#include <vector>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+/**
+ * One resolution of the coarse-to-fine calibration schedule. Coarse levels
+ * have few points, so they can afford a large correspondence distance while
+ * the calibration is still far off.
+ */
+struct PyramidLevel {
+  PyramidLevel() {
+    leaf_size = 0.0;
+    max_sqrt_neighbor_dist = 0.1;
+    normals_radius = 0.07;
+    convergence_diff_thres = 1e-6;
+    max_iterations = 20;
+  }
+
+  // Scaled to the leaf size: neighbors up to 4 and normals over 3 leaf sizes
+  explicit PyramidLevel(double leaf_size) {
+    this->leaf_size = leaf_size;
+    max_sqrt_neighbor_dist = (4 * leaf_size) * (4 * leaf_size);
+    normals_radius = 3 * leaf_size;
+    convergence_diff_thres = 1e-4;
+    max_iterations = 10;
+  }
+
+  // Voxel leaf size of both half scans, 0 for full resolution
+  double leaf_size;
+  // Maximum squared distance of a neighbor
+  double max_sqrt_neighbor_dist;
+  double normals_radius;
+  // The level ends once the squared change in parameters is smaller
+  double convergence_diff_thres;
+  unsigned int max_iterations;
+};
+
+/**
+ * Coarse levels from parallel lists, ordered from coarse to fine. Missing
+ * distances and radii (or values <= 0) are scaled to the leaf size.
+ */
+std::vector<PyramidLevel> makePyramid(const std::vector<double>& leaf_sizes,
+                                      const std::vector<double>& max_sqrt_neighbor_dists,
+                                      const std::vector<double>& normals_radii,
+                                      double convergence_diff_thres,
+                                      unsigned int max_iterations);
+
+/**
+ * Keeps the first point of each voxel together with its angle. The voxels are
+ * fixed in the actuator frame with the given calibration, the order of the
+ * points is kept.
+ */
+std::vector<LaserPoint<double> > voxelDownsample(const std::vector<LaserPoint<double> >& scan,
+                                                 const Eigen::Affine3d& calibration,
+                                                 double leaf_size);
+
+}
+}
+
+#endif
@@ -0,0 +1,108 @@
+//=================================================================================================
+// Copyright (c) 2016, Martin Oehler, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef SCAN_SIMULATOR_H
+#define SCAN_SIMULATOR_H
+
+#include <lidar_calibration/calibration.h>
+#include <lidar_calibration_lib/lidar_calibration_common.h>
+#include <lidar_calibration/point_plane_error.h>
+#include <hector_calibration_msgs/RequestScans.h>
+
+#include <Eigen/Core>
+
+#include <string>
+#include <vector>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+struct SimulatedBox {
+  SimulatedBox() {}
+  SimulatedBox(const Eigen::Vector3d& _min, const Eigen::Vector3d& _max) {
+    min = _min;
+    max = _max;
+  }
+
+  Eigen::Vector3d min;
+  Eigen::Vector3d max;
+};
+
+struct ScanSimulatorOptions {
+  ScanSimulatorOptions();
+
+  // Inside of the room in the actuator frame. The actuator is 1m above the floor.
+  Eigen::Vector3d room_min;
+  Eigen::Vector3d room_max;
+  // Solid boxes inside the room, so that the scene is not symmetric
+  std::vector<SimulatedBox> obstacles;
+
+  unsigned int lines_per_half_scan;
+  unsigned int beams_per_line;
+  // Opening angle of the laser, centered at its x-axis
+  double field_of_view;
+  double min_range;
+  double max_range;
+  // Standard deviation of gaussian range noise
+  double range_noise;
+  unsigned int seed;
+  std::string laser_frame;
+};
+
+/**
+ * Ray casts a box shaped room with a 2D laser scanner that is rotated around
+ * the x-axis of the actuator. The laser is mounted on the actuator with a
+ * given calibration, which is the ground truth for LidarCalibration. Each
+ * scan line uses its own random generator, so the result only depends on the
+ * seed and not on the number of threads.
+ */
+class ScanSimulator {
+public:
+  ScanSimulator(const ScanSimulatorOptions& options = ScanSimulatorOptions());
+
+  // Half scan with actuator angles in [start_angle, start_angle + pi), points are in the laser frame
+  std::vector<LaserPoint<double> > simulateHalfScan(const Calibration& calibration, double start_angle,
+                                                    unsigned int half_scan_index) const;
+  // Both half scans in the layout of the request_scans service of the cloud aggregator
+  void simulate(const Calibration& calibration, hector_calibration_msgs::RequestScansResponse& scans) const;
+
+  // Distance to the first surface along a normalized ray in the actuator frame, false if nothing is hit in range
+  bool castRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double& range) const;
+
+private:
+  void toMsg(const std::vector<LaserPoint<double> >& scan, sensor_msgs::PointCloud2& cloud,
+             std_msgs::Float64MultiArray& angles) const;
+
+  ScanSimulatorOptions options_;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,56 @@
+//=================================================================================================
+// Copyright (c) 2016, Martin Oehler, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef VOXEL_KEY_H
+#define VOXEL_KEY_H
+
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+// Cell indices of 21 bits per axis, clamped at +-2^20 leaf sizes
+const int VOXEL_CELL_BITS = 21;
+
+// Packs the voxel of (x, y, z) into a single key for hashing
+inline uint64_t voxelKey(float x, float y, float z, float inv_leaf_size) {
+  const int cell_offset = 1 << (VOXEL_CELL_BITS - 1);
+  const int cell_max = (1 << VOXEL_CELL_BITS) - 1;
+  uint64_t cx = (uint64_t) std::min(std::max((int) std::floor(x * inv_leaf_size) + cell_offset, 0), cell_max);
+  uint64_t cy = (uint64_t) std::min(std::max((int) std::floor(y * inv_leaf_size) + cell_offset, 0), cell_max);
+  uint64_t cz = (uint64_t) std::min(std::max((int) std::floor(z * inv_leaf_size) + cell_offset, 0), cell_max);
+  return (cx << (2*VOXEL_CELL_BITS)) | (cy << VOXEL_CELL_BITS) | cz;
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,92 @@
+#include <lidar_calibration/bag_reader.h>
+#include <lidar_calibration/lidar_calibration.h>
+
+#include <boost/program_options.hpp>
+
+#include <iostream>
+
+using namespace hector_calibration::lidar_calibration;
+
+int main(int argc, char** argv) {
+  // No ros::init, everything is read from the bag
+  ros::Time::init();
+
+  std::string bag_path;
+  std::string cloud_topic;
+  std::string target_frame;
+  int rotations;
+  std::string normals_search_backend;
+  std::string solver_backend;
+  std::string output;
+  LidarCalibration::CalibrationOptions calibration_options;
+
+  boost::program_options::options_description desc("Allowed options");
+  desc.add_options()
+      ("help", "produce help message")
+      ("bag", boost::program_options::value<std::string>(&bag_path), "Input bag with the clouds and /tf")
+      ("cloud_topic", boost::program_options::value<std::string>(&cloud_topic)->default_value("cloud"),
+       "Topic of the laser clouds (sensor_msgs/PointCloud2)")
+      ("target_frame", boost::program_options::value<std::string>(&target_frame)->default_value("base_link"),
+       "Actuator frame, see target_frame of cloud_aggregator_node")
+      ("rotations", boost::program_options::value<int>(&rotations)->default_value(1), "Number of rotations to accumulate")
+      ("max_iterations", boost::program_options::value<unsigned int>(&calibration_options.max_iterations)
+       ->default_value(calibration_options.max_iterations), "Maximum number of outer iterations")
+      ("normals_radius", boost::program_options::value<double>(&calibration_options.normals_radius)
+       ->default_value(calibration_options.normals_radius), "Radius used to estimate surface normals")
+      ("normals_search_backend", boost::program_options::value<std::string>(&normals_search_backend)->default_value("kdtree"),
+       "kdtree or voxel_hash")
+      ("solver_backend", boost::program_options::value<std::string>(&solver_backend)->default_value("ceres"),
+       "ceres or gauss_newton")
+      ("output", boost::program_options::value<std::string>(&output)->default_value(""),
+       "Bag file for the aggregated half scans (topic request_compact_scans), empty to skip")
+      ("profiling", "Print stage timings after the calibration")
+  ;
+  boost::program_options::positional_options_description positional;
+  positional.add("bag", 1);
+
+  boost::program_options::variables_map vmap;
+  boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(desc).positional(positional).run(), vmap);
+  boost::program_options::notify(vmap);
+
+  if (vmap.count("help") || bag_path.empty()) {
+    std::cout << "Usage: bag_calibration <bag> [options]" << std::endl << desc << std::endl;
+    return vmap.count("help") ? 0 : 1;
+  }
+  if (!searchBackendFromString(normals_search_backend, calibration_options.normals_search_backend)) {
+    std::cerr << "Unknown normals_search_backend '" << normals_search_backend << "'" << std::endl;
+    return 1;
+  }
+  if (!solverBackendFromString(solver_backend, calibration_options.solver_backend)) {
+    std::cerr << "Unknown solver_backend '" << solver_backend << "'" << std::endl;
+    return 1;
+  }
+  Profiler::instance().setEnabled(vmap.count("profiling") > 0);
+
+  ros::WallTime start = ros::WallTime::now();
+  // Compact scans keep the runs, which are the scan lines for organized normals
+  hector_calibration_msgs::RequestCompactScansResponse scans;
+  {
+    BagReader reader(bag_path);
+    if (!reader.readCompactScans(cloud_topic, target_frame, rotations, scans)) {
+      return 1;
+    }
+  }
+  double aggregation_time = (ros::WallTime::now() - start).toSec();
+  std::cout << "Aggregated " << compactScanSize(scans.scan_1) + compactScanSize(scans.scan_2) << " points in "
+            << aggregation_time << " s" << std::endl;
+
+  if (!output.empty()) {
+    rosbag::Bag output_bag(output, rosbag::bagmode::Write);
+    output_bag.write("request_compact_scans", ros::TIME_MIN, scans);
+    output_bag.close();
+  }
+
+  LidarCalibration calibration;
+  calibration.setOptions(calibration_options);
+  start = ros::WallTime::now();
+  Calibration result = calibration.calibrate(scans);
+  double calibration_time = (ros::WallTime::now() - start).toSec();
+  std::cout << "Calibration " << result.toString() << " in " << calibration_time << " s" << std::endl;
+
+  return 0;
+}
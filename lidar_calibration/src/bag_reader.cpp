@@ -0,0 +1,188 @@
+#include <lidar_calibration/bag_reader.h>
+#include <lidar_calibration/cloud_aggregator.h>
+
+#include <rosbag/view.h>
+#include <tf/transform_datatypes.h>
+#include <tf_conversions/tf_eigen.h>
+#include <tf2_msgs/TFMessage.h>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+namespace {
+  std::string stripSlash(const std::string& frame) {
+    if (!frame.empty() && frame[0] == '/') {
+      return frame.substr(1);
+    }
+    return frame;
+  }
+
+  // Recorded topic names may or may not be absolute
+  std::vector<std::string> topicVariants(const std::string& topic) {
+    std::vector<std::string> topics;
+    topics.push_back(stripSlash(topic));
+    topics.push_back("/" + stripSlash(topic));
+    return topics;
+  }
+}
+
+size_t compactScanSize(const hector_calibration_msgs::CompactScan& scan) {
+  size_t num_points = 0;
+  for (size_t r = 0; r < scan.counts.size(); r++) {
+    num_points += scan.counts[r];
+  }
+  return num_points;
+}
+
+BagReader::BagReader(const std::string& path) {
+  bag_.open(path, rosbag::bagmode::Read);
+
+  // Cache the whole bag, lookups are not in time order with the transforms
+  rosbag::View full_view(bag_);
+  ros::Duration bag_duration = full_view.getEndTime() - full_view.getBeginTime();
+  buffer_.reset(new tf2::BufferCore(bag_duration + ros::Duration(10.0)));
+  loadTransforms();
+}
+
+BagReader::~BagReader() {
+  bag_.close();
+}
+
+void BagReader::loadTransforms() {
+  ScopedTimer timer("load_tf");
+  std::vector<std::string> topics = topicVariants("tf");
+  std::vector<std::string> static_topics = topicVariants("tf_static");
+  topics.insert(topics.end(), static_topics.begin(), static_topics.end());
+
+  rosbag::View view(bag_, rosbag::TopicQuery(topics));
+  size_t num_transforms = 0;
+  BOOST_FOREACH(const rosbag::MessageInstance& m, view) {
+    tf2_msgs::TFMessage::ConstPtr tf_msg = m.instantiate<tf2_msgs::TFMessage>();
+    if (!tf_msg) {
+      continue;
+    }
+    bool is_static = stripSlash(m.getTopic()) == "tf_static";
+    for (size_t i = 0; i < tf_msg->transforms.size(); i++) {
+      buffer_->setTransform(tf_msg->transforms[i], "rosbag", is_static);
+      num_transforms++;
+    }
+  }
+  ROS_INFO_STREAM("[BagReader] Loaded " << num_transforms << " transforms from " << bag_.getFileName() << ".");
+}
+
+bool BagReader::readScans(const std::string& cloud_topic, const std::string& target_frame, int rotations,
+                          hector_calibration_msgs::RequestScansResponse& scans)
+{
+  CalibrationCloudAggregator aggregator(target_frame, rotations);
+  if (!aggregate(cloud_topic, target_frame, rotations, aggregator)) {
+    return false;
+  }
+  aggregator.getScans(scans);
+  ROS_INFO_STREAM("[BagReader] Aggregated " << scans.angles1.data.size() + scans.angles2.data.size() << " points.");
+  return true;
+}
+
+bool BagReader::readCompactScans(const std::string& cloud_topic, const std::string& target_frame, int rotations,
+                                 hector_calibration_msgs::RequestCompactScansResponse& scans)
+{
+  CalibrationCloudAggregator aggregator(target_frame, rotations);
+  if (!aggregate(cloud_topic, target_frame, rotations, aggregator)) {
+    return false;
+  }
+  aggregator.getCompactScans(scans);
+  ROS_INFO_STREAM("[BagReader] Aggregated " << compactScanSize(scans.scan_1) + compactScanSize(scans.scan_2)
+                  << " points in " << scans.scan_1.counts.size() + scans.scan_2.counts.size() << " runs.");
+  return true;
+}
+
+bool BagReader::aggregate(const std::string& cloud_topic, const std::string& target_frame, int rotations,
+                          CalibrationCloudAggregator& aggregator)
+{
+  rosbag::View view(bag_, rosbag::TopicQuery(topicVariants(cloud_topic)));
+  size_t num_clouds = 0;
+  size_t num_skipped = 0;
+  BOOST_FOREACH(const rosbag::MessageInstance& m, view) {
+    sensor_msgs::PointCloud2::ConstPtr cloud = m.instantiate<sensor_msgs::PointCloud2>();
+    if (!cloud) {
+      continue;
+    }
+    num_clouds++;
+
+    ScopedTimer timer("tf_lookup");
+    std::string cloud_frame = stripSlash(cloud->header.frame_id);
+    if (!buffer_->canTransform(stripSlash(target_frame), cloud_frame, cloud->header.stamp)) {
+      num_skipped++;
+      continue;
+    }
+    tf::StampedTransform transform;
+    tf::transformStampedMsgToTF(buffer_->lookupTransform(stripSlash(target_frame), cloud_frame, cloud->header.stamp), transform);
+    timer.stop();
+
+    if (aggregator.addCloud(cloud, transform,
+                            boost::bind(&BagReader::lookupActuatorAngle, this, target_frame, _1, _2, _3))) {
+      break;
+    }
+  }
+  if (num_skipped > 0) {
+    ROS_WARN_STREAM("[BagReader] " << num_skipped << "/" << num_clouds << " clouds skipped, cannot transform to "
+                    << target_frame << ".");
+  }
+  if (!aggregator.complete()) {
+    ROS_ERROR_STREAM("[BagReader] " << bag_.getFileName() << " does not contain " << rotations
+                     << " full rotation(s) on " << cloud_topic << ".");
+    return false;
+  }
+  ROS_INFO_STREAM("[BagReader] Read " << num_clouds << " clouds from " << bag_.getFileName() << ".");
+  return true;
+}
+
+bool BagReader::lookupActuatorAngle(const std::string& target_frame, const std::string& frame, const ros::Time& time,
+                                    double& angle) const
+{
+  if (!buffer_->canTransform(stripSlash(target_frame), stripSlash(frame), time)) {
+    return false;
+  }
+  tf::StampedTransform transform;
+  tf::transformStampedMsgToTF(buffer_->lookupTransform(stripSlash(target_frame), stripSlash(frame), time), transform);
+  double pitch, yaw;
+  tf::Matrix3x3(transform.getRotation()).getRPY(angle, pitch, yaw);
+  return true;
+}
+
+bool BagReader::readCloud(const std::string& topic, unsigned int index, sensor_msgs::PointCloud2& cloud) {
+  rosbag::View view(bag_, rosbag::TopicQuery(topicVariants(topic)));
+  unsigned int count = 0;
+  BOOST_FOREACH(const rosbag::MessageInstance& m, view) {
+    sensor_msgs::PointCloud2::ConstPtr cloud_msg = m.instantiate<sensor_msgs::PointCloud2>();
+    if (!cloud_msg) {
+      continue;
+    }
+    if (count == index) {
+      cloud = *cloud_msg;
+      return true;
+    }
+    count++;
+  }
+  ROS_ERROR_STREAM("[BagReader] " << bag_.getFileName() << " contains only " << count << " clouds on " << topic << ".");
+  return false;
+}
+
+bool BagReader::lookupTransform(const std::string& target_frame, const std::string& source_frame, const ros::Time& time,
+                                Eigen::Affine3d& transform) const
+{
+  std::string error;
+  if (!buffer_->canTransform(stripSlash(target_frame), stripSlash(source_frame), time, &error)) {
+    ROS_WARN_STREAM("[BagReader] Cannot transform from " << source_frame << " to " << target_frame << ": " << error);
+    return false;
+  }
+  tf::StampedTransform stamped_transform;
+  tf::transformStampedMsgToTF(buffer_->lookupTransform(stripSlash(target_frame), stripSlash(source_frame), time), stamped_transform);
+  tf::transformTFToEigen(stamped_transform, transform);
+  return true;
+}
+
+}
+}
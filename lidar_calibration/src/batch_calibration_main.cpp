@@ -0,0 +1,337 @@
+#include <lidar_calibration/bag_reader.h>
+#include <lidar_calibration/lidar_calibration.h>
+#include <multi_lidar_calibration/multi_lidar_calibration.h>
+
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+#include <yaml-cpp/yaml.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+
+using namespace hector_calibration::lidar_calibration;
+
+namespace {
+
+enum JobType {
+  LIDAR_JOB,
+  MULTI_LIDAR_JOB
+};
+
+/**
+ * One dataset of the manifest. Missing keys are taken from the top level of
+ * the manifest, then from the defaults of the calibration classes.
+ */
+struct Job {
+  std::string name;
+  JobType type;
+  std::string bag;
+  std::string output;
+  unsigned int threads;
+
+  // lidar
+  std::string cloud_topic;
+  std::string target_frame;
+  int rotations;
+  LidarCalibration::CalibrationOptions lidar_options;
+
+  // multi_lidar
+  std::string cloud1_topic;
+  std::string cloud2_topic;
+  MultiLidarCalibration::CalibrationOptions multi_lidar_options;
+};
+
+struct JobResult {
+  JobResult() : success(false), points(0), seconds(0) {}
+  bool success;
+  std::string message;
+  Eigen::Affine3d calibration;
+  size_t points;
+  double seconds;
+};
+
+template<typename T>
+T value(const YAML::Node& job, const YAML::Node& defaults, const std::string& key, const T& fallback) {
+  if (job[key]) {
+    return job[key].as<T>();
+  }
+  if (defaults[key]) {
+    return defaults[key].as<T>();
+  }
+  return fallback;
+}
+
+Job parseJob(const YAML::Node& node, const YAML::Node& defaults, unsigned int default_threads, size_t index) {
+  Job job;
+  job.name = value<std::string>(node, YAML::Node(), "name", "job_" + std::to_string(index));
+  std::string type = value<std::string>(node, defaults, "type", "lidar");
+  if (type == "lidar") {
+    job.type = LIDAR_JOB;
+  } else if (type == "multi_lidar") {
+    job.type = MULTI_LIDAR_JOB;
+  } else {
+    throw std::runtime_error("Unknown type '" + type + "' of job " + job.name);
+  }
+  job.bag = value<std::string>(node, YAML::Node(), "bag", "");
+  if (job.bag.empty()) {
+    throw std::runtime_error("No bag given for job " + job.name);
+  }
+  job.output = value<std::string>(node, YAML::Node(), "output", "");
+  job.threads = std::max(1u, value<unsigned int>(node, defaults, "threads", default_threads));
+
+  job.cloud_topic = value<std::string>(node, defaults, "cloud_topic", "cloud");
+  job.target_frame = value<std::string>(node, defaults, "target_frame", job.type == LIDAR_JOB ? "base_link" : "");
+  job.rotations = value<int>(node, defaults, "rotations", 1);
+  // MultiLidarCalibration only saves its result relative to a target frame
+  if (job.type == MULTI_LIDAR_JOB && !job.output.empty() && job.target_frame.empty()) {
+    throw std::runtime_error("Job " + job.name + " has an output but no target_frame, multi_lidar results are only "
+                             "saved relative to a target frame");
+  }
+
+  LidarCalibration::CalibrationOptions& lidar = job.lidar_options;
+  lidar.max_iterations = value<unsigned int>(node, defaults, "max_iterations", lidar.max_iterations);
+  lidar.max_sqrt_neighbor_dist = value<double>(node, defaults, "max_sqrt_neighbor_dist", lidar.max_sqrt_neighbor_dist);
+  lidar.sqrt_convergence_diff_thres = value<double>(node, defaults, "sqrt_convergence_diff_thres", lidar.sqrt_convergence_diff_thres);
+  lidar.normals_radius = value<double>(node, defaults, "normals_radius", lidar.normals_radius);
+  lidar.organized_normals = value<bool>(node, defaults, "organized_normals", lidar.organized_normals);
+  lidar.detect_ground_plane = value<bool>(node, defaults, "detect_ground_plane", lidar.detect_ground_plane);
+  lidar.crop.box_size = value<double>(node, defaults, "crop_box_size", lidar.crop.box_size);
+  lidar.crop.min_range = value<double>(node, defaults, "crop_min_range", lidar.crop.min_range);
+  lidar.crop.max_range = value<double>(node, defaults, "crop_max_range", lidar.crop.max_range);
+  lidar.crop.min_azimuth = value<double>(node, defaults, "crop_min_azimuth", lidar.crop.min_azimuth);
+  lidar.crop.max_azimuth = value<double>(node, defaults, "crop_max_azimuth", lidar.crop.max_azimuth);
+  lidar.crop.min_height = value<double>(node, defaults, "crop_min_height", lidar.crop.min_height);
+  lidar.crop.max_height = value<double>(node, defaults, "crop_max_height", lidar.crop.max_height);
+  lidar.sampling.min_weight = value<double>(node, defaults, "sampling_min_weight", lidar.sampling.min_weight);
+  lidar.sampling.max_residuals = value<size_t>(node, defaults, "max_residuals", lidar.sampling.max_residuals);
+  lidar.sampling.normal_bins = std::max(1u, value<unsigned int>(node, defaults, "sampling_normal_bins", lidar.sampling.normal_bins));
+  lidar.pyramid = makePyramid(value<std::vector<double> >(node, defaults, "pyramid_leaf_sizes", std::vector<double>()),
+                              value<std::vector<double> >(node, defaults, "pyramid_max_sqrt_neighbor_dists", std::vector<double>()),
+                              value<std::vector<double> >(node, defaults, "pyramid_normals_radii", std::vector<double>()),
+                              value<double>(node, defaults, "pyramid_convergence_diff_thres", 1e-4),
+                              std::max(1u, value<unsigned int>(node, defaults, "pyramid_max_iterations", 10)));
+  std::string normals_search_backend = value<std::string>(node, defaults, "normals_search_backend", "kdtree");
+  if (!searchBackendFromString(normals_search_backend, lidar.normals_search_backend)) {
+    throw std::runtime_error("Unknown normals_search_backend '" + normals_search_backend + "' of job " + job.name);
+  }
+  std::string solver_backend = value<std::string>(node, defaults, "solver_backend", "ceres");
+  if (!solverBackendFromString(solver_backend, lidar.solver_backend)) {
+    throw std::runtime_error("Unknown solver_backend '" + solver_backend + "' of job " + job.name);
+  }
+  lidar.solver_options.num_threads = job.threads;
+
+  job.cloud1_topic = value<std::string>(node, defaults, "cloud1_topic", "cloud1");
+  job.cloud2_topic = value<std::string>(node, defaults, "cloud2_topic", "cloud2");
+  MultiLidarCalibration::CalibrationOptions& multi_lidar = job.multi_lidar_options;
+  multi_lidar.max_sqr_dist = value<double>(node, defaults, "max_sqr_dist", multi_lidar.max_sqr_dist);
+  multi_lidar.normals_radius = value<double>(node, defaults, "normals_radius", multi_lidar.normals_radius);
+  multi_lidar.normals_search_backend = lidar.normals_search_backend;
+  multi_lidar.crop_dist = value<double>(node, defaults, "crop_dist", multi_lidar.crop_dist);
+  multi_lidar.max_iterations = value<int>(node, defaults, "max_iterations", multi_lidar.max_iterations);
+  multi_lidar.parameter_diff_thres = value<double>(node, defaults, "parameter_diff_thres", multi_lidar.parameter_diff_thres);
+  multi_lidar.solver_options.num_threads = job.threads;
+  return job;
+}
+
+std::vector<Job> loadManifest(const std::string& path, unsigned int default_threads) {
+  YAML::Node manifest = YAML::LoadFile(path);
+  YAML::Node jobs = manifest["jobs"];
+  if (!jobs || !jobs.IsSequence()) {
+    throw std::runtime_error("Manifest " + path + " has no list 'jobs'");
+  }
+  std::vector<Job> result;
+  for (size_t i = 0; i < jobs.size(); i++) {
+    result.push_back(parseJob(jobs[i], manifest, default_threads, i));
+  }
+  return result;
+}
+
+void runLidarJob(const Job& job, JobResult& result) {
+  hector_calibration_msgs::RequestCompactScansResponse scans;
+  {
+    BagReader reader(job.bag);
+    if (!reader.readCompactScans(job.cloud_topic, job.target_frame, job.rotations, scans)) {
+      result.message = "not enough rotations on " + job.cloud_topic;
+      return;
+    }
+  }
+  result.points = compactScanSize(scans.scan_1) + compactScanSize(scans.scan_2);
+
+  LidarCalibration calibration;
+  calibration.setOptions(job.lidar_options);
+  calibration.setSavePath(job.output);
+  result.calibration = calibration.calibrate(scans).getTransform();
+  result.success = true;
+}
+
+void runMultiLidarJob(const Job& job, JobResult& result) {
+  sensor_msgs::PointCloud2 cloud1;
+  sensor_msgs::PointCloud2 cloud2;
+  Eigen::Affine3d target_transform = Eigen::Affine3d::Identity();
+  {
+    BagReader reader(job.bag);
+    // Like multi_lidar_calibration_node, the first cloud of each topic is skipped
+    if (!reader.readCloud(job.cloud1_topic, 1, cloud1) || !reader.readCloud(job.cloud2_topic, 1, cloud2)) {
+      result.message = "missing clouds";
+      return;
+    }
+    if (!job.target_frame.empty()
+        && !reader.lookupTransform(cloud1.header.frame_id, job.target_frame, cloud1.header.stamp, target_transform)) {
+      result.message = "no transform from " + job.target_frame + " to " + cloud1.header.frame_id;
+      return;
+    }
+  }
+  result.points = cloud1.width * cloud1.height + cloud2.width * cloud2.height;
+
+  MultiLidarCalibration calibration;
+  calibration.setOptions(job.multi_lidar_options);
+  calibration.setTargetFrame(job.target_frame, target_transform);
+  calibration.setSavePath(job.output);
+  result.calibration = calibration.calibrate(cloud1, cloud2);
+  result.success = true;
+}
+
+void runJob(const Job& job, JobResult& result) {
+#ifdef _OPENMP
+  // Thread budget of this worker, so that the parallel regions of all jobs together do not oversubscribe the machine
+  omp_set_num_threads(job.threads);
+#endif
+  ros::WallTime start = ros::WallTime::now();
+  try {
+    if (job.type == LIDAR_JOB) {
+      runLidarJob(job, result);
+    } else {
+      runMultiLidarJob(job, result);
+    }
+  } catch (const std::exception& e) {
+    result.success = false;
+    result.message = e.what();
+  }
+  result.seconds = (ros::WallTime::now() - start).toSec();
+}
+
+// Quoted CSV field, embedded quotes are doubled. Messages are often exception texts with commas.
+std::string csvField(const std::string& field) {
+  std::string quoted = "\"";
+  for (size_t i = 0; i < field.size(); i++) {
+    if (field[i] == '"') {
+      quoted += '"';
+    }
+    quoted += field[i];
+  }
+  return quoted + "\"";
+}
+
+bool writeSummary(const std::string& path, const std::vector<Job>& jobs, const std::vector<JobResult>& results) {
+  std::ofstream file(path);
+  if (!file) {
+    return false;
+  }
+  file << "name,type,status,x,y,z,roll,pitch,yaw,points,seconds,output,message" << std::endl;
+  for (size_t i = 0; i < jobs.size(); i++) {
+    const JobResult& result = results[i];
+    file << csvField(jobs[i].name) << "," << (jobs[i].type == LIDAR_JOB ? "lidar" : "multi_lidar") << ","
+         << (result.success ? "ok" : "failed") << ",";
+    if (result.success) {
+      Eigen::Vector3d xyz = result.calibration.translation();
+      Eigen::Vector3d ypr = result.calibration.linear().eulerAngles(2, 1, 0);
+      file << xyz(0) << "," << xyz(1) << "," << xyz(2) << ","
+           << normalizeAngle(ypr(2)) << "," << normalizeAngle(ypr(1)) << "," << normalizeAngle(ypr(0)) << ",";
+    } else {
+      file << ",,,,,,";
+    }
+    file << result.points << "," << result.seconds << "," << csvField(jobs[i].output) << ","
+         << csvField(result.message) << std::endl;
+  }
+  return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+  // No ros::init, everything is read from the bags
+  ros::Time::init();
+
+  std::string manifest_path;
+  std::string summary_path;
+  unsigned int workers;
+  unsigned int threads;
+
+  boost::program_options::options_description desc("Allowed options");
+  desc.add_options()
+      ("help", "produce help message")
+      ("manifest", boost::program_options::value<std::string>(&manifest_path), "YAML manifest with the jobs")
+      ("summary", boost::program_options::value<std::string>(&summary_path)->default_value("calibration_summary.csv"),
+       "CSV file with one row per job")
+      ("threads", boost::program_options::value<unsigned int>(&threads)->default_value(2),
+       "Default thread budget of each job (OpenMP and Ceres)")
+      ("workers", boost::program_options::value<unsigned int>(&workers)->default_value(0),
+       "Number of concurrent jobs, 0 to fill the hardware threads with the default budget")
+      ("verbose", "Print the log of all jobs")
+  ;
+  boost::program_options::positional_options_description positional;
+  positional.add("manifest", 1);
+
+  boost::program_options::variables_map vmap;
+  boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(desc).positional(positional).run(), vmap);
+  boost::program_options::notify(vmap);
+
+  if (vmap.count("help") || manifest_path.empty()) {
+    std::cout << "Usage: batch_calibration <manifest> [options]" << std::endl << desc << std::endl;
+    return vmap.count("help") ? 0 : 1;
+  }
+  if (!vmap.count("verbose") && ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME, ros::console::levels::Warn)) {
+    ros::console::notifyLoggerLevelsChanged();
+  }
+
+  std::vector<Job> jobs;
+  try {
+    jobs = loadManifest(manifest_path, std::max(1u, threads));
+  } catch (const std::exception& e) {
+    std::cerr << "Failed to load manifest: " << e.what() << std::endl;
+    return 1;
+  }
+  if (workers == 0) {
+    workers = std::max(1u, boost::thread::hardware_concurrency() / std::max(1u, threads));
+  }
+  workers = std::min<unsigned int>(workers, jobs.size());
+  std::cout << "Running " << jobs.size() << " jobs on " << workers << " workers" << std::endl;
+
+  // Workers take the next job until all are done
+  std::vector<JobResult> results(jobs.size());
+  std::atomic<size_t> next_job(0);
+  boost::mutex output_mutex;
+  boost::thread_group pool;
+  ros::WallTime start = ros::WallTime::now();
+  for (unsigned int w = 0; w < workers; w++) {
+    pool.create_thread([&]() {
+      for (size_t i = next_job++; i < jobs.size(); i = next_job++) {
+        runJob(jobs[i], results[i]);
+        boost::mutex::scoped_lock lock(output_mutex);
+        std::cout << "[" << jobs[i].name << "] " << (results[i].success ? "done" : "failed: " + results[i].message)
+                  << " in " << results[i].seconds << " s" << std::endl;
+      }
+    });
+  }
+  pool.join_all();
+
+  size_t failed = 0;
+  for (size_t i = 0; i < results.size(); i++) {
+    if (!results[i].success) {
+      failed++;
+    }
+  }
+  std::cout << jobs.size() - failed << "/" << jobs.size() << " jobs succeeded in "
+            << (ros::WallTime::now() - start).toSec() << " s" << std::endl;
+  if (!writeSummary(summary_path, jobs, results)) {
+    std::cerr << "Failed to write " << summary_path << std::endl;
+    return 1;
+  }
+  std::cout << "Summary written to " << summary_path << std::endl;
+  return failed == 0 ? 0 : 1;
+}
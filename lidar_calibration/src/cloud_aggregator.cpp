@@ -1,29 +1,141 @@
 #include <lidar_calibration/cloud_aggregator.h>
+#include <lidar_calibration_lib/lidar_calibration_common.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
 
 namespace hector_calibration {
 
 namespace lidar_calibration {
-  CalibrationCloudAggregator::CalibrationCloudAggregator() {
+namespace {
+  // Per-point times in seconds relative to the header stamp. Floating point fields are read as
+  // seconds, uint32 fields as nanoseconds (e.g. "t" of Ouster sensors).
+  bool readPointTimes(const sensor_msgs::PointCloud2& cloud, const std::string& field_name, std::vector<float>& times) {
+    const sensor_msgs::PointField* field = NULL;
+    for (size_t i = 0; i < cloud.fields.size(); i++) {
+      if (cloud.fields[i].name == field_name) {
+        field = &cloud.fields[i];
+      }
+    }
+    if (!field) {
+      return false;
+    }
+    size_t field_size = 0;
+    switch (field->datatype) {
+      case sensor_msgs::PointField::FLOAT32:
+      case sensor_msgs::PointField::UINT32:
+        field_size = 4;
+        break;
+      case sensor_msgs::PointField::FLOAT64:
+        field_size = 8;
+        break;
+      default:
+        return false;
+    }
+    // Truncated or malformed clouds are not deskewed
+    size_t num_points = (size_t) cloud.width * cloud.height;
+    if (num_points == 0 || (size_t) field->offset + field_size > cloud.point_step
+        || cloud.data.size() < num_points * cloud.point_step) {
+      return false;
+    }
+    times.resize(num_points);
+    const unsigned char* data = &cloud.data[field->offset];
+    for (size_t i = 0; i < num_points; i++, data += cloud.point_step) {
+      switch (field->datatype) {
+        case sensor_msgs::PointField::FLOAT32: {
+          float time;
+          std::memcpy(&time, data, sizeof(time));
+          times[i] = time;
+          break;
+        }
+        case sensor_msgs::PointField::FLOAT64: {
+          double time;
+          std::memcpy(&time, data, sizeof(time));
+          times[i] = (float) time;
+          break;
+        }
+        case sensor_msgs::PointField::UINT32: {
+          uint32_t time;
+          std::memcpy(&time, data, sizeof(time));
+          times[i] = (float) (time * 1e-9);
+          break;
+        }
+        default:
+          return false;
+      }
+    }
+    return true;
+  }
+}
+
+  CalibrationCloudAggregator::CalibrationCloudAggregator() :
+    CalibrationCloudAggregator(ros::NodeHandle(), ros::NodeHandle("~"))
+  {
+  }
+
+  CalibrationCloudAggregator::CalibrationCloudAggregator(const ros::NodeHandle& nh, const ros::NodeHandle& pnh) {
     prior_roll_angle_ = 0.0;
     captured_clouds_ = 0;
+    half_scan_points_ = 0;
+    max_half_scan_points_ = 0;
+    max_point_time_ = 0.0;
+    tf_tolerance_ = 0.0;
 
     laser_frame_ = "";
 
-    scan_sub_ = nh_.subscribe("cloud", 10, &CalibrationCloudAggregator::cloudCallback, this);
-    reset_sub_ = nh_.subscribe("reset_clouds", 10, &CalibrationCloudAggregator::resetCallback, this);
-    point_cloud1_pub_ = nh_.advertise<sensor_msgs::PointCloud2>("half_scan_1",10,false);
-    point_cloud2_pub_ = nh_.advertise<sensor_msgs::PointCloud2>("half_scan_2",10,false);
+    nh_.reset(new ros::NodeHandle(nh));
+    reset_sub_ = nh_->subscribe("reset_clouds", 10, &CalibrationCloudAggregator::resetCallback, this);
+    point_cloud1_pub_ = nh_->advertise<sensor_msgs::PointCloud2>("half_scan_1",10,false);
+    point_cloud2_pub_ = nh_->advertise<sensor_msgs::PointCloud2>("half_scan_2",10,false);
+    // Latched, so that subscribers in the same nodelet manager get the scans without a copy
+    compact_scans_pub_ = nh_->advertise<hector_calibration_msgs::CompactScans>("compact_scans",1,true);
 
-    reset_clouds_srv_ = nh_.advertiseService("reset_clouds", &CalibrationCloudAggregator::resetSrvCallback, this);
+    reset_clouds_srv_ = nh_->advertiseService("reset_clouds", &CalibrationCloudAggregator::resetSrvCallback, this);
 
-    ros::NodeHandle pnh_("~");
-    pnh_.param("target_frame", p_target_frame_, std::string("base_link"));
-    pnh_.param("rotations", rotations_, 1);
+    pnh.param("target_frame", p_target_frame_, std::string("base_link"));
+    pnh.param("rotations", rotations_, 1);
+    pnh.param("quantization_step", p_quantization_step_, 0.0);
+    pnh.param("deskew", p_deskew_, true);
+    pnh.param("voxel_leaf_size", p_voxel_leaf_size_, 0.0);
+    cloud_agg1_.setVoxelLeafSize(p_voxel_leaf_size_);
+    cloud_agg2_.setVoxelLeafSize(p_voxel_leaf_size_);
+    pnh.param("point_time_field", p_point_time_field_, std::string("time"));
 
+    // Clouds wait in the filter instead of blocking the callback until their transform is available
+    int tf_queue_size;
+    pnh.param("tf_queue_size", tf_queue_size, 100);
     tfl_.reset(new tf::TransformListener());
-    double tf_wait_duration;
-    pnh_.param("tf_wait_duration", tf_wait_duration, 0.5);
-    wait_duration_ = ros::Duration(tf_wait_duration);
+    scan_sub_.subscribe(*nh_, "cloud", tf_queue_size);
+    tf_filter_.reset(new tf::MessageFilter<sensor_msgs::PointCloud2>(scan_sub_, *tfl_, p_target_frame_, tf_queue_size, *nh_));
+    tf_filter_->registerCallback(boost::bind(&CalibrationCloudAggregator::cloudCallback, this, _1));
+    tf_filter_->registerFailureCallback(boost::bind(&CalibrationCloudAggregator::transformFailureCallback, this, _1, _2));
+
+    bool profiling;
+    pnh.param("profiling", profiling, false);
+    if (profiling) {
+      Profiler::instance().setEnabled(true);
+      diagnostics_pub_ = nh_->advertise<diagnostic_msgs::DiagnosticArray>("diagnostics", 10);
+    }
+  }
+
+  CalibrationCloudAggregator::CalibrationCloudAggregator(const std::string& target_frame, int rotations) {
+    prior_roll_angle_ = 0.0;
+    captured_clouds_ = 0;
+    half_scan_points_ = 0;
+    max_half_scan_points_ = 0;
+    max_point_time_ = 0.0;
+    tf_tolerance_ = 0.0;
+
+    laser_frame_ = "";
+
+    p_target_frame_ = target_frame;
+    rotations_ = rotations;
+    p_quantization_step_ = 0.0;
+    p_deskew_ = true;
+    p_voxel_leaf_size_ = 0.0;
+    p_point_time_field_ = "time";
   }
 
   void CalibrationCloudAggregator::publishClouds() {
@@ -35,31 +147,25 @@ namespace lidar_calibration {
   }
 
   void CalibrationCloudAggregator::publishCloud(const ros::Publisher& pub, sensor_msgs::PointCloud2& cloud_msg) {
+    if (!pub) {
+      return;
+    }
     cloud_msg.header.frame_id = p_target_frame_;
     cloud_msg.header.stamp = ros::Time::now();
     pub.publish(cloud_msg);
   }
 
-  void CalibrationCloudAggregator::transformCloud(const std::vector<pc_roll_tuple>& cloud_agg, sensor_msgs::PointCloud2& cloud) {
-    pcl::PointCloud<pcl::PointXYZ> tmp_agg_cloud;
-    for (size_t i=0; i < cloud_agg.size(); ++i){
-      Eigen::Affine3d sensor_to_actuator(Eigen::AngleAxisd(cloud_agg[i].second, Eigen::Vector3d::UnitX()));
-      pcl::PointCloud<pcl::PointXYZ> pc_tmp;
-      pcl::transformPointCloud(*cloud_agg[i].first, pc_tmp, sensor_to_actuator);
-
-      if (tmp_agg_cloud.empty()){
-        tmp_agg_cloud = pc_tmp;
-      }else{
-        tmp_agg_cloud += pc_tmp;
-      }
-    }
-    pcl::toROSMsg(tmp_agg_cloud, cloud);
+  void CalibrationCloudAggregator::transformCloud(const PointArena& cloud_agg, sensor_msgs::PointCloud2& cloud) {
+    cloud_agg.toMsg(cloud, true);
   }
 
   void CalibrationCloudAggregator::setPeriodicPublishing(bool status, double period) {
+    if (!nh_) {
+      return;
+    }
     if (status) {
       ROS_INFO_STREAM("[CloudAggregator] Enabled periodic cloud publishing.");
-      timer_ = nh_.createTimer(ros::Duration(period), &CalibrationCloudAggregator::timerCallback, this, false);
+      timer_ = nh_->createTimer(ros::Duration(period), &CalibrationCloudAggregator::timerCallback, this, false);
     } else {
       ROS_INFO_STREAM("[CloudAggregator] Disabled periodic cloud publishing.");
       timer_.stop();
@@ -84,60 +190,210 @@ namespace lidar_calibration {
     cloud_agg1_.clear();
     cloud_agg2_.clear();
     captured_clouds_ = 0;
+    half_scan_points_ = 0;
     prior_roll_angle_ = 0.0;
     request_scans_srv_.shutdown();
+    request_compact_scans_srv_.shutdown();
     ROS_INFO_STREAM("[CloudAggregator] Resetted half scans.");
   }
 
-  void CalibrationCloudAggregator::scanToMsg(const std::vector<pc_roll_tuple>& cloud_agg,
+  void CalibrationCloudAggregator::scanToMsg(const PointArena& cloud_agg,
                                              sensor_msgs::PointCloud2& scan,
-                                             std_msgs::Float64MultiArray& angles)
+                                             std_msgs::Float64MultiArray& angles) const
   {
-    pcl::PointCloud<pcl::PointXYZ> tmp_scan_cloud;
-    std::vector<double> angle_agg;
-    for (size_t i=0; i < cloud_agg.size(); ++i){
-      for (unsigned int j = 0; j < cloud_agg[i].first->size(); j++) {
-        angle_agg.push_back(cloud_agg[i].second);
-      }
-      if (tmp_scan_cloud.empty()){
-        tmp_scan_cloud = *cloud_agg[i].first;
-      }else{
-        tmp_scan_cloud += *cloud_agg[i].first;
+    cloud_agg.toMsg(scan);
+    scan.header.frame_id = laser_frame_;
+    cloud_agg.anglesToMsg(angles.data);
+  }
+
+
+  void CalibrationCloudAggregator::scanToCompactMsg(const PointArena& cloud_agg,
+                                                    hector_calibration_msgs::CompactScan& scan) const
+  {
+    const std::vector<PointArena::Run>& runs = cloud_agg.runs();
+    size_t num_points = 0;
+    bool quantize = p_quantization_step_ > 0;
+    const float max_abs = (float) (std::numeric_limits<int16_t>::max() * p_quantization_step_);
+    scan.offsets.resize(runs.size());
+    scan.counts.resize(runs.size());
+    scan.angles.resize(runs.size());
+    for (size_t i = 0; i < runs.size(); ++i) {
+      const pcl::PointXYZ* points = cloud_agg.points(runs[i]);
+      scan.offsets[i] = num_points;
+      scan.counts[i] = runs[i].count;
+      scan.angles[i] = runs[i].angle;
+      num_points += runs[i].count;
+      // Points out of the int16 range (or NaN) can only be stored as float32
+      for (size_t j = 0; j < runs[i].count && quantize; j++) {
+        quantize = std::abs(points[j].x) < max_abs && std::abs(points[j].y) < max_abs && std::abs(points[j].z) < max_abs;
       }
     }
-    pcl::toROSMsg(tmp_scan_cloud, scan);
+
     scan.header.frame_id = laser_frame_;
-    angles.data = angle_agg;
+    if (quantize) {
+      scan.encoding = hector_calibration_msgs::CompactScan::INT16;
+      scan.scale = p_quantization_step_;
+      scan.quantized_points.resize(3 * num_points);
+    } else {
+      scan.encoding = hector_calibration_msgs::CompactScan::FLOAT32;
+      scan.scale = 1.0;
+      scan.points.resize(3 * num_points);
+    }
+    scan.angle_offsets.resize(cloud_agg.hasAngleOffsets() ? num_points : 0);
+    for (size_t i = 0; i < runs.size(); ++i) {
+      const pcl::PointXYZ* points = cloud_agg.points(runs[i]);
+      if (!scan.angle_offsets.empty()) {
+        const float* angle_offsets = cloud_agg.angleOffsets(runs[i]);
+        std::copy(angle_offsets, angle_offsets + runs[i].count, scan.angle_offsets.begin() + scan.offsets[i]);
+      }
+      size_t offset = 3 * scan.offsets[i];
+      for (size_t j = 0; j < runs[i].count; j++) {
+        if (quantize) {
+          scan.quantized_points[offset + 3*j] = (int16_t) std::round(points[j].x / p_quantization_step_);
+          scan.quantized_points[offset + 3*j + 1] = (int16_t) std::round(points[j].y / p_quantization_step_);
+          scan.quantized_points[offset + 3*j + 2] = (int16_t) std::round(points[j].z / p_quantization_step_);
+        } else {
+          scan.points[offset + 3*j] = points[j].x;
+          scan.points[offset + 3*j + 1] = points[j].y;
+          scan.points[offset + 3*j + 2] = points[j].z;
+        }
+      }
+    }
   }
 
-
   bool CalibrationCloudAggregator::requestScansCallback(
       hector_calibration_msgs::RequestScans::Request& request,
       hector_calibration_msgs::RequestScans::Response& response) {
+    getScans(response);
+    return true;
+  }
+
+  void CalibrationCloudAggregator::getScans(hector_calibration_msgs::RequestScans::Response& response) const {
     scanToMsg(cloud_agg1_, response.scan_1, response.angles1);
     scanToMsg(cloud_agg2_, response.scan_2, response.angles2);
+  }
+
+  bool CalibrationCloudAggregator::requestCompactScansCallback(
+      hector_calibration_msgs::RequestCompactScans::Request& request,
+      hector_calibration_msgs::RequestCompactScans::Response& response) {
+    getCompactScans(response);
     return true;
   }
 
+  void CalibrationCloudAggregator::getCompactScans(hector_calibration_msgs::RequestCompactScans::Response& response) const {
+    scanToCompactMsg(cloud_agg1_, response.scan_1);
+    scanToCompactMsg(cloud_agg2_, response.scan_2);
+  }
 
-  void CalibrationCloudAggregator::savePointCloud(const sensor_msgs::PointCloud2::ConstPtr& pc_msg, const tf::StampedTransform &transform) {
+  bool CalibrationCloudAggregator::complete() const {
+    return captured_clouds_ == rotations_*2 + 1;
+  }
+
+
+  void CalibrationCloudAggregator::savePointCloud(const sensor_msgs::PointCloud2::ConstPtr& pc_msg, const tf::StampedTransform &transform,
+                                                  const ActuatorAngleLookup& lookup) {
     if (captured_clouds_ == 0) { // skip first half scan
       return;
     }
-
-    boost::shared_ptr<pcl::PointCloud<pcl::PointXYZ> > pc;
-    pc.reset(new pcl::PointCloud<pcl::PointXYZ>());
-    pcl::fromROSMsg(*pc_msg, *pc);
+    ScopedTimer timer("save_cloud");
 
     double roll, pitch, yaw;
     tf::Matrix3x3(transform.getRotation()).getRPY(roll, pitch, yaw);
 
+    const float* angle_offsets = NULL;
+    if (p_deskew_ && lookup && deskew(*pc_msg, roll, lookup)) {
+      angle_offsets = angle_offsets_.data();
+    }
+
     // add point cloud to current aggregator
-    if (captured_clouds_ % 2 == 1) {
-      cloud_agg1_.push_back(pc_roll_tuple(pc, roll));
-    } else if (captured_clouds_ % 2 == 0) {
-      cloud_agg2_.push_back(pc_roll_tuple(pc, roll));
+    PointArena& cloud_agg = captured_clouds_ % 2 == 1 ? cloud_agg1_ : cloud_agg2_;
+    if (!cloud_agg.append(*pc_msg, roll, angle_offsets)) {
+      ROS_WARN_THROTTLE(5.0, "Cloud in frame %s has no float32 x, y and z fields or is truncated, skipping it. "
+                        "This message is throttled.", pc_msg->header.frame_id.c_str());
+    }
+  }
+
+  bool CalibrationCloudAggregator::deskew(const sensor_msgs::PointCloud2& cloud, double angle, const ActuatorAngleLookup& lookup) {
+    if (!readPointTimes(cloud, p_point_time_field_, point_times_) || point_times_.empty()) {
+      return false;
+    }
+    ScopedTimer timer("deskew");
+    float start_time = *std::min_element(point_times_.begin(), point_times_.end());
+    float end_time = *std::max_element(point_times_.begin(), point_times_.end());
+    max_point_time_ = std::max(max_point_time_, (double) end_time);
+    if (!(end_time > start_time)) {
+      return false;
     }
+
+    double start_angle, end_angle;
+    if (!lookup(cloud.header.frame_id, cloud.header.stamp + ros::Duration(start_time), start_angle) ||
+        !lookup(cloud.header.frame_id, cloud.header.stamp + ros::Duration(end_time), end_angle)) {
+      profileCount("deskew_skipped", 1);
+      return false;
+    }
+
+    // Constant actuator velocity during one cloud
+    double start_offset = normalizeAngle(start_angle - angle);
+    double velocity = normalizeAngle(end_angle - start_angle) / (end_time - start_time);
+    angle_offsets_.resize(point_times_.size());
+    for (size_t i = 0; i < point_times_.size(); i++) {
+      angle_offsets_[i] = (float) (start_offset + velocity * (point_times_[i] - start_time));
+    }
+    return true;
+  }
+
+  bool CalibrationCloudAggregator::lookupActuatorAngle(const std::string& frame, const ros::Time& time, double& angle) const {
+    if (!tfl_ || !tfl_->canTransform(p_target_frame_, frame, time)) {
+      return false;
+    }
+    tf::StampedTransform transform;
+    tfl_->lookupTransform(p_target_frame_, frame, time, transform);
+    double pitch, yaw;
+    tf::Matrix3x3(transform.getRotation()).getRPY(angle, pitch, yaw);
+    return true;
+  }
+
+  void CalibrationCloudAggregator::reserveHalfScans() {
+    max_half_scan_points_ = std::max(max_half_scan_points_, half_scan_points_);
+    half_scan_points_ = 0;
+    // Each aggregator holds one half scan per rotation, with some margin for a varying scan rate.
+    // Voxel filtered half scans only grow with the scene, the largest one so far is the estimate.
+    size_t expected_points = rotations_ * max_half_scan_points_;
+    if (p_voxel_leaf_size_ > 0) {
+      expected_points = std::max(cloud_agg1_.size(), cloud_agg2_.size());
+    }
+    expected_points += expected_points / 8;
+    cloud_agg1_.reserve(expected_points);
+    cloud_agg2_.reserve(expected_points);
+  }
+
+  bool CalibrationCloudAggregator::addCloud(const sensor_msgs::PointCloud2::ConstPtr& cloud_in, const tf::StampedTransform& transform,
+                                            const ActuatorAngleLookup& lookup) {
+    laser_frame_ = cloud_in->header.frame_id;
+    if (captured_clouds_ > rotations_*2) {
+      // don't need more than rotations*2 half scans (dump first)
+      return false;
+    }
+    profileCount("cloud_points", cloud_in->width * cloud_in->height);
+
+    double roll, pitch, yaw;
+    tf::Matrix3x3(transform.getRotation()).getRPY(roll, pitch, yaw);
+
+    bool completed = false;
+    if (prior_roll_angle_ < 0 && roll > 0 || prior_roll_angle_ > 0 && roll < 0) {
+      // mark cloud as complete
+      captured_clouds_++;
+      reserveHalfScans();
+      half_scan_points_ += cloud_in->width * cloud_in->height;
+      savePointCloud(cloud_in, transform, lookup);
+      ROS_INFO_STREAM("[CloudAggregator] Captured half scan number: " << captured_clouds_ << "/" << (rotations_*2+1));
+      completed = complete();
+    } else {
+      half_scan_points_ += cloud_in->width * cloud_in->height;
+      savePointCloud(cloud_in, transform, lookup);
+    }
+    prior_roll_angle_ = roll;
+    return completed;
   }
 
   void CalibrationCloudAggregator::cloudCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud_in) {
@@ -146,32 +402,66 @@ namespace lidar_calibration {
       // don't need more than rotations*2 half scans (dump first)
       return;
     }
-    if (tfl_->waitForTransform(p_target_frame_, cloud_in->header.frame_id, cloud_in->header.stamp, wait_duration_)) {
-      tf::StampedTransform transform;
+    ScopedTimer callback_timer("cloud_callback");
+    ScopedTimer tf_timer("tf_lookup");
+    tf::StampedTransform transform;
+    try {
       tfl_->lookupTransform(p_target_frame_, cloud_in->header.frame_id, cloud_in->header.stamp, transform);
+    } catch (const tf::TransformException& e) {
+      ROS_WARN_STREAM_THROTTLE(5.0, "[CloudAggregator] " << e.what());
+      return;
+    }
+    tf_timer.stop();
 
-      double roll, pitch, yaw;
-      tf::Matrix3x3(transform.getRotation()).getRPY(roll, pitch, yaw);
-
-      if (prior_roll_angle_ < 0 && roll > 0 || prior_roll_angle_ > 0 && roll < 0) {
-        // mark cloud as complete
-        captured_clouds_++;
-        savePointCloud(cloud_in, transform);
-        ROS_INFO_STREAM("[CloudAggregator] Captured half scan number: " << captured_clouds_ << "/" << (rotations_*2+1));
-        if (captured_clouds_ == rotations_*2 + 1) {
-          request_scans_srv_ = nh_.advertiseService("request_scans", &CalibrationCloudAggregator::requestScansCallback, this);
-          transformCloud(cloud_agg1_, cloud1_);
-          transformCloud(cloud_agg2_, cloud2_);
-          publishClouds();
-        }
-      } else {
-        savePointCloud(cloud_in, transform);
+    unsigned int prior_captured_clouds = captured_clouds_;
+    bool completed = addCloud(cloud_in, transform,
+                              boost::bind(&CalibrationCloudAggregator::lookupActuatorAngle, this, _1, _2, _3));
+    if (max_point_time_ > tf_tolerance_) {
+      // Wait until the actuator angle at the last point of a cloud is known, so it can be deskewed
+      tf_tolerance_ = max_point_time_;
+      tf_filter_->setTolerance(ros::Duration(tf_tolerance_));
+    }
+    if (completed) {
+      request_scans_srv_ = nh_->advertiseService("request_scans", &CalibrationCloudAggregator::requestScansCallback, this);
+      request_compact_scans_srv_ = nh_->advertiseService("request_compact_scans",
+                                                         &CalibrationCloudAggregator::requestCompactScansCallback, this);
+      {
+        ScopedTimer timer("assemble");
+        transformCloud(cloud_agg1_, cloud1_);
+        transformCloud(cloud_agg2_, cloud2_);
+      }
+      {
+        ScopedTimer timer("publish");
+        hector_calibration_msgs::CompactScansPtr compact_scans(new hector_calibration_msgs::CompactScans());
+        scanToCompactMsg(cloud_agg1_, compact_scans->scan_1);
+        scanToCompactMsg(cloud_agg2_, compact_scans->scan_2);
+        compact_scans_pub_.publish(compact_scans);
+        publishClouds();
       }
-      prior_roll_angle_ = roll;
-    }else{
+      callback_timer.stop();
+      if (Profiler::instance().enabled()) {
+        ROS_INFO_STREAM("[CloudAggregator] Profiling summary:\n" << Profiler::instance().summary());
+      }
+    }
+    if (captured_clouds_ != prior_captured_clouds) {
+      Profiler::instance().publishDiagnostics(diagnostics_pub_, "cloud_aggregator");
+    }
+  }
+
+  void CalibrationCloudAggregator::transformFailureCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud_in,
+                                                            tf::filter_failure_reasons::FilterFailureReason reason) {
+    if (captured_clouds_ > rotations_*2) {
+      return;
+    }
+    if (reason == tf::filter_failure_reasons::Unknown) {
+      // Dropped because the queue is full, the transform lags by more than tf_queue_size clouds
+      profileCount("tf_dropped_clouds", 1);
+      ROS_WARN_THROTTLE(5.0, "Dropped cloud, no transform from sensor %s to target %s yet. Increase tf_queue_size if "
+                             "tf lags. This message is throttled.",
+                        cloud_in->header.frame_id.c_str(), p_target_frame_.c_str());
+    } else {
       ROS_WARN_THROTTLE(5.0, "Cannot transform from sensor %s to target %s. This message is throttled.",
-                         cloud_in->header.frame_id.c_str(),
-                         p_target_frame_.c_str());
+                        cloud_in->header.frame_id.c_str(), p_target_frame_.c_str());
     }
   }
 }
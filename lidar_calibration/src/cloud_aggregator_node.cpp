@@ -1,10 +1,12 @@
-#include <lidar_calibration/cloud_aggregator.h>
+#include <ros/ros.h>
+#include <nodelet/loader.h>
 
 int main(int argc, char** argv) {
   ros::init(argc, argv, "cloud_aggregator_node");
-  ros::NodeHandle nh;
-  hector_calibration::lidar_calibration::CalibrationCloudAggregator agg;
-  agg.setPeriodicPublishing(true, 10.0);
+  nodelet::Loader nodelet;
+  nodelet::M_string remap(ros::names::getRemappings());
+  nodelet::V_string nargv;
+  nodelet.load(ros::this_node::getName(), "lidar_calibration/CloudAggregatorNodelet", remap, nargv);
   ros::spin();
 
   return 0;
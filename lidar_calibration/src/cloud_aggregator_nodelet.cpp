@@ -0,0 +1,23 @@
+#include <lidar_calibration/cloud_aggregator.h>
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+class CloudAggregatorNodelet : public nodelet::Nodelet {
+private:
+  virtual void onInit() {
+    aggregator_.reset(new CalibrationCloudAggregator(getNodeHandle(), getPrivateNodeHandle()));
+    aggregator_->setPeriodicPublishing(true, 10.0);
+  }
+
+  boost::shared_ptr<CalibrationCloudAggregator> aggregator_;
+};
+
+}
+}
+
+PLUGINLIB_EXPORT_CLASS(hector_calibration::lidar_calibration::CloudAggregatorNodelet, nodelet::Nodelet)
@@ -0,0 +1,191 @@
+#include <lidar_calibration/gauss_newton_solver.h>
+
+#include <Eigen/Cholesky>
+
+#include <algorithm>
+#include <sstream>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+namespace {
+  // Number of terms summed into one partial result. Fixed, so the order of the reduction is too.
+  const unsigned int REDUCTION_BLOCK_SIZE = 4096;
+
+  // J'J (upper triangle, row major), J'r and r'r
+  const unsigned int NUM_SUMS = 15;
+}
+
+bool solverBackendFromString(const std::string& name, SolverBackendType& type) {
+  if (name == "ceres") {
+    type = CERES_SOLVER;
+  } else if (name == "gauss_newton") {
+    type = GAUSS_NEWTON_SOLVER;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+std::string solverBackendToString(SolverBackendType type) {
+  switch (type) {
+    case GAUSS_NEWTON_SOLVER: return "gauss_newton";
+    case CERES_SOLVER:
+    default: return "ceres";
+  }
+}
+
+std::string GaussNewtonSummary::briefReport() const {
+  std::stringstream ss;
+  ss << "Gauss-Newton Report: Iterations: " << iterations
+     << ", Initial cost: " << initial_cost
+     << ", Final cost: " << final_cost
+     << ", Termination: " << (converged ? "CONVERGENCE" : "NO_CONVERGENCE");
+  return ss.str();
+}
+
+GaussNewtonSolver::GaussNewtonSolver(const GaussNewtonOptions& options) :
+  options_(options)
+{
+}
+
+double GaussNewtonSolver::accumulate(const PointPlaneCoefficients& coefficients, const Eigen::Vector4d& parameters,
+                                     Eigen::Matrix4d& jtj, Eigen::Vector4d& jtr) const
+{
+  CalibrationRotation rotation(parameters(0), parameters(1));
+  // Row major copies of the rotation and its derivatives
+  double h[9], hp[9], hy[9];
+  for (unsigned int j = 0; j < 9; j++) {
+    h[j] = rotation.rotation(j / 3, j % 3);
+    hp[j] = rotation.d_pitch(j / 3, j % 3);
+    hy[j] = rotation.d_yaw(j / 3, j % 3);
+  }
+  const double t0 = parameters(2), t1 = parameters(3);
+  const std::vector<double>* c = coefficients.values;
+
+  const size_t n = coefficients.size();
+  const long num_blocks = (n + REDUCTION_BLOCK_SIZE - 1) / REDUCTION_BLOCK_SIZE;
+  std::vector<double> partial_sums(num_blocks * NUM_SUMS);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) shared (partial_sums, c)
+#endif
+  for (long b = 0; b < num_blocks; b++) {
+    const size_t begin = b * REDUCTION_BLOCK_SIZE;
+    const int count = (int) std::min<size_t>(REDUCTION_BLOCK_SIZE, n - begin);
+    const double* a0 = &c[0][begin]; const double* a1 = &c[1][begin]; const double* a2 = &c[2][begin];
+    const double* a3 = &c[3][begin]; const double* a4 = &c[4][begin]; const double* a5 = &c[5][begin];
+    const double* a6 = &c[6][begin]; const double* a7 = &c[7][begin]; const double* a8 = &c[8][begin];
+    const double* dy = &c[9][begin]; const double* dz = &c[10][begin];
+
+    double s00 = 0, s01 = 0, s02 = 0, s03 = 0, s11 = 0, s12 = 0, s13 = 0, s22 = 0, s23 = 0, s33 = 0;
+    double g0 = 0, g1 = 0, g2 = 0, g3 = 0, rr = 0;
+#ifdef _OPENMP
+#pragma omp simd reduction(+:s00,s01,s02,s03,s11,s12,s13,s22,s23,s33,g0,g1,g2,g3,rr)
+#endif
+    for (int i = 0; i < count; i++) {
+      const double jy = dy[i];
+      const double jz = dz[i];
+      const double r = h[0]*a0[i] + h[1]*a1[i] + h[2]*a2[i]
+                     + h[3]*a3[i] + h[4]*a4[i] + h[5]*a5[i]
+                     + h[6]*a6[i] + h[7]*a7[i] + h[8]*a8[i]
+                     + jy*t0 + jz*t1;
+      const double jp = hp[0]*a0[i] + hp[1]*a1[i] + hp[2]*a2[i]
+                      + hp[3]*a3[i] + hp[4]*a4[i] + hp[5]*a5[i]
+                      + hp[6]*a6[i] + hp[7]*a7[i] + hp[8]*a8[i];
+      const double jw = hy[0]*a0[i] + hy[1]*a1[i] + hy[2]*a2[i]
+                      + hy[3]*a3[i] + hy[4]*a4[i] + hy[5]*a5[i]
+                      + hy[6]*a6[i] + hy[7]*a7[i] + hy[8]*a8[i];
+      s00 += jp*jp; s01 += jp*jw; s02 += jp*jy; s03 += jp*jz;
+      s11 += jw*jw; s12 += jw*jy; s13 += jw*jz;
+      s22 += jy*jy; s23 += jy*jz;
+      s33 += jz*jz;
+      g0 += jp*r; g1 += jw*r; g2 += jy*r; g3 += jz*r;
+      rr += r*r;
+    }
+
+    double* sums = &partial_sums[b * NUM_SUMS];
+    sums[0] = s00; sums[1] = s01; sums[2] = s02; sums[3] = s03;
+    sums[4] = s11; sums[5] = s12; sums[6] = s13;
+    sums[7] = s22; sums[8] = s23;
+    sums[9] = s33;
+    sums[10] = g0; sums[11] = g1; sums[12] = g2; sums[13] = g3;
+    sums[14] = rr;
+  }
+
+  // Deterministic reduction in block order
+  double total[NUM_SUMS] = {0};
+  for (long b = 0; b < num_blocks; b++) {
+    for (unsigned int k = 0; k < NUM_SUMS; k++) {
+      total[k] += partial_sums[b * NUM_SUMS + k];
+    }
+  }
+
+  jtj << total[0], total[1], total[2], total[3],
+         total[1], total[4], total[5], total[6],
+         total[2], total[5], total[7], total[8],
+         total[3], total[6], total[8], total[9];
+  jtr << total[10], total[11], total[12], total[13];
+  return 0.5 * total[14];
+}
+
+void GaussNewtonSolver::solve(const PointPlaneCoefficients& coefficients, double* rotation, double* translation,
+                              GaussNewtonSummary* summary) const
+{
+  Eigen::Vector4d x(rotation[0], rotation[1], translation[0], translation[1]);
+  Eigen::Matrix4d jtj;
+  Eigen::Vector4d jtr;
+  double cost = accumulate(coefficients, x, jtj, jtr);
+
+  GaussNewtonSummary result;
+  result.initial_cost = cost;
+
+  // Levenberg-Marquardt style damping, only increased if a step fails
+  double lambda = 1e-8;
+  for (unsigned int iteration = 0; iteration < options_.max_iterations; iteration++) {
+    result.iterations = iteration + 1;
+    Eigen::Matrix4d damped = jtj;
+    damped.diagonal() *= (1 + lambda);
+    Eigen::Vector4d delta = damped.ldlt().solve(-jtr);
+    if (!delta.allFinite()) {
+      break;
+    }
+    if (delta.norm() <= options_.parameter_tolerance * (x.norm() + options_.parameter_tolerance)) {
+      result.converged = true;
+      break;
+    }
+
+    // The pass at the new parameters also linearizes for the next step
+    Eigen::Vector4d x_new = x + delta;
+    Eigen::Matrix4d jtj_new;
+    Eigen::Vector4d jtr_new;
+    double cost_new = accumulate(coefficients, x_new, jtj_new, jtr_new);
+    if (cost_new <= cost) {
+      double decrease = cost - cost_new;
+      x = x_new;
+      jtj = jtj_new;
+      jtr = jtr_new;
+      lambda = std::max(lambda / 10, 1e-8);
+      bool converged = decrease <= options_.function_tolerance * cost;
+      cost = cost_new;
+      if (converged) {
+        result.converged = true;
+        break;
+      }
+    } else {
+      lambda *= 10;
+    }
+  }
+
+  result.final_cost = cost;
+  rotation[0] = x(0);
+  rotation[1] = x(1);
+  translation[0] = x(2);
+  translation[1] = x(3);
+  if (summary) {
+    *summary = result;
+  }
+}
+
+}
+}
@@ -0,0 +1,81 @@
+#include <lidar_calibration/laser_scan_buffer.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+namespace {
+  // Points per parallel block, the inner loop of a block is vectorized
+  const long TRANSFORM_BLOCK_SIZE = 4096;
+}
+
+LaserScanBuffer::LaserScanBuffer(const std::vector<LaserPoint<double> >& scan) {
+  assign(scan);
+}
+
+void LaserScanBuffer::assign(const std::vector<LaserPoint<double> >& scan) {
+  const size_t n = scan.size();
+  x_.resize(n);
+  y_.resize(n);
+  z_.resize(n);
+  cos_angle_.resize(n);
+  sin_angle_.resize(n);
+  ActuatorRotation rotation;
+  for (size_t i = 0; i < n; i++) {
+    x_[i] = scan[i].point.x();
+    y_[i] = scan[i].point.y();
+    z_[i] = scan[i].point.z();
+    rotation.setAngle(scan[i].angle);
+    cos_angle_[i] = rotation.cos_angle;
+    sin_angle_[i] = rotation.sin_angle;
+  }
+}
+
+void LaserScanBuffer::toActuatorCloud(const Eigen::Affine3d& calibration, pcl::PointCloud<pcl::PointXYZ>& cloud) const {
+  const size_t n = size();
+  cloud.resize(n);
+  cloud.width = n;
+  cloud.height = 1;
+
+  const Eigen::Matrix3d r = calibration.linear();
+  const double r00 = r(0, 0), r01 = r(0, 1), r02 = r(0, 2);
+  const double r10 = r(1, 0), r11 = r(1, 1), r12 = r(1, 2);
+  const double r20 = r(2, 0), r21 = r(2, 1), r22 = r(2, 2);
+  const double t0 = calibration.translation()(0);
+  const double t1 = calibration.translation()(1);
+  const double t2 = calibration.translation()(2);
+
+  const double* x = x_.data();
+  const double* y = y_.data();
+  const double* z = z_.data();
+  const double* c = cos_angle_.data();
+  const double* s = sin_angle_.data();
+  pcl::PointXYZ* out = cloud.points.data();
+
+  const long num_blocks = (n + TRANSFORM_BLOCK_SIZE - 1) / TRANSFORM_BLOCK_SIZE;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) shared (x, y, z, c, s, out)
+#endif
+  for (long b = 0; b < num_blocks; b++) {
+    const long begin = b * TRANSFORM_BLOCK_SIZE;
+    const long end = std::min<long>(begin + TRANSFORM_BLOCK_SIZE, n);
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for (long i = begin; i < end; i++) {
+      // Calibration, then rotation around the x-axis of the actuator
+      const double px = r00*x[i] + r01*y[i] + r02*z[i] + t0;
+      const double py = r10*x[i] + r11*y[i] + r12*z[i] + t1;
+      const double pz = r20*x[i] + r21*y[i] + r22*z[i] + t2;
+      out[i].x = (float) px;
+      out[i].y = (float) (c[i]*py - s[i]*pz);
+      out[i].z = (float) (s[i]*py + c[i]*pz);
+    }
+  }
+}
+
+}
+}
@@ -1,5 +1,9 @@
 #include <lidar_calibration/lidar_calibration.h>
 
+#include <sys/select.h>
+#include <unistd.h>
+#include <cerrno>
+
 namespace hector_calibration {
 
 namespace lidar_calibration {
@@ -8,80 +12,124 @@ void LidarCalibration::enableNormalVisualization(bool normals) {
   vis_normals_ = normals;
 }
 
-std::vector<LaserPoint<double> >
-LidarCalibration::cropCloud(const std::vector<LaserPoint<double> > &scan, double range) {
-  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_ptr(new pcl::PointCloud<pcl::PointXYZ>);
-  *cloud_ptr = laserToActuatorCloud(scan, options_.init_calibration);
-
-  pcl::CropBox<pcl::PointXYZ> crop_box_filter(true);
-  crop_box_filter.setInputCloud(cloud_ptr);
-  crop_box_filter.setNegative(true);
-  Eigen::Vector4f box_v(1, 1, 1, 1);
-
-  Eigen::Vector4f min_v = -range*box_v;
-  min_v[3] = 1;
-  Eigen::Vector4f max_v = range*box_v;
-  min_v[3] = 1;
-
-  crop_box_filter.setMin(min_v);
-  crop_box_filter.setMax(max_v);
-
-  pcl::PointCloud<pcl::PointXYZ> cloud_cropped;
-  crop_box_filter.filter(cloud_cropped);
-
-//  pcl::PointIndices pcl_indices = crop_box_filter.getRemovedIndices();
-  std::vector<int> indices = *crop_box_filter.getRemovedIndices();
-  std::sort(indices.begin(), indices.end());
-
-  std::vector<int>::iterator to_delete_it = indices.begin();
-  std::vector<LaserPoint<double> > scan_cropped;
-  for (unsigned int i = 0; i < scan.size(); i++) {
-    if (to_delete_it == indices.end()) { // no more indices
-      scan_cropped.push_back(scan[i]);
-    } else {
-      if (*to_delete_it != i) { // current index not in to_delete
-        scan_cropped.push_back(scan[i]);
-      } else { // current index in to_delete
-        to_delete_it++;
-      }
-    }
-  }
-  ROS_INFO_STREAM("Cropped " << indices.size() << " points from scan");
-
-  return scan_cropped;
+void LidarCalibration::cropCloud(std::vector<LaserPoint<double> >& scan, ScanLines* lines) const {
+  size_t removed = cropScan(scan, options_.init_calibration.getTransform(), options_.crop, lines);
+  ROS_INFO_STREAM("Cropped " << removed << " points from scan");
 }
 
-LidarCalibration::LidarCalibration(const ros::NodeHandle& nh) :
+LidarCalibration::LidarCalibration() :
+  tf_wait_duration_(5.0),
+  save_calibration_(false),
+  save_path_(""),
+  actuator_frame_("lidar_actuator_frame"),
+  rotation_offset_(Eigen::Affine3d::Identity()),
+  ceres_problem_(RESIDUAL_CHUNK_SIZE),
+  compact_scans_(true),
+  subscribe_scans_(false),
   manual_mode_(false),
   vis_normals_(false),
-  nh_(nh),
+  stop_requested_(false)
+{
+}
+
+LidarCalibration::LidarCalibration(const ros::NodeHandle& nh) :
+  LidarCalibration(nh, ros::NodeHandle("~"))
+{
+}
+
+LidarCalibration::LidarCalibration(const ros::NodeHandle& nh, const ros::NodeHandle& pnh) :
+  tf_wait_duration_(5.0),
   save_calibration_(false),
   save_path_(""),
-  rotation_offset_(Eigen::Affine3d::Identity())
+  nh_(new ros::NodeHandle(nh)),
+  pnh_(new ros::NodeHandle(pnh)),
+  rotation_offset_(Eigen::Affine3d::Identity()),
+  ceres_problem_(RESIDUAL_CHUNK_SIZE),
+  compact_scans_(true),
+  subscribe_scans_(false),
+  manual_mode_(false),
+  vis_normals_(false),
+  stop_requested_(false)
 {
-  cloud1_pub_ = nh_.advertise<sensor_msgs::PointCloud2>("result_cloud1", 1000);
-  cloud2_pub_ = nh_.advertise<sensor_msgs::PointCloud2>("result_cloud2", 1000);
-  ground_plane_pub_ = nh_.advertise<sensor_msgs::PointCloud2>("ground_plane", 1000);
-  neighbor_pub_ = nh_.advertise<visualization_msgs::MarkerArray>("neighbor_mapping", 1000);
-  planarity_pub_ = nh_.advertise<visualization_msgs::MarkerArray>("planarity", 1000);
+  tfl_.reset(new tf::TransformListener());
+  cloud1_pub_ = nh_->advertise<sensor_msgs::PointCloud2>("result_cloud1", 1000);
+  cloud2_pub_ = nh_->advertise<sensor_msgs::PointCloud2>("result_cloud2", 1000);
+  ground_plane_pub_ = nh_->advertise<sensor_msgs::PointCloud2>("ground_plane", 1000);
+  neighbor_pub_ = nh_->advertise<visualization_msgs::MarkerArray>("neighbor_mapping", 1000);
+  planarity_pub_ = nh_->advertise<visualization_msgs::MarkerArray>("planarity", 1000);
 
-  request_scans_client_ = nh_.serviceClient<hector_calibration_msgs::RequestScans>("request_scans");
-  reset_clouds_client_ = nh_.serviceClient<std_srvs::Empty>("reset_clouds");
+  request_scans_client_ = nh_->serviceClient<hector_calibration_msgs::RequestScans>("request_scans");
+  request_compact_scans_client_ = nh_->serviceClient<hector_calibration_msgs::RequestCompactScans>("request_compact_scans");
+  reset_clouds_client_ = nh_->serviceClient<std_srvs::Empty>("reset_clouds");
 
-  ros::NodeHandle pnh("~");
   pnh.param<std::string>("actuator_frame", actuator_frame_, "lidar_actuator_frame");
+  pnh.param<bool>("subscribe_scans", subscribe_scans_, false);
+  if (subscribe_scans_) {
+    compact_scans_sub_ = nh_->subscribe("compact_scans", 1, &LidarCalibration::compactScansCallback, this);
+  }
+
+  bool profiling;
+  pnh.param<bool>("profiling", profiling, false);
+  if (profiling) {
+    Profiler::instance().setEnabled(true);
+    diagnostics_pub_ = nh_->advertise<diagnostic_msgs::DiagnosticArray>("diagnostics", 10);
+  }
 }
 
 bool LidarCalibration::loadOptionsFromParamServer() {
+  if (!pnh_) {
+    return false;
+  }
+  const ros::NodeHandle& pnh = *pnh_;
   int max_iterations;
-  ros::NodeHandle pnh("~");
   pnh.param<int>("max_iterations", max_iterations, 20);
   max_iterations = options_.max_iterations;
   pnh.param<double>("max_sqrt_neighbor_dist", options_.max_sqrt_neighbor_dist, 0.1);
   pnh.param<double>("sqrt_convergence_diff_thres", options_.sqrt_convergence_diff_thres, 1e-6);
   pnh.param<double>("normals_radius", options_.normals_radius, 0.07);
+  std::string normals_search_backend;
+  pnh.param<std::string>("normals_search_backend", normals_search_backend, "kdtree");
+  if (!searchBackendFromString(normals_search_backend, options_.normals_search_backend)) {
+    ROS_WARN_STREAM("Unknown normals_search_backend '" << normals_search_backend << "'. Using kdtree.");
+    options_.normals_search_backend = KDTREE;
+  }
+  pnh.param<bool>("organized_normals", options_.organized_normals, false);
+  pnh.param<bool>("compact_scans", compact_scans_, true);
+  std::string solver_backend;
+  pnh.param<std::string>("solver_backend", solver_backend, "ceres");
+  if (!solverBackendFromString(solver_backend, options_.solver_backend)) {
+    ROS_WARN_STREAM("Unknown solver_backend '" << solver_backend << "'. Using ceres.");
+    options_.solver_backend = CERES_SOLVER;
+  }
+  loadSolverOptions(pnh, options_.solver_options);
   pnh.param<bool>("detect_ground_plane", options_.detect_ground_plane, false);
   pnh.param<bool>("detect_ceiling", options_.detect_ceiling, false);
+  std::vector<double> pyramid_leaf_sizes;
+  std::vector<double> pyramid_max_sqrt_neighbor_dists;
+  std::vector<double> pyramid_normals_radii;
+  double pyramid_convergence_diff_thres;
+  int pyramid_max_iterations;
+  pnh.param("pyramid_leaf_sizes", pyramid_leaf_sizes, std::vector<double>());
+  pnh.param("pyramid_max_sqrt_neighbor_dists", pyramid_max_sqrt_neighbor_dists, std::vector<double>());
+  pnh.param("pyramid_normals_radii", pyramid_normals_radii, std::vector<double>());
+  pnh.param<double>("pyramid_convergence_diff_thres", pyramid_convergence_diff_thres, 1e-4);
+  pnh.param<int>("pyramid_max_iterations", pyramid_max_iterations, 10);
+  options_.pyramid = makePyramid(pyramid_leaf_sizes, pyramid_max_sqrt_neighbor_dists, pyramid_normals_radii,
+                                 pyramid_convergence_diff_thres, std::max(pyramid_max_iterations, 1));
+  pnh.param<double>("sampling_min_weight", options_.sampling.min_weight, 0.05);
+  int max_residuals;
+  pnh.param<int>("max_residuals", max_residuals, 200000);
+  options_.sampling.max_residuals = std::max(max_residuals, 0);
+  int sampling_normal_bins;
+  pnh.param<int>("sampling_normal_bins", sampling_normal_bins, 4);
+  options_.sampling.normal_bins = std::max(sampling_normal_bins, 1);
+  pnh.param<double>("crop_box_size", options_.crop.box_size, 1.0);
+  pnh.param<double>("crop_min_range", options_.crop.min_range, 0.0);
+  pnh.param<double>("crop_max_range", options_.crop.max_range, 0.0);
+  pnh.param<double>("crop_min_azimuth", options_.crop.min_azimuth, -M_PI);
+  pnh.param<double>("crop_max_azimuth", options_.crop.max_azimuth, M_PI);
+  pnh.param<double>("crop_min_height", options_.crop.min_height, -std::numeric_limits<double>::infinity());
+  pnh.param<double>("crop_max_height", options_.crop.max_height, std::numeric_limits<double>::infinity());
   pnh.param<std::string>("ground_frame", ground_frame_, "");
 
   pnh.param<bool>("save_calibration", save_calibration_, false);
@@ -100,19 +148,32 @@ bool LidarCalibration::loadOptionsFromParamServer() {
   double tf_wait_duration;
   pnh.param("tf_wait_duration", tf_wait_duration, 5.0);
   tf_wait_duration_ = ros::Duration(tf_wait_duration);
+  return true;
 }
 
 void LidarCalibration::setOptions(CalibrationOptions options) {
   options_ = options;
 }
 
+void LidarCalibration::setSavePath(const std::string& path) {
+  save_calibration_ = !path.empty();
+  save_path_ = path;
+}
+
 void LidarCalibration::setManualMode(bool manual) {
   manual_mode_ = manual;
 }
 
+void LidarCalibration::stop() {
+  stop_requested_ = true;
+}
+
 void LidarCalibration::setPeriodicPublishing(bool status, double period) {
+  if (!nh_) {
+    return;
+  }
   if (status) {
-    timer_ = nh_.createTimer(ros::Duration(period), &LidarCalibration::timerCallback, this, false);
+    timer_ = nh_->createTimer(ros::Duration(period), &LidarCalibration::timerCallback, this, false);
   } else {
     timer_.stop();
   }
@@ -124,51 +185,266 @@ void LidarCalibration::timerCallback(const ros::TimerEvent&) {
 }
 
 void LidarCalibration::publishResults() {
+  boost::mutex::scoped_lock lock(cloud_msgs_mutex_);
   publishCloud(cloud1_msg_, cloud1_pub_, actuator_frame_);
   publishCloud(cloud2_msg_, cloud2_pub_, actuator_frame_);
 }
 
+void LidarCalibration::publishResults(const pcl::PointCloud<pcl::PointXYZ>& cloud1,
+                                      const pcl::PointCloud<pcl::PointXYZ>& cloud2)
+{
+  boost::mutex::scoped_lock lock(cloud_msgs_mutex_);
+  if (hasSubscribers(cloud1_pub_)) {
+    toXYZCloud(cloud1, cloud1_msg_);
+    publishCloud(cloud1_msg_, cloud1_pub_, actuator_frame_);
+  }
+  if (hasSubscribers(cloud2_pub_)) {
+    toXYZCloud(cloud2, cloud2_msg_);
+    publishCloud(cloud2_msg_, cloud2_pub_, actuator_frame_);
+  }
+}
+
 std::vector<LaserPoint<double> >
 LidarCalibration::msgToLaserPoints(const sensor_msgs::PointCloud2& scan,
                                    const std_msgs::Float64MultiArray& angles)
 {
-  pcl::PointCloud<pcl::PointXYZ> pcl_scan;
-  pcl::fromROSMsg(scan, pcl_scan);
+  ConstXYZView view = makeXYZView(scan);
+  if (view.size() != angles.data.size()) {
+    ROS_ERROR_STREAM("Scan with " << view.size() << " xyz points does not match its " << angles.data.size() << " angles.");
+  }
+  std::vector<LaserPoint<double> > laser_points(std::min(view.size(), angles.data.size()));
+  ConstXYZView::iterator it = view.begin();
+  for (size_t i = 0; i < laser_points.size(); i++, ++it) {
+    laser_points[i].point = (*it).cast<double>();
+    laser_points[i].angle = angles.data[i];
+  }
+  return laser_points;
+}
+
+std::vector<LaserPoint<double> >
+LidarCalibration::msgToLaserPoints(const hector_calibration_msgs::CompactScan& scan, ScanLines& lines)
+{
   std::vector<LaserPoint<double> > laser_points;
-  for (unsigned int i = 0; i < pcl_scan.size(); i++) {
-    LaserPoint<double> lp;
-    lp.point = Eigen::Vector3d(pcl_scan[i].x, pcl_scan[i].y, pcl_scan[i].z);
-    lp.angle = angles.data[i];
-    laser_points.push_back(lp);
+  lines = ScanLines();
+  if (scan.encoding != hector_calibration_msgs::CompactScan::FLOAT32
+      && scan.encoding != hector_calibration_msgs::CompactScan::INT16) {
+    ROS_ERROR_STREAM("Compact scan has unknown encoding " << (int) scan.encoding << ".");
+    return laser_points;
+  }
+  if (scan.offsets.size() != scan.angles.size() || scan.counts.size() != scan.angles.size()) {
+    ROS_ERROR_STREAM("Compact scan has " << scan.angles.size() << " runs, but " << scan.offsets.size()
+                     << " offsets and " << scan.counts.size() << " counts.");
+    return laser_points;
+  }
+  bool quantized = scan.encoding == hector_calibration_msgs::CompactScan::INT16;
+  size_t num_points = (quantized ? scan.quantized_points.size() : scan.points.size()) / 3;
+  laser_points.resize(num_points);
+  bool deskewed = scan.angle_offsets.size() == num_points;
+  for (size_t r = 0; r < scan.angles.size(); r++) {
+    size_t end = std::min<size_t>(scan.offsets[r] + scan.counts[r], num_points);
+    for (size_t i = scan.offsets[r]; i < end; i++) {
+      if (quantized) {
+        laser_points[i].point = scan.scale * Eigen::Vector3d(scan.quantized_points[3*i],
+                                                             scan.quantized_points[3*i + 1],
+                                                             scan.quantized_points[3*i + 2]);
+      } else {
+        laser_points[i].point = Eigen::Vector3d(scan.points[3*i], scan.points[3*i + 1], scan.points[3*i + 2]);
+      }
+      laser_points[i].angle = scan.angles[r];
+      if (deskewed) {
+        laser_points[i].angle += scan.angle_offsets[i];
+      }
+    }
   }
+  // Each run is one scan message, the angle offsets of deskewing do not split it
+  lines = scanLinesFromRuns(scan.angles, scan.offsets, scan.counts, num_points);
   return laser_points;
 }
 
-void LidarCalibration::requestScans(std::vector<LaserPoint<double> >& scan1,
-                  std::vector<LaserPoint<double> >& scan2) {
+ScanLines LidarCalibration::scanLinesFromLaserPoints(const std::vector<LaserPoint<double> >& scan) const {
+  ScanLines lines;
+  if (!options_.organized_normals) {
+    return lines;
+  }
+  std::vector<double> angles(scan.size());
+  for (unsigned int i = 0; i < scan.size(); i++) {
+    angles[i] = scan[i].angle;
+  }
+  lines = scanLinesFromAngles(angles);
+  // Deskewed points have individual angles and would each become a line
+  if (lines.size() > 0 && scan.size() < lines.size() * OrganizedNeighborhood().min_neighbors) {
+    ROS_WARN_STREAM("Scan lines from point angles are degenerate (" << lines.size() << " lines for " << scan.size()
+                    << " points), the angles are probably deskewed. Use compact scans to keep the scan lines. "
+                    << "Falling back to the spatial normal search.");
+    lines = ScanLines();
+  }
+  return lines;
+}
+
+void LidarCalibration::compactScansCallback(const hector_calibration_msgs::CompactScansConstPtr& scans) {
+  boost::mutex::scoped_lock lock(compact_scans_mutex_);
+  compact_scans_msg_ = scans;
+}
+
+bool LidarCalibration::waitForService(ros::ServiceClient& client) const {
+  while (ok()) {
+    if (client.waitForExistence(ros::Duration(0.5))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool LidarCalibration::waitForEnter() const {
+  while (ok()) {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(STDIN_FILENO, &fds);
+    timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 100000;
+    int ready = select(STDIN_FILENO + 1, &fds, NULL, NULL, &timeout);
+    if (ready > 0) {
+      std::string line;
+      std::getline(std::cin, line);
+      return true;
+    }
+    if (ready < 0 && errno != EINTR) {
+      return false;
+    }
+  }
+  return false;
+}
+
+bool LidarCalibration::requestScans(std::vector<LaserPoint<double> >& scan1,
+                                    std::vector<LaserPoint<double> >& scan2,
+                                    ScanLines& scan1_lines) {
+  if (subscribe_scans_) {
+    // Shared with the aggregator if both run in the same nodelet manager
+    hector_calibration_msgs::CompactScansConstPtr scans;
+    ROS_INFO_STREAM("Waiting for half scans on " << compact_scans_sub_.getTopic() << ".");
+    while (ok() && !scans) {
+      {
+        boost::mutex::scoped_lock lock(compact_scans_mutex_);
+        scans = compact_scans_msg_;
+      }
+      if (!scans) {
+        ros::WallDuration(0.1).sleep();
+      }
+    }
+    if (!scans) {
+      return false;
+    }
+    scansFromCompactScans(scans->scan_1, scans->scan_2, scan1, scan2, scan1_lines);
+    return true;
+  }
+  if (compact_scans_) {
+    hector_calibration_msgs::RequestCompactScansRequest request;
+    hector_calibration_msgs::RequestCompactScansResponse response;
+    if (!waitForService(request_compact_scans_client_)) {
+      return false;
+    }
+    request_compact_scans_client_.call(request, response);
+    scansFromResponse(response, scan1, scan2, scan1_lines);
+    return true;
+  }
   hector_calibration_msgs::RequestScansRequest request;
   hector_calibration_msgs::RequestScansResponse response;
-  request_scans_client_.waitForExistence();
+  if (!waitForService(request_scans_client_)) {
+    return false;
+  }
   request_scans_client_.call(request, response);
+  scansFromResponse(response, scan1, scan2, scan1_lines);
+  return true;
+}
+
+void LidarCalibration::scansFromResponse(const hector_calibration_msgs::RequestScansResponse& response,
+                                         std::vector<LaserPoint<double> >& scan1,
+                                         std::vector<LaserPoint<double> >& scan2,
+                                         ScanLines& scan1_lines)
+{
   scan1 = msgToLaserPoints(response.scan_1, response.angles1);
   scan2 = msgToLaserPoints(response.scan_2, response.angles2);
   laser_frame_ = response.scan_1.header.frame_id;
   if (scan2.size() < scan1.size()) { // Switch scan1 and scan2
-    std::vector<LaserPoint<double> >tmp = scan1;
-    scan1 = scan2;
-    scan2 = tmp;
+    scan1.swap(scan2);
+  }
+  scan1_lines = scanLinesFromLaserPoints(scan1);
+}
+
+void LidarCalibration::scansFromResponse(const hector_calibration_msgs::RequestCompactScansResponse& response,
+                                         std::vector<LaserPoint<double> >& scan1,
+                                         std::vector<LaserPoint<double> >& scan2,
+                                         ScanLines& scan1_lines)
+{
+  scansFromCompactScans(response.scan_1, response.scan_2, scan1, scan2, scan1_lines);
+}
+
+void LidarCalibration::scansFromCompactScans(const hector_calibration_msgs::CompactScan& compact_scan1,
+                                             const hector_calibration_msgs::CompactScan& compact_scan2,
+                                             std::vector<LaserPoint<double> >& scan1,
+                                             std::vector<LaserPoint<double> >& scan2,
+                                             ScanLines& scan1_lines)
+{
+  ScanLines scan2_lines;
+  scan1 = msgToLaserPoints(compact_scan1, scan1_lines);
+  scan2 = msgToLaserPoints(compact_scan2, scan2_lines);
+  laser_frame_ = compact_scan1.header.frame_id;
+  if (scan2.size() < scan1.size()) { // Switch scan1 and scan2
+    scan1.swap(scan2);
+    scan1_lines.begin.swap(scan2_lines.begin);
   }
 }
 
+bool LidarCalibration::ok() const {
+  return !stop_requested_ && (!nh_ || ros::ok());
+}
+
 void LidarCalibration::calibrate() {
-  reset_clouds_client_.waitForExistence();
+  if (!waitForService(reset_clouds_client_)) {
+    return;
+  }
   std_srvs::Empty empty_srv;
 //  reset_clouds_client_.call(empty_srv);
 
   std::vector<LaserPoint<double> > scan1;
   std::vector<LaserPoint<double> > scan2;
-  requestScans(scan1, scan2);
+  ScanLines scan1_lines;
+  {
+    ScopedTimer timer("request_scans");
+    if (!requestScans(scan1, scan2, scan1_lines)) {
+      return;
+    }
+  }
+  calibrate(std::move(scan1), std::move(scan2), std::move(scan1_lines));
+}
+
+Calibration LidarCalibration::calibrate(const hector_calibration_msgs::RequestScansResponse& scans) {
+  std::vector<LaserPoint<double> > scan1;
+  std::vector<LaserPoint<double> > scan2;
+  ScanLines scan1_lines;
+  scansFromResponse(scans, scan1, scan2, scan1_lines);
+  return calibrate(std::move(scan1), std::move(scan2), std::move(scan1_lines));
+}
+
+Calibration LidarCalibration::calibrate(const hector_calibration_msgs::RequestCompactScansResponse& scans) {
+  std::vector<LaserPoint<double> > scan1;
+  std::vector<LaserPoint<double> > scan2;
+  ScanLines scan1_lines;
+  scansFromResponse(scans, scan1, scan2, scan1_lines);
+  return calibrate(std::move(scan1), std::move(scan2), std::move(scan1_lines));
+}
+
+Calibration LidarCalibration::calibrate(std::vector<LaserPoint<double> > scan1, std::vector<LaserPoint<double> > scan2) {
+  ScanLines scan1_lines = scanLinesFromLaserPoints(scan1);
+  return calibrate(std::move(scan1), std::move(scan2), std::move(scan1_lines));
+}
+
+Calibration LidarCalibration::calibrate(std::vector<LaserPoint<double> > scan1, std::vector<LaserPoint<double> > scan2,
+                                        ScanLines scan1_lines) {
+  ScopedTimer total_timer("total");
   ROS_INFO_STREAM("Received point clouds of sizes " << scan1.size() << " and " << scan2.size() << ".");
+  profileCount("scan_points", scan1.size() + scan2.size());
 
   // get transforms
   if (o_laser_frame_ != "" && o_spin_frame_ != "") {
@@ -178,92 +454,194 @@ void LidarCalibration::calibrate() {
     plane_transform_ = getTransform(ground_frame_, actuator_frame_);
   }
 
-  scan1 = cropCloud(scan1, 1);
-  scan2 = cropCloud(scan2, 1);
+  {
+    ScopedTimer timer("crop");
+    cropCloud(scan1, &scan1_lines);
+    cropCloud(scan2);
+  }
 
+  Calibration current_calibration = options_.init_calibration;
   pcl::PointCloud<pcl::PointXYZ> cloud1;
   pcl::PointCloud<pcl::PointXYZ> cloud2;
-
-  Calibration previous_calibration = options_.init_calibration;
-  Calibration current_calibration = options_.init_calibration;
-
   unsigned int iteration_counter = 0;
-  do {
-    ROS_INFO_STREAM("-------------- Starting iteration " << (iteration_counter+1) << "--------------");
-    // Transform laser points to actuator frame using current calibration
-    applyCalibration(scan1, scan2, cloud1, cloud2, current_calibration);
-
-    // Publish current results
-    pcl::toROSMsg(cloud1, cloud1_msg_);
-    pcl::toROSMsg(cloud2, cloud2_msg_);
-    publishResults();
 
-    // Compute normals with weight
-    std::vector<WeightedNormal> normals = computeNormals(cloud1, options_.normals_radius);
-    if (vis_normals_) {
-      visualizeNormals(cloud1, normals);
+  // Coarse to fine, each level starts with the calibration of the previous one
+  for (size_t l = 0; l < options_.pyramid.size() && ok(); l++) {
+    const PyramidLevel& level = options_.pyramid[l];
+    std::vector<LaserPoint<double> > level_scan1;
+    std::vector<LaserPoint<double> > level_scan2;
+    {
+      ScopedTimer timer("pyramid");
+      Eigen::Affine3d calibration_transform = current_calibration.getTransform();
+      level_scan1 = voxelDownsample(scan1, calibration_transform, level.leaf_size);
+      level_scan2 = voxelDownsample(scan2, calibration_transform, level.leaf_size);
     }
+    ROS_INFO_STREAM("Pyramid level " << l << " with leaf size " << level.leaf_size << ": "
+                    << level_scan1.size() << " and " << level_scan2.size() << " points.");
+    // Downsampled levels have no line structure
+    current_calibration = iterate(level_scan1, level_scan2, ScanLines(), level, current_calibration, cloud1, cloud2,
+                                  iteration_counter);
+  }
 
-    // Find neighbors
-    std::map<unsigned int, unsigned int> neighbor_mapping = findNeighbors(cloud1, cloud2, options_.max_sqrt_neighbor_dist);
-    publishNeighbors(cloud1, cloud2, neighbor_mapping, neighbor_pub_, actuator_frame_);
-
-    previous_calibration = current_calibration;
-    current_calibration = optimizeCalibration(scan1, scan2, current_calibration, normals, neighbor_mapping);
-    iteration_counter++;
-    if (manual_mode_ && ros::ok()) {
-      ROS_INFO_STREAM("Press [ENTER] to proceed with next iteration.");
-      std::cin.get();
-    }
-  } while(ros::ok() && !maxIterationsReached(iteration_counter)
-          &&  !checkConvergence(previous_calibration, current_calibration));
+  PyramidLevel full_resolution;
+  full_resolution.max_sqrt_neighbor_dist = options_.max_sqrt_neighbor_dist;
+  full_resolution.normals_radius = options_.normals_radius;
+  full_resolution.convergence_diff_thres = options_.sqrt_convergence_diff_thres;
+  full_resolution.max_iterations = options_.max_iterations;
+  if (ok()) {
+    current_calibration = iterate(scan1, scan2, scan1_lines, full_resolution, current_calibration, cloud1, cloud2,
+                                  iteration_counter);
+  }
 
   if (options_.detect_ground_plane || options_.detect_ceiling) {
 
     double ground_roll;
     double ground_pitch;
 
+    ScopedTimer timer("ground_plane");
     detectGroundPlane(cloud1, cloud2, ground_roll, ground_pitch);
 
     Eigen::Affine3d ground_roll_transform(Eigen::AngleAxisd(ground_roll, Eigen::Vector3d::UnitX()));
     current_calibration = current_calibration.applyTransform(ground_roll_transform);
 
-    applyCalibration(scan1, scan2, cloud1, cloud2, current_calibration);
-    pcl::toROSMsg(cloud1, cloud1_msg_);
-    pcl::toROSMsg(cloud2, cloud2_msg_);
-    publishResults();
+    applyCalibration(LaserScanBuffer(scan1), LaserScanBuffer(scan2), cloud1, cloud2, current_calibration);
+    publishResults(cloud1, cloud2);
   }
 
-  ROS_INFO_STREAM("Result: " << current_calibration.applyRotationOffset(rotation_offset_).toString());
+  // Last clouds for periodic publishing
+  if (nh_) {
+    boost::mutex::scoped_lock lock(cloud_msgs_mutex_);
+    toXYZCloud(cloud1, cloud1_msg_);
+    toXYZCloud(cloud2, cloud2_msg_);
+  }
+
+  Calibration result = current_calibration.applyRotationOffset(rotation_offset_);
+  ROS_INFO_STREAM("Result: " << result.toString());
   if (save_calibration_ && save_path_ != "") {
     ROS_INFO_STREAM("Saving calibration to: " << save_path_);
-    saveToDisk(save_path_, current_calibration.applyRotationOffset(rotation_offset_));
+    saveToDisk(save_path_, result);
+  }
+
+  total_timer.stop();
+  if (Profiler::instance().enabled()) {
+    Profiler::instance().publishDiagnostics(diagnostics_pub_, "lidar_calibration");
+    ROS_INFO_STREAM("Profiling summary:\n" << Profiler::instance().summary());
   }
+  return result;
+}
+
+Calibration LidarCalibration::iterate(const std::vector<LaserPoint<double> >& scan1,
+                                      const std::vector<LaserPoint<double> >& scan2,
+                                      const ScanLines& scan1_lines,
+                                      const PyramidLevel& level,
+                                      const Calibration& init_calibration,
+                                      pcl::PointCloud<pcl::PointXYZ>& cloud1,
+                                      pcl::PointCloud<pcl::PointXYZ>& cloud2,
+                                      unsigned int& iteration_counter)
+{
+  // Transformed in every iteration, the clouds keep their memory
+  LaserScanBuffer scan1_buffer(scan1);
+  LaserScanBuffer scan2_buffer(scan2);
+
+  Calibration previous_calibration = init_calibration;
+  Calibration current_calibration = init_calibration;
+
+  // Search indices are kept over iterations to reuse their memory
+  NeighborSearch cloud1_search(options_.normals_search_backend, level.normals_radius);
+  NeighborSearch cloud2_search(KDTREE);
+  Correspondences correspondences;
+
+  // Each scan message is one line of the half scan
+  const bool organized_normals = options_.organized_normals && scan1_lines.size() > 0
+                                 && scan1_lines.begin.back() == scan1.size();
+  if (organized_normals) {
+    ROS_INFO_STREAM("Using organized normal estimation with " << scan1_lines.size() << " scan lines.");
+  }
+
+  unsigned int level_iterations = 0;
+  do {
+    ROS_INFO_STREAM("-------------- Starting iteration " << (iteration_counter+1) << "--------------");
+    ScopedTimer iteration_timer("iteration");
+    // Transform laser points to actuator frame using current calibration
+    {
+      ScopedTimer timer("apply_calibration");
+      applyCalibration(scan1_buffer, scan2_buffer, cloud1, cloud2, current_calibration);
+    }
+    profileCount("points", cloud1.size() + cloud2.size());
+
+    // Publish current results, the clouds are only converted for subscribers
+    {
+      ScopedTimer timer("publish");
+      publishResults(cloud1, cloud2);
+    }
+
+    // Compute normals with weight
+    std::vector<WeightedNormal> normals;
+    {
+      ScopedTimer timer("normals");
+      if (organized_normals) {
+        normals = computeOrganizedNormals(cloud1, scan1_lines, level.normals_radius, cloud1_search);
+      } else {
+        cloud1_search.updatePoints(cloud1);
+        normals = computeNormals(cloud1_search, level.normals_radius);
+      }
+    }
+    if (vis_normals_) {
+      visualizeNormals(cloud1, normals);
+    }
+
+    // Find neighbors of planar points
+    {
+      ScopedTimer timer("neighbors");
+      cloud2_search.updatePoints(cloud2);
+      findNeighbors(cloud1, cloud2_search, normals, options_.sampling.min_weight, correspondences,
+                    level.max_sqrt_neighbor_dist);
+    }
+    profileCount("matches", correspondences.size());
+    {
+      ScopedTimer timer("sampling");
+      sampleCorrespondences(normals, options_.sampling, correspondences);
+    }
+    profileCount("residuals", correspondences.size());
+    {
+      ScopedTimer timer("publish");
+      publishNeighbors(cloud1, cloud2, correspondences, neighbor_pub_, actuator_frame_);
+    }
+
+    previous_calibration = current_calibration;
+    {
+      ScopedTimer timer("optimize");
+      current_calibration = optimizeCalibration(scan1, scan2, current_calibration, normals, correspondences);
+    }
+    level_iterations++;
+    iteration_counter++;
+    iteration_timer.stop();
+    Profiler::instance().publishDiagnostics(diagnostics_pub_, "lidar_calibration");
+    if (manual_mode_ && ok()) {
+      ROS_INFO_STREAM("Press [ENTER] to proceed with next iteration.");
+      waitForEnter();
+    }
+  } while(ok() && !maxIterationsReached(level_iterations, level.max_iterations)
+          &&  !checkConvergence(previous_calibration, current_calibration, level.convergence_diff_thres));
+  return current_calibration;
 }
 
 pcl::PointCloud<pcl::PointXYZ>
 LidarCalibration::laserToActuatorCloud(const std::vector<LaserPoint<double> >& laserpoints, const Calibration& calibration) const {
   pcl::PointCloud<pcl::PointXYZ> pcl_cloud;
-  Eigen::Affine3d calibration_transform = calibration.getTransform();
-  for (unsigned int i = 0; i < laserpoints.size(); i++) {
-    Eigen::Vector3d actuator_point = laserpoints[i].getInActuatorFrame(calibration_transform);
-    pcl::PointXYZ pcl_x;
-    pcl_x.x = actuator_point.x();
-    pcl_x.y = actuator_point.y();
-    pcl_x.z = actuator_point.z();
-    pcl_cloud.push_back(pcl_x);
-  }
+  LaserScanBuffer(laserpoints).toActuatorCloud(calibration.getTransform(), pcl_cloud);
   return pcl_cloud;
 }
 
-void LidarCalibration::applyCalibration(const std::vector<LaserPoint<double> > &scan1,
-                                        const std::vector<LaserPoint<double> > &scan2,
+void LidarCalibration::applyCalibration(const LaserScanBuffer& scan1,
+                                        const LaserScanBuffer& scan2,
                                         pcl::PointCloud<pcl::PointXYZ>& cloud1,
                                         pcl::PointCloud<pcl::PointXYZ>& cloud2,
                                         const Calibration& calibration)
 {
-  cloud1 = laserToActuatorCloud(scan1, calibration);
-  cloud2 = laserToActuatorCloud(scan2, calibration);
+  Eigen::Affine3d calibration_transform = calibration.getTransform();
+  scan1.toActuatorCloud(calibration_transform, cloud1);
+  scan2.toActuatorCloud(calibration_transform, cloud2);
 }
 
 Calibration
@@ -271,35 +649,21 @@ LidarCalibration::optimizeCalibration(const std::vector<LaserPoint<double> >& sc
                                       const std::vector<LaserPoint<double> >& scan2,
                                       const Calibration& current_calibration,
                                       const std::vector<WeightedNormal> &normals,
-                                      const std::map<unsigned int, unsigned int> neighbor_mapping) const
+                                      const Correspondences& correspondences)
 {
   if (scan1.size() != normals.size()) {
     ROS_ERROR_STREAM("Size of scan1 (" << scan1.size() << ") doesn't match size of normals (" << normals.size() << ").");
     return Calibration();
   }
 
-  ceres::Problem problem;
-
   double rotation[2] = {current_calibration.pitch, current_calibration.yaw};
   double translation[2] = {current_calibration.y, current_calibration.z};
 
-  unsigned int residual_count = 0;
-  for(std::map<unsigned int, unsigned int>::const_iterator it = neighbor_mapping.begin(); it != neighbor_mapping.end(); it++) {
-    unsigned int s1_index = it->first;
-    unsigned int s2_index = it->second;
-
-    ceres::CostFunction* cost_function = PointPlaneError::Create(scan1[s1_index], scan2[s2_index], normals[s1_index]);
-
-    problem.AddResidualBlock(cost_function, NULL, rotation, translation);
-    residual_count++;
+  if (options_.solver_backend == GAUSS_NEWTON_SOLVER) {
+    solveGaussNewton(scan1, scan2, normals, correspondences, rotation, translation);
+  } else {
+    solveCeres(scan1, scan2, normals, correspondences, rotation, translation);
   }
-  ROS_INFO_STREAM("Number of residuals: " << residual_count);
-
-  ceres::Solver::Options options;
-  //options.minimizer_progress_to_stdout = true;
-  ceres::Solver::Summary summary;
-  ceres::Solve(options, &problem, &summary);
-  std::cout << summary.BriefReport() << "\n";
 
   Calibration calibration;
   calibration.y = translation[0];
@@ -314,6 +678,59 @@ LidarCalibration::optimizeCalibration(const std::vector<LaserPoint<double> >& sc
   return calibration;
 }
 
+void LidarCalibration::solveCeres(const std::vector<LaserPoint<double> >& scan1,
+                                  const std::vector<LaserPoint<double> >& scan2,
+                                  const std::vector<WeightedNormal>& normals,
+                                  const Correspondences& correspondences,
+                                  double* rotation, double* translation)
+{
+  // The problem persists over iterations, only the residual data is replaced
+  std::copy(rotation, rotation + 2, ceres_problem_.rotation());
+  std::copy(translation, translation + 2, ceres_problem_.translation());
+  ceres_problem_.resize(correspondences.size());
+  const unsigned int chunk_size = ceres_problem_.chunkSize();
+#ifdef _OPENMP
+#pragma omp parallel for shared (correspondences, scan1, scan2, normals)
+#endif
+  for (long i = 0; i < (long) correspondences.size(); i++) {
+    unsigned int s1_index = correspondences.source[i];
+    unsigned int s2_index = correspondences.target[i];
+    ceres_problem_.chunkOf(i).set(i % chunk_size, scan1[s1_index], scan2[s2_index], normals[s1_index]);
+  }
+  ROS_INFO_STREAM("Number of residuals: " << correspondences.size() << " in "
+                  << (correspondences.size() + chunk_size - 1) / chunk_size << " blocks");
+
+  ceres::Solver::Summary summary;
+  ceres_problem_.solve(options_.solver_options, &summary);
+  std::cout << summary.BriefReport() << "\n";
+  std::copy(ceres_problem_.rotation(), ceres_problem_.rotation() + 2, rotation);
+  std::copy(ceres_problem_.translation(), ceres_problem_.translation() + 2, translation);
+}
+
+void LidarCalibration::solveGaussNewton(const std::vector<LaserPoint<double> >& scan1,
+                                        const std::vector<LaserPoint<double> >& scan2,
+                                        const std::vector<WeightedNormal>& normals,
+                                        const Correspondences& correspondences,
+                                        double* rotation, double* translation) const
+{
+  PointPlaneCoefficients coefficients;
+  coefficients.resize(correspondences.size());
+#ifdef _OPENMP
+#pragma omp parallel for shared (coefficients, correspondences, scan1, scan2, normals)
+#endif
+  for (long i = 0; i < (long) correspondences.size(); i++) {
+    unsigned int s1_index = correspondences.source[i];
+    unsigned int s2_index = correspondences.target[i];
+    coefficients.set(i, PointPlaneTerm(scan1[s1_index], scan2[s2_index], normals[s1_index]));
+  }
+  ROS_INFO_STREAM("Number of residuals: " << correspondences.size());
+
+  GaussNewtonSolver solver;
+  GaussNewtonSummary summary;
+  solver.solve(coefficients, rotation, translation, &summary);
+  std::cout << summary.briefReport() << "\n";
+}
+
 bool LidarCalibration::detectGroundPlane(const pcl::PointCloud<pcl::PointXYZ> &cloud1,
                                          const pcl::PointCloud<pcl::PointXYZ> &cloud2,
                                          double& roll,
@@ -373,12 +790,7 @@ bool LidarCalibration::detectGroundPlane(const pcl::PointCloud<pcl::PointXYZ> &c
   extract.filter(*ground_plane);
 
   // Publish plane
-  sensor_msgs::PointCloud2 ground_plane_msg;
-  pcl::toROSMsg(*ground_plane, ground_plane_msg);
-  ground_plane_msg.header.frame_id = actuator_frame_;
-  ground_plane_msg.header.stamp = ros::Time::now();
-
-  ground_plane_pub_.publish(ground_plane_msg);
+  publishCloud(*ground_plane, ground_plane_pub_, actuator_frame_);
 
   // Calculate angle from ground plane to actuator frame around x-axis
   double nx = coefficients.values[0]; double ny = coefficients.values[1]; double nz = coefficients.values[2];
@@ -396,14 +808,15 @@ bool LidarCalibration::detectGroundPlane(const pcl::PointCloud<pcl::PointXYZ> &c
 }
 
 bool LidarCalibration::checkConvergence(const Calibration& prev_calibration,
-                                         const Calibration& current_calibration) const
+                                         const Calibration& current_calibration,
+                                         double threshold) const
 {
   double cum_sqrt_diff = 0;
   for (unsigned int i = 0; i < Calibration::NUM_FREE_PARAMS; i++) {
     cum_sqrt_diff += std::pow(current_calibration(i) - prev_calibration(i), 2);
   }
   ROS_INFO_STREAM("Squared change in parameters: " << cum_sqrt_diff);
-  if (cum_sqrt_diff < options_.sqrt_convergence_diff_thres) {
+  if (cum_sqrt_diff < threshold) {
     ROS_INFO_STREAM("-------------- CONVERGENCE --------------");
     return true;
   } else {
@@ -411,8 +824,8 @@ bool LidarCalibration::checkConvergence(const Calibration& prev_calibration,
   }
 }
 
-bool LidarCalibration::maxIterationsReached(unsigned int current_iterations) const {
-  if (current_iterations < options_.max_iterations) {
+bool LidarCalibration::maxIterationsReached(unsigned int current_iterations, unsigned int max_iterations) const {
+  if (current_iterations < max_iterations) {
     return false;
   }  else {
     ROS_INFO_STREAM("-------- MAX ITERATIONS REACHED ---------");
@@ -450,10 +863,14 @@ bool LidarCalibration::saveToDisk(std::string path, const Calibration& calibrati
 }
 
 Eigen::Affine3d LidarCalibration::getTransform(std::string frame_base, std::string frame_target) const {
+  if (!tfl_) {
+    ROS_WARN_STREAM("No tf available. Using identity from " << frame_base << " to " << frame_target << ".");
+    return Eigen::Affine3d::Identity();
+  }
   ros::Time now = ros::Time::now();
-  if (tfl_.waitForTransform(frame_base, frame_target, now, tf_wait_duration_)) {
+  if (tfl_->waitForTransform(frame_base, frame_target, now, tf_wait_duration_)) {
     tf::StampedTransform transform;
-    tfl_.lookupTransform(frame_base, frame_target, now, transform);
+    tfl_->lookupTransform(frame_base, frame_target, now, transform);
 
     Eigen::Affine3d transform_eigen;
     tf::transformTFToEigen(transform, transform_eigen);
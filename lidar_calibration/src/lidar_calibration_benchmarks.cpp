@@ -0,0 +1,306 @@
+#include <lidar_calibration/lidar_calibration.h>
+#include <multi_lidar_calibration/multi_lidar_calibration.h>
+
+#include <benchmark/benchmark.h>
+
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+
+using namespace hector_calibration::lidar_calibration;
+
+namespace {
+
+const unsigned int SCENE_SEED = 42;
+const double NORMALS_RADIUS = 0.07;
+const double MAX_SQR_NEIGHBOR_DIST = 0.1;
+
+// Exposes the protected stages
+class LidarCalibrationBenchmark : public LidarCalibration {
+public:
+  using LidarCalibration::laserToActuatorCloud;
+  using LidarCalibration::cropCloud;
+  using LidarCalibration::optimizeCalibration;
+};
+
+class MultiLidarCalibrationBenchmark : public MultiLidarCalibration {
+public:
+  using MultiLidarCalibration::optimize;
+};
+
+/**
+ * Points sampled uniformly on the walls, floor and ceiling of a box shaped
+ * room around the actuator. Both half scans see the same room with the
+ * ground truth calibration; the angles are random, so the scene is only
+ * meant for timing.
+ */
+struct Scene {
+  std::vector<LaserPoint<double> > scan1;
+  std::vector<LaserPoint<double> > scan2;
+  // Actuator frame with the ground truth calibration
+  pcl::PointCloud<pcl::PointXYZ> cloud1;
+  pcl::PointCloud<pcl::PointXYZ> cloud2;
+};
+
+Calibration groundTruth() {
+  return Calibration(0, 0.02, 0.05, 0, 0.01, -0.02);
+}
+
+Eigen::Vector3d sampleRoom(std::mt19937& rng) {
+  const Eigen::Vector3d min(-4, -3, -1);
+  const Eigen::Vector3d max(4, 3, 2);
+  const Eigen::Vector3d size = max - min;
+  // Faces are picked proportional to their area
+  const double areas[3] = {size.y() * size.z(), size.x() * size.z(), size.x() * size.y()};
+  std::uniform_real_distribution<double> uniform(0, 1);
+  double pick = uniform(rng) * (areas[0] + areas[1] + areas[2]);
+  unsigned int axis = pick < areas[0] ? 0 : (pick < areas[0] + areas[1] ? 1 : 2);
+  Eigen::Vector3d p;
+  for (unsigned int i = 0; i < 3; i++) {
+    p(i) = min(i) + uniform(rng) * size(i);
+  }
+  p(axis) = uniform(rng) < 0.5 ? min(axis) : max(axis);
+  return p;
+}
+
+void generateHalfScan(std::mt19937& rng, size_t size, double angle_offset,
+                      std::vector<LaserPoint<double> >& scan, pcl::PointCloud<pcl::PointXYZ>& cloud)
+{
+  std::uniform_real_distribution<double> angle(0, M_PI);
+  std::normal_distribution<double> noise(0, 0.005);
+  Eigen::Affine3d calibration_inv = groundTruth().getTransform().inverse();
+  scan.resize(size);
+  cloud.resize(size);
+  for (size_t i = 0; i < size; i++) {
+    Eigen::Vector3d p = sampleRoom(rng) + Eigen::Vector3d(noise(rng), noise(rng), noise(rng));
+    double a = angle_offset + angle(rng);
+    scan[i].angle = a;
+    scan[i].point = calibration_inv * (Eigen::AngleAxisd(-a, Eigen::Vector3d::UnitX()) * p);
+    cloud[i] = pcl::PointXYZ(p.x(), p.y(), p.z());
+  }
+}
+
+// Scenes are generated once per size and seeded, so all runs see the same points
+const Scene& scene(size_t size) {
+  static std::map<size_t, Scene> scenes;
+  std::map<size_t, Scene>::iterator it = scenes.find(size);
+  if (it == scenes.end()) {
+    std::mt19937 rng(SCENE_SEED);
+    Scene& s = scenes[size];
+    generateHalfScan(rng, size / 2, 0, s.scan1, s.cloud1);
+    generateHalfScan(rng, size - size / 2, M_PI, s.scan2, s.cloud2);
+    return s;
+  }
+  return it->second;
+}
+
+// Values from /proc/self/status in MB, 0 if unavailable
+double procStatusMB(const std::string& key) {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, key.size(), key) == 0) {
+      std::stringstream ss(line.substr(key.size() + 1));
+      double kb = 0;
+      ss >> kb;
+      return kb / 1024.0;
+    }
+  }
+  return 0;
+}
+
+// Measures the peak resident memory of a stage. Resetting the peak needs Linux 4.0.
+class PeakMemory {
+public:
+  PeakMemory() {
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    if (clear_refs) {
+      clear_refs << "5";
+    }
+    start_mb_ = procStatusMB("VmRSS:");
+  }
+
+  void report(benchmark::State& state) const {
+    double peak_mb = procStatusMB("VmHWM:");
+    state.counters["peak_MB"] = peak_mb;
+    state.counters["stage_MB"] = std::max(0.0, peak_mb - start_mb_);
+  }
+
+private:
+  double start_mb_;
+};
+
+void reportThroughput(benchmark::State& state, size_t points) {
+  state.SetItemsProcessed(state.iterations() * points);
+  state.counters["points/s"] = benchmark::Counter(points, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+void BM_LaserToActuatorCloud(benchmark::State& state) {
+  const Scene& s = scene(state.range(0));
+  LidarCalibrationBenchmark calibration;
+  Calibration current = groundTruth();
+  PeakMemory memory;
+  for (auto _ : state) {
+    pcl::PointCloud<pcl::PointXYZ> cloud = calibration.laserToActuatorCloud(s.scan1, current);
+    benchmark::DoNotOptimize(cloud.points.data());
+  }
+  memory.report(state);
+  reportThroughput(state, s.scan1.size());
+}
+
+// Transform only, as in every iteration of the calibration
+void BM_LaserScanBuffer(benchmark::State& state) {
+  const Scene& s = scene(state.range(0));
+  LaserScanBuffer buffer(s.scan1);
+  Eigen::Affine3d calibration = groundTruth().getTransform();
+  pcl::PointCloud<pcl::PointXYZ> cloud;
+  PeakMemory memory;
+  for (auto _ : state) {
+    buffer.toActuatorCloud(calibration, cloud);
+    benchmark::DoNotOptimize(cloud.points.data());
+  }
+  memory.report(state);
+  reportThroughput(state, s.scan1.size());
+}
+
+void BM_CropCloud(benchmark::State& state) {
+  const Scene& s = scene(state.range(0));
+  LidarCalibrationBenchmark calibration;
+  PeakMemory memory;
+  std::vector<LaserPoint<double> > cropped;
+  for (auto _ : state) {
+    // The crop is in place, restore the scan untimed
+    state.PauseTiming();
+    cropped = s.scan1;
+    state.ResumeTiming();
+    calibration.cropCloud(cropped);
+    benchmark::DoNotOptimize(cropped.data());
+  }
+  memory.report(state);
+  reportThroughput(state, s.scan1.size());
+}
+
+void BM_ComputeNormals(benchmark::State& state) {
+  const Scene& s = scene(state.range(0));
+  SearchBackendType backend = (SearchBackendType) state.range(1);
+  PeakMemory memory;
+  for (auto _ : state) {
+    NeighborSearch search(backend, NORMALS_RADIUS);
+    search.setInputCloud(s.cloud1);
+    std::vector<WeightedNormal> normals = computeNormals(search, NORMALS_RADIUS);
+    benchmark::DoNotOptimize(normals.data());
+  }
+  memory.report(state);
+  reportThroughput(state, s.cloud1.size());
+  state.SetLabel(searchBackendToString(backend));
+}
+
+void BM_FindNeighbors(benchmark::State& state) {
+  const Scene& s = scene(state.range(0));
+  NeighborSearch search(KDTREE);
+  search.setInputCloud(s.cloud2);
+  Correspondences correspondences;
+  PeakMemory memory;
+  for (auto _ : state) {
+    findNeighbors(s.cloud1, search, correspondences, MAX_SQR_NEIGHBOR_DIST);
+    benchmark::DoNotOptimize(correspondences.source.data());
+  }
+  memory.report(state);
+  reportThroughput(state, s.cloud1.size());
+}
+
+void BM_OptimizeCalibration(benchmark::State& state) {
+  const Scene& s = scene(state.range(0));
+  LidarCalibrationBenchmark calibration;
+  LidarCalibration::CalibrationOptions options;
+  options.solver_backend = (SolverBackendType) state.range(1);
+  calibration.setOptions(options);
+
+  NeighborSearch search(VOXEL_HASH, NORMALS_RADIUS);
+  search.setInputCloud(s.cloud1);
+  std::vector<WeightedNormal> normals = computeNormals(search, NORMALS_RADIUS);
+  NeighborSearch cloud2_search(KDTREE);
+  cloud2_search.setInputCloud(s.cloud2);
+  Correspondences correspondences;
+  findNeighbors(s.cloud1, cloud2_search, correspondences, MAX_SQR_NEIGHBOR_DIST);
+
+  Calibration initial;
+  PeakMemory memory;
+  for (auto _ : state) {
+    Calibration result = calibration.optimizeCalibration(s.scan1, s.scan2, initial, normals, correspondences);
+    benchmark::DoNotOptimize(result);
+  }
+  memory.report(state);
+  reportThroughput(state, s.scan1.size());
+  state.counters["residuals/s"] = benchmark::Counter(correspondences.size(), benchmark::Counter::kIsIterationInvariantRate);
+  state.SetLabel(solverBackendToString(options.solver_backend));
+}
+
+void BM_MultiLidarOptimize(benchmark::State& state) {
+  const Scene& s = scene(state.range(0));
+  MultiLidarCalibrationBenchmark calibration;
+
+  NeighborSearch search(VOXEL_HASH, NORMALS_RADIUS);
+  search.setInputCloud(s.cloud1);
+  std::vector<WeightedNormal> normals = computeNormals(search, NORMALS_RADIUS);
+  NeighborSearch cloud2_search(KDTREE);
+  cloud2_search.setInputCloud(s.cloud2);
+  Correspondences correspondences;
+  findNeighbors(s.cloud1, cloud2_search, correspondences, MAX_SQR_NEIGHBOR_DIST);
+
+  Eigen::Affine3d initial = Eigen::Affine3d::Identity();
+  PeakMemory memory;
+  for (auto _ : state) {
+    Eigen::Affine3d result = calibration.optimize(s.cloud1, s.cloud2, normals, correspondences, initial);
+    benchmark::DoNotOptimize(result);
+  }
+  memory.report(state);
+  reportThroughput(state, s.cloud1.size());
+  state.counters["residuals/s"] = benchmark::Counter(correspondences.size(), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+// Scene sizes count the points of both half scans
+void sceneSizes(benchmark::internal::Benchmark* b) {
+  b->Arg(100000)->Arg(500000)->Arg(1000000)->Arg(5000000);
+  b->Unit(benchmark::kMillisecond)->UseRealTime();
+}
+
+void sceneSizesWithBackend(benchmark::internal::Benchmark* b, int first, int last) {
+  const int sizes[4] = {100000, 500000, 1000000, 5000000};
+  for (unsigned int i = 0; i < 4; i++) {
+    for (int backend = first; backend <= last; backend++) {
+      b->Args({sizes[i], backend});
+    }
+  }
+  b->Unit(benchmark::kMillisecond)->UseRealTime();
+}
+
+void normalsArgs(benchmark::internal::Benchmark* b) {
+  sceneSizesWithBackend(b, KDTREE, VOXEL_HASH);
+}
+
+void solverArgs(benchmark::internal::Benchmark* b) {
+  sceneSizesWithBackend(b, CERES_SOLVER, GAUSS_NEWTON_SOLVER);
+}
+
+}
+
+BENCHMARK(BM_LaserToActuatorCloud)->Apply(sceneSizes);
+BENCHMARK(BM_LaserScanBuffer)->Apply(sceneSizes);
+BENCHMARK(BM_CropCloud)->Apply(sceneSizes);
+BENCHMARK(BM_ComputeNormals)->Apply(normalsArgs);
+BENCHMARK(BM_FindNeighbors)->Apply(sceneSizes);
+BENCHMARK(BM_OptimizeCalibration)->Apply(solverArgs);
+BENCHMARK(BM_MultiLidarOptimize)->Apply(sceneSizes);
+
+int main(int argc, char** argv) {
+  // No ros::init, nothing here needs a master. Only the clock is used for log stamps.
+  ros::Time::init();
+  if (ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME, ros::console::levels::Warn)) {
+    ros::console::notifyLoggerLevelsChanged();
+  }
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -1,40 +1,18 @@
-#include <lidar_calibration/lidar_calibration.h>
-#include <boost/program_options.hpp>
+#include <ros/ros.h>
+#include <nodelet/loader.h>
+#include <glog/logging.h>
 
 int main(int argc, char** argv) {
   ros::init(argc, argv, "lidar_calibration_node");
-
-  ros::NodeHandle nh;
   google::InitGoogleLogging(argv[0]);
-  hector_calibration::lidar_calibration::LidarCalibration calibration(nh);
-
-  boost::program_options::options_description desc("Allowed options");
-
-  desc.add_options()
-      ("help", "produce help message")
-      ("n", "Enable normal visualization")
-      ("m", "Enable manual mode")
-  ;
-
-  boost::program_options::variables_map vmap;
-  boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(desc).allow_unregistered().run(), vmap);
-  boost::program_options::notify(vmap);
-
-  if (vmap.count("help")) {
-    std::cout << desc << std::endl;
-    return 0;
-  }
-  if (vmap.count("n")) {
-    calibration.enableNormalVisualization(true);
-  }
-  if (vmap.count("m")) {
-    calibration.setManualMode(true);
-  }
-
-  calibration.setPeriodicPublishing(true, 5);
-  calibration.loadOptionsFromParamServer();
 
-  calibration.calibrate();
+  // Command line arguments are parsed by the nodelet, the node exits once the calibration is done
+  nodelet::Loader nodelet;
+  nodelet::M_string remap(ros::names::getRemappings());
+  nodelet::V_string nargv(argv + 1, argv + argc);
+  nargv.push_back("--exit_after_calibration");
+  nodelet.load(ros::this_node::getName(), "lidar_calibration/LidarCalibrationNodelet", remap, nargv);
+  ros::spin();
 
   return 0;
 }
@@ -0,0 +1,90 @@
+#include <lidar_calibration/lidar_calibration.h>
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+/**
+ * Runs the calibration in its own thread, callbacks are processed by the
+ * nodelet manager. Accepts the command line arguments of lidar_calibration_node.
+ */
+class LidarCalibrationNodelet : public nodelet::Nodelet {
+public:
+  LidarCalibrationNodelet() :
+    exit_after_calibration_(false)
+  {
+  }
+
+  virtual ~LidarCalibrationNodelet() {
+    if (calibration_) {
+      calibration_->stop();
+    }
+    if (worker_.joinable()) {
+      worker_.join();
+    }
+  }
+
+private:
+  virtual void onInit() {
+    calibration_.reset(new LidarCalibration(getNodeHandle(), getPrivateNodeHandle()));
+
+    boost::program_options::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "produce help message")
+        ("n", "Enable normal visualization")
+        ("m", "Enable manual mode")
+        ("exit_after_calibration", "Shut down the node when the calibration is done, set by lidar_calibration_node")
+    ;
+
+    boost::program_options::variables_map vmap;
+    boost::program_options::store(boost::program_options::command_line_parser(getMyArgv()).options(desc).allow_unregistered().run(), vmap);
+    boost::program_options::notify(vmap);
+
+    exit_after_calibration_ = vmap.count("exit_after_calibration") > 0;
+    if (vmap.count("help")) {
+      std::cout << desc << std::endl;
+      if (exit_after_calibration_) {
+        ros::requestShutdown();
+      }
+      return;
+    }
+    if (vmap.count("n")) {
+      calibration_->enableNormalVisualization(true);
+    }
+    if (vmap.count("m")) {
+      if (exit_after_calibration_) {
+        calibration_->setManualMode(true);
+      } else {
+        // A nodelet manager does not own a terminal to read [ENTER] from
+        NODELET_WARN_STREAM("Manual mode needs the terminal of lidar_calibration_node, ignoring it in a nodelet manager.");
+      }
+    }
+
+    calibration_->setPeriodicPublishing(true, 5);
+    calibration_->loadOptionsFromParamServer();
+
+    worker_ = boost::thread(&LidarCalibrationNodelet::run, this);
+  }
+
+  void run() {
+    calibration_->calibrate();
+    if (exit_after_calibration_) {
+      ros::requestShutdown();
+    }
+  }
+
+  boost::shared_ptr<LidarCalibration> calibration_;
+  // Standalone node, in a nodelet manager the process keeps running
+  bool exit_after_calibration_;
+  boost::thread worker_;
+};
+
+}
+}
+
+PLUGINLIB_EXPORT_CLASS(hector_calibration::lidar_calibration::LidarCalibrationNodelet, nodelet::Nodelet)
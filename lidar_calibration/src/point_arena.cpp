@@ -0,0 +1,192 @@
+#include <lidar_calibration/point_arena.h>
+#include <lidar_calibration/voxel_key.h>
+
+#include <Eigen/Geometry>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+PointArena::PointArena(size_t chunk_size) :
+  chunk_size_(std::max<size_t>(chunk_size, 1)),
+  size_(0),
+  is_dense_(true),
+  has_angle_offsets_(false),
+  voxel_leaf_size_(0.0)
+{
+}
+
+void PointArena::reserve(size_t num_points) {
+  while (capacity() < num_points) {
+    addChunk();
+  }
+}
+
+void PointArena::clear() {
+  runs_.clear();
+  size_ = 0;
+  is_dense_ = true;
+  has_angle_offsets_ = false;
+  voxels_.clear();
+}
+
+void PointArena::setVoxelLeafSize(double leaf_size) {
+  voxel_leaf_size_ = leaf_size;
+  voxels_.clear();
+}
+
+void PointArena::addChunk() {
+  chunks_.push_back(Chunk(chunk_size_));
+  angle_offset_chunks_.push_back(std::vector<float>(chunk_size_));
+}
+
+bool PointArena::append(const sensor_msgs::PointCloud2& cloud, double angle, const float* angle_offsets) {
+  ConstXYZView view = makeXYZView(cloud);
+  if (view.empty()) {
+    return (size_t) cloud.width * cloud.height == 0;
+  }
+  if (voxel_leaf_size_ > 0) {
+    appendVoxelFiltered(view, angle, angle_offsets);
+    return true;
+  }
+  ConstXYZView::iterator it = view.begin();
+
+  size_t remaining = view.size();
+  while (remaining > 0) {
+    size_t chunk = size_ / chunk_size_;
+    size_t offset = size_ % chunk_size_;
+    if (chunk == chunks_.size()) {
+      addChunk();
+    }
+    size_t count = std::min(remaining, chunk_size_ - offset);
+    pcl::PointXYZ* points = &chunks_[chunk][offset];
+    for (size_t i = 0; i < count; ++i, ++it) {
+      points[i].getVector3fMap() = *it;
+    }
+    float* offsets = &angle_offset_chunks_[chunk][offset];
+    if (angle_offsets) {
+      std::copy(angle_offsets, angle_offsets + count, offsets);
+      angle_offsets += count;
+    } else {
+      std::fill(offsets, offsets + count, 0.0f);
+    }
+    runs_.push_back(Run(chunk, offset, count, angle));
+    size_ += count;
+    remaining -= count;
+  }
+  is_dense_ = is_dense_ && cloud.is_dense;
+  has_angle_offsets_ = has_angle_offsets_ || angle_offsets;
+  return true;
+}
+
+void PointArena::appendVoxelFiltered(const ConstXYZView& view, double angle, const float* angle_offsets) {
+  ConstXYZView::iterator it = view.begin();
+
+  const float inv_leaf_size = (float) (1.0 / voxel_leaf_size_);
+  float cos_angle = (float) std::cos(angle);
+  float sin_angle = (float) std::sin(angle);
+  size_t num_points = view.size();
+  bool new_run = true;
+  for (size_t i = 0; i < num_points; ++i, ++it) {
+    Eigen::Vector3f point_in = *it;
+    float x = point_in.x();
+    float y = point_in.y();
+    float z = point_in.z();
+    if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z)) {
+      continue;
+    }
+    float angle_offset = angle_offsets ? angle_offsets[i] : 0.0f;
+    if (angle_offsets) {
+      cos_angle = (float) std::cos(angle + angle_offset);
+      sin_angle = (float) std::sin(angle + angle_offset);
+    }
+    // Voxels are fixed in the actuator frame, the first point of a voxel is kept with its angle
+    if (!voxels_.insert(voxelKey(x, cos_angle * y - sin_angle * z, sin_angle * y + cos_angle * z, inv_leaf_size)).second) {
+      continue;
+    }
+
+    size_t chunk = size_ / chunk_size_;
+    size_t offset = size_ % chunk_size_;
+    if (chunk == chunks_.size()) {
+      addChunk();
+    }
+    if (new_run || offset == 0) {
+      runs_.push_back(Run(chunk, offset, 0, angle));
+      new_run = false;
+    }
+    pcl::PointXYZ& point = chunks_[chunk][offset];
+    point.x = x;
+    point.y = y;
+    point.z = z;
+    angle_offset_chunks_[chunk][offset] = angle_offset;
+    runs_.back().count++;
+    size_++;
+  }
+  has_angle_offsets_ = has_angle_offsets_ || angle_offsets;
+}
+
+void PointArena::toMsg(sensor_msgs::PointCloud2& cloud, bool rotate) const {
+  const char* names[3] = {"x", "y", "z"};
+  cloud.fields.resize(3);
+  for (unsigned int i = 0; i < 3; i++) {
+    cloud.fields[i].name = names[i];
+    cloud.fields[i].offset = 4 * i;
+    cloud.fields[i].datatype = sensor_msgs::PointField::FLOAT32;
+    cloud.fields[i].count = 1;
+  }
+  cloud.height = 1;
+  cloud.width = size_;
+  cloud.is_bigendian = false;
+  cloud.point_step = sizeof(pcl::PointXYZ);
+  cloud.row_step = cloud.point_step * cloud.width;
+  cloud.is_dense = is_dense_;
+  cloud.data.resize(cloud.row_step);
+
+  size_t index = 0;
+  for (size_t r = 0; r < runs_.size(); r++) {
+    const Run& run = runs_[r];
+    const pcl::PointXYZ* run_points = points(run);
+    unsigned char* data = &cloud.data[index * cloud.point_step];
+    if (!rotate) {
+      std::memcpy(data, run_points, run.count * sizeof(pcl::PointXYZ));
+    } else {
+      const float* offsets = angleOffsets(run);
+      Eigen::Matrix3f rotation(Eigen::AngleAxisf((float) run.angle, Eigen::Vector3f::UnitX()));
+      for (size_t i = 0; i < run.count; i++) {
+        if (has_angle_offsets_) {
+          rotation = Eigen::AngleAxisf((float) run.angle + offsets[i], Eigen::Vector3f::UnitX());
+        }
+        Eigen::Vector3f point = rotation * run_points[i].getVector3fMap();
+        float* out = reinterpret_cast<float*>(data + i * cloud.point_step);
+        out[0] = point.x();
+        out[1] = point.y();
+        out[2] = point.z();
+        out[3] = 1.0f;
+      }
+    }
+    index += run.count;
+  }
+}
+
+void PointArena::anglesToMsg(std::vector<double>& angles) const {
+  angles.resize(size_);
+  size_t index = 0;
+  for (size_t r = 0; r < runs_.size(); r++) {
+    const Run& run = runs_[r];
+    std::fill(angles.begin() + index, angles.begin() + index + run.count, run.angle);
+    if (has_angle_offsets_) {
+      const float* offsets = angleOffsets(run);
+      for (size_t i = 0; i < run.count; i++) {
+        angles[index + i] += offsets[i];
+      }
+    }
+    index += run.count;
+  }
+}
+
+}
+}
@@ -0,0 +1,110 @@
+#include <lidar_calibration/scan_crop.h>
+
+#include <algorithm>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+namespace {
+  // Points per parallel block
+  const long CROP_BLOCK_SIZE = 4096;
+}
+
+size_t cropScan(std::vector<LaserPoint<double> >& scan, const Eigen::Affine3d& calibration, const CropOptions& options,
+                ScanLines* lines)
+{
+  const long n = scan.size();
+  const long num_blocks = (n + CROP_BLOCK_SIZE - 1) / CROP_BLOCK_SIZE;
+  std::vector<long> kept(num_blocks, 0);
+  // Line begins that lie inside the scan, as offsets in the compacted block
+  const bool move_lines = lines && lines->size() > 0 && lines->begin.back() == (unsigned int) n;
+  const long num_line_begins = move_lines ? (long) lines->begin.size() - 1 : 0;
+  std::vector<long> line_begins(num_line_begins, 0);
+
+  const bool box = options.box_size > 0;
+  const double box_size = options.box_size;
+  const double min_sqr_range = options.min_range * options.min_range;
+  const double max_sqr_range = options.max_range > 0 ? options.max_range * options.max_range
+                                                     : std::numeric_limits<double>::infinity();
+  const bool sector = options.min_azimuth > -M_PI || options.max_azimuth < M_PI;
+  const bool sector_wraps = options.min_azimuth > options.max_azimuth;
+
+  // Each block evaluates the predicate and moves its kept points to the front of the block
+  LaserPoint<double>* points = scan.data();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) shared (points, kept, calibration, options, lines, line_begins)
+#endif
+  for (long b = 0; b < num_blocks; b++) {
+    const long begin = b * CROP_BLOCK_SIZE;
+    const long end = std::min(begin + CROP_BLOCK_SIZE, n);
+    long out = begin;
+    long line = 0;
+    if (move_lines) {
+      line = std::lower_bound(lines->begin.begin(), lines->begin.end() - 1, (unsigned int) begin) - lines->begin.begin();
+    }
+    ActuatorRotation rotation;
+    for (long i = begin; i < end; i++) {
+      while (line < num_line_begins && (long) lines->begin[line] == i) {
+        line_begins[line++] = out - begin;
+      }
+      const Eigen::Vector3d p = rotation.inActuatorFrame(points[i], calibration);
+      const double x = p.x();
+      const double y = p.y();
+      const double z = p.z();
+
+      const double sqr_range = x*x + y*y + z*z;
+      bool keep = std::isfinite(sqr_range)
+          && sqr_range >= min_sqr_range && sqr_range <= max_sqr_range
+          && z >= options.min_height && z <= options.max_height
+          && !(box && std::abs(x) <= box_size && std::abs(y) <= box_size && std::abs(z) <= box_size);
+      if (keep && sector) {
+        const double azimuth = std::atan2(y, x);
+        keep = sector_wraps ? (azimuth >= options.min_azimuth || azimuth <= options.max_azimuth)
+                            : (azimuth >= options.min_azimuth && azimuth <= options.max_azimuth);
+      }
+      if (keep) {
+        if (out != i) {
+          points[out] = points[i];
+        }
+        out++;
+      }
+    }
+    kept[b] = out - begin;
+  }
+
+  // Close the gaps between the blocks, destinations never pass their source
+  long size = 0;
+  for (long b = 0; b < num_blocks; b++) {
+    const long begin = b * CROP_BLOCK_SIZE;
+    if (size != begin) {
+      std::copy(points + begin, points + begin + kept[b], points + size);
+    }
+    size += kept[b];
+  }
+  scan.resize(size);
+
+  if (move_lines) {
+    std::vector<long> block_begins(num_blocks, 0);
+    for (long b = 1; b < num_blocks; b++) {
+      block_begins[b] = block_begins[b - 1] + kept[b - 1];
+    }
+    std::vector<unsigned int> begins;
+    begins.reserve(lines->begin.size());
+    for (long l = 0; l < num_line_begins; l++) {
+      if ((long) lines->begin[l] >= n) {
+        break;
+      }
+      unsigned int line_begin = (unsigned int) (block_begins[lines->begin[l] / CROP_BLOCK_SIZE] + line_begins[l]);
+      if (line_begin < size && (begins.empty() || line_begin != begins.back())) {
+        begins.push_back(line_begin);
+      }
+    }
+    begins.push_back(size);
+    lines->begin.swap(begins);
+  }
+  return n - size;
+}
+
+}
+}
@@ -0,0 +1,57 @@
+#include <lidar_calibration/scan_pyramid.h>
+#include <lidar_calibration/voxel_key.h>
+
+#include <cmath>
+#include <unordered_set>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+std::vector<PyramidLevel> makePyramid(const std::vector<double>& leaf_sizes,
+                                      const std::vector<double>& max_sqrt_neighbor_dists,
+                                      const std::vector<double>& normals_radii,
+                                      double convergence_diff_thres,
+                                      unsigned int max_iterations)
+{
+  std::vector<PyramidLevel> levels;
+  for (size_t l = 0; l < leaf_sizes.size(); l++) {
+    if (leaf_sizes[l] <= 0) {
+      continue;
+    }
+    PyramidLevel level(leaf_sizes[l]);
+    if (l < max_sqrt_neighbor_dists.size() && max_sqrt_neighbor_dists[l] > 0) {
+      level.max_sqrt_neighbor_dist = max_sqrt_neighbor_dists[l];
+    }
+    if (l < normals_radii.size() && normals_radii[l] > 0) {
+      level.normals_radius = normals_radii[l];
+    }
+    level.convergence_diff_thres = convergence_diff_thres;
+    level.max_iterations = max_iterations;
+    levels.push_back(level);
+  }
+  return levels;
+}
+
+std::vector<LaserPoint<double> > voxelDownsample(const std::vector<LaserPoint<double> >& scan,
+                                                 const Eigen::Affine3d& calibration,
+                                                 double leaf_size)
+{
+  const float inv_leaf_size = (float) (1.0 / leaf_size);
+  std::unordered_set<uint64_t> voxels;
+  std::vector<LaserPoint<double> > downsampled;
+  ActuatorRotation rotation;
+  for (size_t i = 0; i < scan.size(); i++) {
+    const Eigen::Vector3d p = rotation.inActuatorFrame(scan[i], calibration);
+    if (!std::isfinite(p.x()) || !std::isfinite(p.y()) || !std::isfinite(p.z())) {
+      continue;
+    }
+    if (voxels.insert(voxelKey((float) p.x(), (float) p.y(), (float) p.z(), inv_leaf_size)).second) {
+      downsampled.push_back(scan[i]);
+    }
+  }
+  return downsampled;
+}
+
+}
+}
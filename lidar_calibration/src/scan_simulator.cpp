@@ -0,0 +1,148 @@
+#include <lidar_calibration/scan_simulator.h>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl_conversions/pcl_conversions.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+ScanSimulatorOptions::ScanSimulatorOptions() {
+  room_min = Eigen::Vector3d(-4, -3, -1);
+  room_max = Eigen::Vector3d(4, 3, 2);
+  obstacles.push_back(SimulatedBox(Eigen::Vector3d(1.5, -3, -1), Eigen::Vector3d(2.5, -2, 0.5)));  // cabinet
+  obstacles.push_back(SimulatedBox(Eigen::Vector3d(-3, 1, -1), Eigen::Vector3d(-2, 2.2, -0.25)));  // table
+  obstacles.push_back(SimulatedBox(Eigen::Vector3d(0.8, 1.2, -1), Eigen::Vector3d(1.2, 1.6, 2)));  // pillar
+  lines_per_half_scan = 200;
+  beams_per_line = 1081;
+  field_of_view = 1.5 * M_PI;
+  min_range = 0.1;
+  max_range = 30;
+  range_noise = 0.01;
+  seed = 0;
+  laser_frame = "laser_frame";
+}
+
+ScanSimulator::ScanSimulator(const ScanSimulatorOptions& options) :
+  options_(options)
+{
+}
+
+bool ScanSimulator::castRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double& range) const {
+  // Exit distance of the room, the origin is inside
+  double t_hit = std::numeric_limits<double>::max();
+  for (unsigned int i = 0; i < 3; i++) {
+    if (direction(i) > 0) {
+      t_hit = std::min(t_hit, (options_.room_max(i) - origin(i)) / direction(i));
+    } else if (direction(i) < 0) {
+      t_hit = std::min(t_hit, (options_.room_min(i) - origin(i)) / direction(i));
+    }
+  }
+
+  // Entry distance of the obstacles (slab test)
+  for (unsigned int b = 0; b < options_.obstacles.size(); b++) {
+    const SimulatedBox& box = options_.obstacles[b];
+    double t_min = -std::numeric_limits<double>::max();
+    double t_max = std::numeric_limits<double>::max();
+    bool miss = false;
+    for (unsigned int i = 0; i < 3 && !miss; i++) {
+      if (direction(i) == 0) {
+        miss = origin(i) < box.min(i) || origin(i) > box.max(i);
+        continue;
+      }
+      double t1 = (box.min(i) - origin(i)) / direction(i);
+      double t2 = (box.max(i) - origin(i)) / direction(i);
+      t_min = std::max(t_min, std::min(t1, t2));
+      t_max = std::min(t_max, std::max(t1, t2));
+      miss = t_min > t_max;
+    }
+    if (!miss && t_min > 0 && t_min < t_hit) {
+      t_hit = t_min;
+    }
+  }
+
+  if (t_hit < options_.min_range || t_hit > options_.max_range) {
+    return false;
+  }
+  range = t_hit;
+  return true;
+}
+
+std::vector<LaserPoint<double> >
+ScanSimulator::simulateHalfScan(const Calibration& calibration, double start_angle, unsigned int half_scan_index) const {
+  const Eigen::Affine3d mounting = calibration.getTransform();
+  const unsigned int num_lines = options_.lines_per_half_scan;
+  const unsigned int num_beams = options_.beams_per_line;
+  const double beam_increment = num_beams > 1 ? options_.field_of_view / (num_beams - 1) : 0;
+
+  std::vector<std::vector<LaserPoint<double> > > lines(num_lines);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) shared (lines, mounting)
+#endif
+  for (int l = 0; l < (int) num_lines; l++) {
+    std::seed_seq seed{options_.seed, half_scan_index, (unsigned int) l};
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> noise(0, options_.range_noise);
+
+    double angle = start_angle + M_PI * l / num_lines;
+    Eigen::Affine3d laser_to_actuator = Eigen::AngleAxisd(angle, Eigen::Vector3d::UnitX()) * mounting;
+    Eigen::Vector3d origin = laser_to_actuator.translation();
+
+    std::vector<LaserPoint<double> >& line = lines[l];
+    line.reserve(num_beams);
+    for (unsigned int b = 0; b < num_beams; b++) {
+      double beam_angle = -0.5 * options_.field_of_view + b * beam_increment;
+      Eigen::Vector3d beam(std::cos(beam_angle), std::sin(beam_angle), 0);
+      double range;
+      if (!castRay(origin, laser_to_actuator.linear() * beam, range)) {
+        continue;
+      }
+      if (options_.range_noise > 0) {
+        range += noise(rng);
+      }
+      line.push_back(LaserPoint<double>(range * beam, angle));
+    }
+  }
+
+  size_t num_points = 0;
+  for (unsigned int l = 0; l < num_lines; l++) {
+    num_points += lines[l].size();
+  }
+  std::vector<LaserPoint<double> > scan;
+  scan.reserve(num_points);
+  for (unsigned int l = 0; l < num_lines; l++) {
+    scan.insert(scan.end(), lines[l].begin(), lines[l].end());
+  }
+  return scan;
+}
+
+void ScanSimulator::simulate(const Calibration& calibration, hector_calibration_msgs::RequestScansResponse& scans) const {
+  // Same angle ranges as the half scans of the cloud aggregator (sign change of the roll angle)
+  toMsg(simulateHalfScan(calibration, 0, 0), scans.scan_1, scans.angles1);
+  toMsg(simulateHalfScan(calibration, -M_PI, 1), scans.scan_2, scans.angles2);
+}
+
+void ScanSimulator::toMsg(const std::vector<LaserPoint<double> >& scan, sensor_msgs::PointCloud2& cloud,
+                          std_msgs::Float64MultiArray& angles) const
+{
+  pcl::PointCloud<pcl::PointXYZ> pcl_cloud;
+  pcl_cloud.resize(scan.size());
+  angles.data.resize(scan.size());
+  for (size_t i = 0; i < scan.size(); i++) {
+    pcl_cloud[i].x = (float) scan[i].point.x();
+    pcl_cloud[i].y = (float) scan[i].point.y();
+    pcl_cloud[i].z = (float) scan[i].point.z();
+    angles.data[i] = scan[i].angle;
+  }
+  pcl::toROSMsg(pcl_cloud, cloud);
+  cloud.header.frame_id = options_.laser_frame;
+}
+
+}
+}
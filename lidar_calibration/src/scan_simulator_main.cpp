@@ -0,0 +1,82 @@
+#include <lidar_calibration/lidar_calibration.h>
+#include <lidar_calibration/scan_simulator.h>
+
+#include <rosbag/bag.h>
+#include <boost/program_options.hpp>
+
+#include <iostream>
+
+using namespace hector_calibration::lidar_calibration;
+
+int main(int argc, char** argv) {
+  // No ros::init, the generator does not need a master
+  ros::Time::init();
+
+  ScanSimulatorOptions options;
+  Calibration mounting;
+  std::string output;
+
+  boost::program_options::options_description desc("Allowed options");
+  desc.add_options()
+      ("help", "produce help message")
+      ("output", boost::program_options::value<std::string>(&output)->default_value("request_scans.bag"),
+       "Bag file for the generated scans (topic request_scans), empty to skip")
+      ("lines", boost::program_options::value<unsigned int>(&options.lines_per_half_scan)->default_value(options.lines_per_half_scan),
+       "Scan lines per half scan")
+      ("beams", boost::program_options::value<unsigned int>(&options.beams_per_line)->default_value(options.beams_per_line),
+       "Beams per scan line")
+      ("noise", boost::program_options::value<double>(&options.range_noise)->default_value(options.range_noise),
+       "Standard deviation of the range noise")
+      ("seed", boost::program_options::value<unsigned int>(&options.seed)->default_value(options.seed),
+       "Random seed")
+      ("x", boost::program_options::value<double>(&mounting.x)->default_value(0.0), "Injected calibration")
+      ("y", boost::program_options::value<double>(&mounting.y)->default_value(0.02), "Injected calibration")
+      ("z", boost::program_options::value<double>(&mounting.z)->default_value(0.05), "Injected calibration")
+      ("roll", boost::program_options::value<double>(&mounting.roll)->default_value(0.0), "Injected calibration")
+      ("pitch", boost::program_options::value<double>(&mounting.pitch)->default_value(0.01), "Injected calibration")
+      ("yaw", boost::program_options::value<double>(&mounting.yaw)->default_value(-0.02), "Injected calibration")
+      ("calibrate", "Run LidarCalibration on the generated scans and compare with the injected calibration")
+  ;
+
+  boost::program_options::variables_map vmap;
+  boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(desc).run(), vmap);
+  boost::program_options::notify(vmap);
+
+  if (vmap.count("help")) {
+    std::cout << desc << std::endl;
+    return 0;
+  }
+
+  ScanSimulator simulator(options);
+  hector_calibration_msgs::RequestScansResponse scans;
+  ros::WallTime start = ros::WallTime::now();
+  simulator.simulate(mounting, scans);
+  double simulation_time = (ros::WallTime::now() - start).toSec();
+  size_t num_points = scans.angles1.data.size() + scans.angles2.data.size();
+  std::cout << "Simulated " << num_points << " points with calibration " << mounting.toString()
+            << " in " << simulation_time << " s" << std::endl;
+
+  if (!output.empty()) {
+    rosbag::Bag bag(output, rosbag::bagmode::Write);
+    bag.write("request_scans", ros::TIME_MIN, scans);
+    bag.close();
+    std::cout << "Wrote scans to " << output << std::endl;
+  }
+
+  if (vmap.count("calibrate")) {
+    if (ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME, ros::console::levels::Warn)) {
+      ros::console::notifyLoggerLevelsChanged();
+    }
+    LidarCalibration calibration;
+    start = ros::WallTime::now();
+    Calibration result = calibration.calibrate(scans);
+    double calibration_time = (ros::WallTime::now() - start).toSec();
+    // x and roll are not observable with a rotation around the x-axis
+    Calibration error(0, result.y - mounting.y, result.z - mounting.z,
+                      0, result.pitch - mounting.pitch, result.yaw - mounting.yaw);
+    std::cout << "Estimated calibration " << result.toString() << " in " << calibration_time << " s" << std::endl;
+    std::cout << "Error " << error.toString() << std::endl;
+  }
+
+  return 0;
+}
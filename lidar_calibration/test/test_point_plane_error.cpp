@@ -0,0 +1,216 @@
+#include <lidar_calibration_lib/lidar_calibration_common.h>
+#include <lidar_calibration/point_plane_error.h>
+
+#include <gtest/gtest.h>
+
+#include <boost/scoped_ptr.hpp>
+#include <random>
+
+using namespace hector_calibration::lidar_calibration;
+
+namespace {
+
+/**
+ * Automatically differentiated point to plane error, the reference for the
+ * analytic jacobians.
+ */
+struct PointPlaneErrorAutoDiff {
+  PointPlaneErrorAutoDiff(const LaserPoint<double>& s1, const LaserPoint<double>& s2, const WeightedNormal& normal) {
+    s1_ = s1;
+    s2_ = s2;
+    normal_ = normal;
+  }
+
+  template<typename T>
+  bool operator()(const T* const rpy_rotation, const T* const translation, T* residuals) const{
+    // residual = n' * (Rx*H*s1 - Rx*H*s2)
+    Affine3T<T> calibration(Eigen::AngleAxis<T>(T(rpy_rotation[1]), Vector3T<T>::UnitZ())
+        * Eigen::AngleAxis<T>(T(rpy_rotation[0]), Vector3T<T>::UnitY()));
+    calibration.translation() = Vector3T<T>(T(0.0), T(translation[0]), T(translation[1]));
+
+    LaserPoint<T> s1t(s1_);
+    LaserPoint<T> s2t(s2_);
+
+    Vector3T<T> nt(T(normal_.normal(0)), T(normal_.normal(1)), T(normal_.normal(2)));
+
+    Vector3T<T> x1 = s1t.getInActuatorFrame(calibration);
+    Vector3T<T> x2 = s2t.getInActuatorFrame(calibration);
+
+    residuals[0] = T(normal_.weight) * nt.transpose() * (x1 - x2);
+
+    return true;
+  }
+
+  static ceres::CostFunction* Create(const LaserPoint<double>& s1, const LaserPoint<double>& s2, const WeightedNormal& normal)
+  {
+    ceres::CostFunction* cost_function =
+        new ceres::AutoDiffCostFunction<PointPlaneErrorAutoDiff, 1, 2, 2>(
+          new PointPlaneErrorAutoDiff(s1, s2, normal));
+
+    return cost_function;
+  }
+
+  LaserPoint<double> s1_;
+  LaserPoint<double> s2_;
+  WeightedNormal normal_;
+};
+
+const double TOLERANCE = 1e-9;
+
+struct Correspondence {
+  LaserPoint<double> s1;
+  LaserPoint<double> s2;
+  WeightedNormal normal;
+};
+
+class PointPlaneErrorTest : public ::testing::Test {
+protected:
+  PointPlaneErrorTest() : rng_(42) {}
+
+  double uniform(double min, double max) {
+    return std::uniform_real_distribution<double>(min, max)(rng_);
+  }
+
+  LaserPoint<double> randomLaserPoint() {
+    return LaserPoint<double>(Eigen::Vector3d(uniform(-20, 20), uniform(-20, 20), uniform(-20, 20)),
+                              uniform(-M_PI, M_PI));
+  }
+
+  Correspondence randomCorrespondence() {
+    Correspondence c;
+    c.s1 = randomLaserPoint();
+    c.s2 = randomLaserPoint();
+    c.normal = WeightedNormal(Eigen::Vector3d(uniform(-1, 1), uniform(-1, 1), uniform(-1, 1)).normalized(),
+                              uniform(0, 1));
+    return c;
+  }
+
+  void randomParameters(double* rotation, double* translation) {
+    rotation[0] = uniform(-0.5, 0.5);
+    rotation[1] = uniform(-0.5, 0.5);
+    translation[0] = uniform(-0.2, 0.2);
+    translation[1] = uniform(-0.2, 0.2);
+  }
+
+  // Residual and 1x2 jacobians of the automatically differentiated error
+  void evaluateReference(const Correspondence& c, const double* rotation, const double* translation,
+                         double& residual, double* jacobian_rotation, double* jacobian_translation) {
+    boost::scoped_ptr<ceres::CostFunction> reference(PointPlaneErrorAutoDiff::Create(c.s1, c.s2, c.normal));
+    const double* parameters[2] = {rotation, translation};
+    double* jacobians[2] = {jacobian_rotation, jacobian_translation};
+    ASSERT_TRUE(reference->Evaluate(parameters, &residual, jacobians));
+  }
+
+  std::mt19937 rng_;
+};
+
+}
+
+TEST_F(PointPlaneErrorTest, MatchesAutoDiff) {
+  for (unsigned int i = 0; i < 1000; i++) {
+    Correspondence c = randomCorrespondence();
+    double rotation[2], translation[2];
+    randomParameters(rotation, translation);
+
+    double expected_residual, expected_rotation[2], expected_translation[2];
+    evaluateReference(c, rotation, translation, expected_residual, expected_rotation, expected_translation);
+
+    boost::scoped_ptr<ceres::CostFunction> error(PointPlaneError::Create(c.s1, c.s2, c.normal));
+    const double* parameters[2] = {rotation, translation};
+    double residual, jacobian_rotation[2], jacobian_translation[2];
+    double* jacobians[2] = {jacobian_rotation, jacobian_translation};
+    ASSERT_TRUE(error->Evaluate(parameters, &residual, jacobians));
+
+    EXPECT_NEAR(expected_residual, residual, TOLERANCE);
+    for (unsigned int j = 0; j < 2; j++) {
+      EXPECT_NEAR(expected_rotation[j], jacobian_rotation[j], TOLERANCE);
+      EXPECT_NEAR(expected_translation[j], jacobian_translation[j], TOLERANCE);
+    }
+
+    // Residual only and a single jacobian block
+    double residual_only;
+    ASSERT_TRUE(error->Evaluate(parameters, &residual_only, NULL));
+    EXPECT_NEAR(expected_residual, residual_only, TOLERANCE);
+    double rotation_only[2];
+    double* rotation_jacobians[2] = {rotation_only, NULL};
+    ASSERT_TRUE(error->Evaluate(parameters, &residual_only, rotation_jacobians));
+    EXPECT_NEAR(expected_rotation[0], rotation_only[0], TOLERANCE);
+    EXPECT_NEAR(expected_rotation[1], rotation_only[1], TOLERANCE);
+  }
+}
+
+TEST_F(PointPlaneErrorTest, ChunkMatchesAutoDiff) {
+  const unsigned int num_residuals = RESIDUAL_CHUNK_SIZE + 13;
+  std::vector<Correspondence> correspondences;
+  PointPlaneChunkError chunk;
+  for (unsigned int i = 0; i < num_residuals; i++) {
+    correspondences.push_back(randomCorrespondence());
+    chunk.add(correspondences[i].s1, correspondences[i].s2, correspondences[i].normal);
+  }
+  ASSERT_EQ(num_residuals, chunk.size());
+  ASSERT_EQ((int) num_residuals, chunk.num_residuals());
+
+  for (unsigned int trial = 0; trial < 10; trial++) {
+    double rotation[2], translation[2];
+    randomParameters(rotation, translation);
+    const double* parameters[2] = {rotation, translation};
+    std::vector<double> residuals(num_residuals);
+    std::vector<double> jacobian_rotation(2 * num_residuals);
+    std::vector<double> jacobian_translation(2 * num_residuals);
+    double* jacobians[2] = {jacobian_rotation.data(), jacobian_translation.data()};
+    ASSERT_TRUE(chunk.Evaluate(parameters, residuals.data(), jacobians));
+
+    for (unsigned int i = 0; i < num_residuals; i++) {
+      double expected_residual, expected_rotation[2], expected_translation[2];
+      evaluateReference(correspondences[i], rotation, translation, expected_residual, expected_rotation,
+                        expected_translation);
+      EXPECT_NEAR(expected_residual, residuals[i], TOLERANCE);
+      for (unsigned int j = 0; j < 2; j++) {
+        EXPECT_NEAR(expected_rotation[j], jacobian_rotation[2*i + j], TOLERANCE);
+        EXPECT_NEAR(expected_translation[j], jacobian_translation[2*i + j], TOLERANCE);
+      }
+    }
+  }
+}
+
+TEST_F(PointPlaneErrorTest, ChunkSetAndZero) {
+  const unsigned int num_residuals = 64;
+  std::vector<Correspondence> correspondences;
+  PointPlaneChunkError chunk;
+  chunk.resize(num_residuals);
+  for (unsigned int i = 0; i < num_residuals; i++) {
+    correspondences.push_back(randomCorrespondence());
+    if (i % 3 == 0) {
+      chunk.setZero(i);
+    } else {
+      chunk.set(i, correspondences[i].s1, correspondences[i].s2, correspondences[i].normal);
+    }
+  }
+
+  double rotation[2], translation[2];
+  randomParameters(rotation, translation);
+  const double* parameters[2] = {rotation, translation};
+  std::vector<double> residuals(num_residuals);
+  std::vector<double> jacobian_rotation(2 * num_residuals);
+  std::vector<double> jacobian_translation(2 * num_residuals);
+  double* jacobians[2] = {jacobian_rotation.data(), jacobian_translation.data()};
+  ASSERT_TRUE(chunk.Evaluate(parameters, residuals.data(), jacobians));
+
+  for (unsigned int i = 0; i < num_residuals; i++) {
+    double expected_residual = 0, expected_rotation[2] = {0, 0}, expected_translation[2] = {0, 0};
+    if (i % 3 != 0) {
+      evaluateReference(correspondences[i], rotation, translation, expected_residual, expected_rotation,
+                        expected_translation);
+    }
+    EXPECT_NEAR(expected_residual, residuals[i], TOLERANCE);
+    for (unsigned int j = 0; j < 2; j++) {
+      EXPECT_NEAR(expected_rotation[j], jacobian_rotation[2*i + j], TOLERANCE);
+      EXPECT_NEAR(expected_translation[j], jacobian_translation[2*i + j], TOLERANCE);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
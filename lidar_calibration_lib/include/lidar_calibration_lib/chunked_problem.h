@@ -0,0 +1,121 @@
+#ifndef CHUNKED_PROBLEM_H
+#define CHUNKED_PROBLEM_H
+
+// ros
+#include <ros/ros.h>
+
+// ceres solver
+#include <ceres/ceres.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+// Solver options suited for few parameters and many residuals
+ceres::Solver::Options defaultSolverOptions();
+// Reads num_threads, linear_solver_type, trust_region_strategy, initial_trust_region_radius,
+// max_num_iterations and function_tolerance. Values in options are used as defaults.
+void loadSolverOptions(const ros::NodeHandle& pnh, ceres::Solver::Options& options);
+
+/**
+ * Ceres problem that persists over the outer iterations of a calibration.
+ * Correspondences are evaluated in chunks of fixed size (see
+ * PointPlaneChunkError and LidarPoseChunkError), which are registered once.
+ * When the correspondences change, the chunk data is overwritten in place and
+ * unused slots of the last chunk are set to zero. Residual blocks are only
+ * added or removed if the number of chunks changes. The parameter blocks
+ * keep the state of the last solve as warm start for the next one.
+ *
+ * ChunkT needs a constructor taking the capacity, resize(n) and setZero(i).
+ */
+template<typename ChunkT, int ROTATION_SIZE, int TRANSLATION_SIZE>
+class ChunkedProblem : private boost::noncopyable {
+public:
+  ChunkedProblem(unsigned int chunk_size) :
+    problem_(problemOptions()),
+    chunk_size_(chunk_size),
+    size_(0)
+  {
+    std::fill(rotation_, rotation_ + ROTATION_SIZE, 0.0);
+    std::fill(translation_, translation_ + TRANSLATION_SIZE, 0.0);
+  }
+
+  // Sets the number of terms. Slots of the last chunk beyond size are cleared.
+  void resize(size_t size) {
+    size_t num_chunks = (size + chunk_size_ - 1) / chunk_size_;
+    while (chunks_.size() < num_chunks) {
+      boost::shared_ptr<ChunkT> chunk(new ChunkT(chunk_size_));
+      chunk->resize(chunk_size_);
+      blocks_.push_back(problem_.AddResidualBlock(chunk.get(), NULL, rotation_, translation_));
+      chunks_.push_back(chunk);
+    }
+    while (chunks_.size() > num_chunks) {
+      problem_.RemoveResidualBlock(blocks_.back());
+      blocks_.pop_back();
+      chunks_.pop_back();
+    }
+    for (size_t i = size; i < num_chunks * chunk_size_; i++) {
+      chunks_[i / chunk_size_]->setZero(i % chunk_size_);
+    }
+    size_ = size;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  unsigned int chunkSize() const {
+    return chunk_size_;
+  }
+
+  // Chunk holding term i at slot i % chunkSize()
+  ChunkT& chunkOf(size_t i) {
+    return *chunks_[i / chunk_size_];
+  }
+
+  double* rotation() {
+    return rotation_;
+  }
+
+  double* translation() {
+    return translation_;
+  }
+
+  void solve(const ceres::Solver::Options& options, ceres::Solver::Summary* summary) {
+    if (size_ == 0) {
+      ROS_WARN_STREAM("No residuals to optimize.");
+      return;
+    }
+    ceres::Solve(options, &problem_, summary);
+  }
+
+private:
+  static ceres::Problem::Options problemOptions() {
+    ceres::Problem::Options options;
+    // Chunks are owned here and removed from the problem when there are fewer correspondences
+    options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    options.enable_fast_removal = true;
+    return options;
+  }
+
+  ceres::Problem problem_;
+  unsigned int chunk_size_;
+  size_t size_;
+
+  std::vector<boost::shared_ptr<ChunkT> > chunks_;
+  std::vector<ceres::ResidualBlockId> blocks_;
+
+  double rotation_[ROTATION_SIZE];
+  double translation_[TRANSLATION_SIZE];
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef CLOUD_VIEW_H
+#define CLOUD_VIEW_H
+
+// ros
+#include <sensor_msgs/PointCloud2.h>
+
+// pcl
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <Eigen/Core>
+
+#include <cstring>
+#include <stdint.h>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+/**
+ * Typed view of the float32 x, y and z fields of a PointCloud2. Points are
+ * read from and written to the data buffer of the message directly, without
+ * a conversion to a pcl cloud. Byte is "const uint8_t" for read-only and
+ * "uint8_t" for writable views, see ConstXYZView and XYZView. The view is
+ * invalidated if the message is resized.
+ */
+template<typename Byte>
+class BasicXYZView {
+public:
+  class iterator {
+  public:
+    iterator(Byte* point, const BasicXYZView* view) : point_(point), view_(view) {}
+
+    Eigen::Vector3f operator*() const {
+      return view_->read(point_);
+    }
+    iterator& operator++() {
+      point_ += view_->point_step_;
+      return *this;
+    }
+    bool operator==(const iterator& other) const {
+      return point_ == other.point_;
+    }
+    bool operator!=(const iterator& other) const {
+      return point_ != other.point_;
+    }
+    // Writable views only
+    void set(float x, float y, float z) {
+      view_->write(point_, x, y, z);
+    }
+
+  private:
+    Byte* point_;
+    const BasicXYZView* view_;
+  };
+
+  // Empty view
+  BasicXYZView() : data_(NULL), size_(0), point_step_(0), x_offset_(0), y_offset_(0), z_offset_(0) {}
+  BasicXYZView(Byte* data, size_t size, uint32_t point_step, uint32_t x_offset, uint32_t y_offset, uint32_t z_offset)
+    : data_(data), size_(size), point_step_(point_step), x_offset_(x_offset), y_offset_(y_offset), z_offset_(z_offset) {}
+
+  size_t size() const {
+    return size_;
+  }
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  Eigen::Vector3f operator[](size_t i) const {
+    return read(data_ + i * point_step_);
+  }
+  // Writable views only
+  void set(size_t i, float x, float y, float z) const {
+    write(data_ + i * point_step_, x, y, z);
+  }
+
+  iterator begin() const {
+    return iterator(data_, this);
+  }
+  iterator end() const {
+    return iterator(data_ + size_ * point_step_, this);
+  }
+
+private:
+  // memcpy, the fields of a message are not necessarily aligned
+  Eigen::Vector3f read(const uint8_t* point) const {
+    float x, y, z;
+    std::memcpy(&x, point + x_offset_, sizeof(float));
+    std::memcpy(&y, point + y_offset_, sizeof(float));
+    std::memcpy(&z, point + z_offset_, sizeof(float));
+    return Eigen::Vector3f(x, y, z);
+  }
+  void write(uint8_t* point, float x, float y, float z) const {
+    std::memcpy(point + x_offset_, &x, sizeof(float));
+    std::memcpy(point + y_offset_, &y, sizeof(float));
+    std::memcpy(point + z_offset_, &z, sizeof(float));
+  }
+
+  Byte* data_;
+  size_t size_;
+  uint32_t point_step_;
+  uint32_t x_offset_;
+  uint32_t y_offset_;
+  uint32_t z_offset_;
+};
+
+typedef BasicXYZView<const uint8_t> ConstXYZView;
+typedef BasicXYZView<uint8_t> XYZView;
+
+// Empty if the cloud has no float32 x, y or z field
+ConstXYZView makeXYZView(const sensor_msgs::PointCloud2& cloud);
+XYZView makeXYZView(sensor_msgs::PointCloud2& cloud);
+// Resizes cloud to size unorganized points with float32 x, y and z fields and returns a view to fill them
+XYZView resizeXYZCloud(sensor_msgs::PointCloud2& cloud, size_t size);
+// Writes cloud into cloud_msg, reusing the memory of cloud_msg. The header is not touched.
+void toXYZCloud(const pcl::PointCloud<pcl::PointXYZ>& cloud, sensor_msgs::PointCloud2& cloud_msg);
+
+}
+}
+
+#endif
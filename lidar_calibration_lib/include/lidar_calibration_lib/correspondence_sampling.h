@@ -0,0 +1,44 @@
+#ifndef CORRESPONDENCE_SAMPLING_H
+#define CORRESPONDENCE_SAMPLING_H
+
+#include <lidar_calibration_lib/correspondences.h>
+#include <lidar_calibration_lib/lidar_calibration_common.h>
+
+#include <vector>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+struct CorrespondenceSamplingOptions {
+  CorrespondenceSamplingOptions() {
+    min_weight = 0.05;
+    max_residuals = 200000;
+    normal_bins = 4;
+  }
+
+  // Sources with a smaller normal weight (planarity) are not matched
+  double min_weight;
+  // Residual budget per iteration, 0 for no limit
+  size_t max_residuals;
+  // Elevation bins of the normal directions, the azimuth has twice as many
+  unsigned int normal_bins;
+};
+
+/**
+ * Normal space sampling: if there are more than max_residuals
+ * correspondences, the budget is split evenly over the occupied bins of the
+ * source normal directions. Bins with fewer correspondences keep all of
+ * theirs. Rare directions, e.g. the few planes that constrain one
+ * translation, are thereby kept while large walls are thinned out. Inside a
+ * bin, correspondences are taken at even strides, so the result stays
+ * sorted by source index and is spread over the scan.
+ */
+void sampleCorrespondences(const std::vector<WeightedNormal>& normals,
+                           const CorrespondenceSamplingOptions& options,
+                           Correspondences& correspondences);
+
+}
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef CORRESPONDENCES_H
+#define CORRESPONDENCES_H
+
+#include <vector>
+#include <cstddef>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+/**
+ * Flat point correspondences from cloud1 (source) to cloud2 (target),
+ * stored as structure of arrays and sorted by source index.
+ */
+struct Correspondences {
+  size_t size() const {
+    return source.size();
+  }
+
+  bool empty() const {
+    return source.empty();
+  }
+
+  void clear() {
+    source.clear();
+    target.clear();
+    sqr_dist.clear();
+  }
+
+  void reserve(size_t n) {
+    source.reserve(n);
+    target.reserve(n);
+    sqr_dist.reserve(n);
+  }
+
+  void resize(size_t n) {
+    source.resize(n);
+    target.resize(n);
+    sqr_dist.resize(n);
+  }
+
+  void push_back(unsigned int source_index, unsigned int target_index, float dist) {
+    source.push_back(source_index);
+    target.push_back(target_index);
+    sqr_dist.push_back(dist);
+  }
+
+  std::vector<unsigned int> source;
+  std::vector<unsigned int> target;
+  std::vector<float> sqr_dist;
+};
+
+}
+}
+
+#endif
@@ -17,6 +17,11 @@
 #include <sensor_msgs/PointCloud2.h>
 #include <visualization_msgs/MarkerArray.h>
 
+#include <lidar_calibration_lib/cloud_view.h>
+#include <lidar_calibration_lib/neighbor_search.h>
+#include <lidar_calibration_lib/correspondences.h>
+#include <lidar_calibration_lib/normal_estimation.h>
+
 namespace hector_calibration {
 
 namespace lidar_calibration {
@@ -39,20 +44,34 @@ namespace lidar_calibration {
   template<typename T> bool isValidPoint(const T& point);
   bool isValidCloud(const pcl::PointCloud<pcl::PointXYZ>& cloud);
   template<typename T> pcl::PointCloud<T> removeInvalidPoints(pcl::PointCloud<T>& cloud);
-  template <class Iter, class Incr> void safe_advance(Iter& curr, const Iter& end, Incr n);
   void nanInfToZero(WeightedNormal& normal);
 
+  // Publishing helpers skip publishers that were never advertised (offline use)
+  // The pcl cloud is only converted if the publisher has subscribers or is latched
   void publishCloud(const pcl::PointCloud<pcl::PointXYZ>& cloud, const ros::Publisher& pub, std::string frame);
   void publishCloud(sensor_msgs::PointCloud2& cloud, const ros::Publisher& pub, std::string frame);
+  // Advertised and either subscribed or latched, serializing a message for it is not wasted
+  bool hasSubscribers(const ros::Publisher& pub);
 
 
-  std::map<unsigned int, unsigned int> findNeighbors(const pcl::PointCloud<pcl::PointXYZ> &cloud1,
-                                                     const pcl::PointCloud<pcl::PointXYZ> &cloud2, double max_sqr_dist = 0.1);
+  void findNeighbors(const pcl::PointCloud<pcl::PointXYZ> &cloud1,
+                     const pcl::PointCloud<pcl::PointXYZ> &cloud2,
+                     Correspondences& correspondences, double max_sqr_dist = 0.1);
+  void findNeighbors(const pcl::PointCloud<pcl::PointXYZ> &cloud1,
+                     const NeighborSearch& cloud2_search,
+                     Correspondences& correspondences, double max_sqr_dist = 0.1);
+  // Only points of cloud1 with a normal weight of at least min_weight are matched, normals belong to cloud1
+  void findNeighbors(const pcl::PointCloud<pcl::PointXYZ> &cloud1,
+                     const NeighborSearch& cloud2_search,
+                     const std::vector<WeightedNormal>& normals, double min_weight,
+                     Correspondences& correspondences, double max_sqr_dist = 0.1);
   void publishNeighbors(const pcl::PointCloud<pcl::PointXYZ>& cloud1,
                          const pcl::PointCloud<pcl::PointXYZ>& cloud2,
-                         const std::map<unsigned int, unsigned int>& mapping, ros::Publisher &pub, std::string frame, unsigned int number_of_markers = 100);
+                         const Correspondences& correspondences, ros::Publisher &pub, std::string frame, unsigned int number_of_markers = 100);
 
-  std::vector<WeightedNormal> computeNormals(const pcl::PointCloud<pcl::PointXYZ>& cloud, double radius = 0.07);
+  std::vector<WeightedNormal> computeNormals(const pcl::PointCloud<pcl::PointXYZ>& cloud, double radius = 0.07,
+                                             SearchBackendType backend = KDTREE);
+  std::vector<WeightedNormal> computeNormals(const NeighborSearch& search, double radius = 0.07);
   void visualizeNormals(const pcl::PointCloud<pcl::PointXYZ>& cloud, std::vector<WeightedNormal> &normals);
   void visualizePlanarity(const pcl::PointCloud<pcl::PointXYZ> &cloud, const std::vector<WeightedNormal> &normals, ros::Publisher &pub, std::string frame);
 
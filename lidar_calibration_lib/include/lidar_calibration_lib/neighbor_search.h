@@ -0,0 +1,70 @@
+#ifndef NEIGHBOR_SEARCH_H
+#define NEIGHBOR_SEARCH_H
+
+// pcl
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <lidar_calibration_lib/search_backend.h>
+
+#include <Eigen/Geometry>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+/**
+ * Owns a point cloud together with its search index, so the index can be
+ * reused over several iterations and for both radius and nearest neighbor
+ * queries. A rigid transform of the cloud is applied to the queries instead
+ * of the points, which keeps the index valid without a rebuild.
+ * The spatial index itself is provided by a SearchBackend.
+ */
+class NeighborSearch {
+public:
+  typedef boost::shared_ptr<NeighborSearch> Ptr;
+  typedef boost::shared_ptr<const NeighborSearch> ConstPtr;
+
+  NeighborSearch(SearchBackendType backend = KDTREE, double cell_size = 0.07);
+
+  // Copies the cloud and builds the index. Resets the transform to identity.
+  void setInputCloud(const pcl::PointCloud<pcl::PointXYZ>& cloud);
+  // Overwrites the stored points without reallocating and rebuilds the index.
+  // Falls back to setInputCloud() if the number of points changed.
+  void updatePoints(const pcl::PointCloud<pcl::PointXYZ>& cloud);
+  // Moves the indexed cloud rigidly. The index is not rebuilt.
+  void setTransform(const Eigen::Affine3d& transform);
+  const Eigen::Affine3d& getTransform() const;
+
+  size_t size() const;
+  bool empty() const;
+  // Point i with the current transform applied
+  pcl::PointXYZ getPoint(unsigned int i) const;
+  // Points as stored in the index (transform not applied)
+  const pcl::PointCloud<pcl::PointXYZ>& getIndexedCloud() const;
+
+  // Queries are given in the transformed frame, returned distances are invariant to the rigid transform
+  int radiusSearch(const pcl::PointXYZ& query, double radius, std::vector<int>& indices, std::vector<float>& sqr_dists) const;
+  // Neighbors farther than max_sqr_dist may be skipped by the backend
+  bool nearestSearch(const pcl::PointXYZ& query, double max_sqr_dist, int& index, float& sqr_dist) const;
+  // Same as above, but reuses the caller's buffers. The result is stored in the first element.
+  bool nearestSearch(const pcl::PointXYZ& query, double max_sqr_dist, std::vector<int>& indices, std::vector<float>& sqr_dists) const;
+  // Radius search around an indexed point
+  int radiusSearch(unsigned int index, double radius, std::vector<int>& indices, std::vector<float>& sqr_dists) const;
+
+  // Converts a query from the transformed frame to the frame of the index
+  pcl::PointXYZ toIndexFrame(const pcl::PointXYZ& point) const;
+
+private:
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_;
+  SearchBackend::Ptr backend_;
+
+  Eigen::Affine3d transform_;
+  Eigen::Affine3f inverse_transform_;
+  bool is_identity_;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef NORMAL_ESTIMATION_H
+#define NORMAL_ESTIMATION_H
+
+// pcl
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <Eigen/Core>
+
+#include <vector>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+// Number of points whose normals are solved together
+const unsigned int NORMAL_BLOCK_SIZE = 8;
+
+/**
+ * Neighborhood moments of NORMAL_BLOCK_SIZE points in structure of arrays
+ * layout. Sums are taken relative to the query point of each lane, which keeps
+ * the single precision covariance accurate far away from the origin.
+ */
+struct NormalBlock {
+  // Resets all lanes
+  void clear();
+  // Resets one lane and sets its query point
+  void setQuery(unsigned int lane, const pcl::PointXYZ& query);
+  // Adds the neighbors of one lane
+  void accumulate(unsigned int lane, const pcl::PointCloud<pcl::PointXYZ>& cloud, const std::vector<int>& indices);
+
+  float count[NORMAL_BLOCK_SIZE];
+  float qx[NORMAL_BLOCK_SIZE], qy[NORMAL_BLOCK_SIZE], qz[NORMAL_BLOCK_SIZE];
+  float sx[NORMAL_BLOCK_SIZE], sy[NORMAL_BLOCK_SIZE], sz[NORMAL_BLOCK_SIZE];
+  float sxx[NORMAL_BLOCK_SIZE], sxy[NORMAL_BLOCK_SIZE], sxz[NORMAL_BLOCK_SIZE];
+  float syy[NORMAL_BLOCK_SIZE], syz[NORMAL_BLOCK_SIZE], szz[NORMAL_BLOCK_SIZE];
+};
+
+/**
+ * Solves all lanes of a block with a closed-form symmetric 3x3 eigen
+ * decomposition. For every lane the eigenvector of the smallest eigenvalue is
+ * returned, flipped towards the viewpoint, together with the planarity weight
+ * 2*(l1 - l0)/(l0 + l1 + l2). Lanes with less than 3 neighbors get a zero
+ * normal and zero weight.
+ * The lane loops are written for auto vectorization (SSE/AVX, depending on
+ * the compiler flags) and run as plain scalar code without OpenMP.
+ */
+void solveNormalBlock(const NormalBlock& block, const Eigen::Vector3f& viewpoint,
+                      float* nx, float* ny, float* nz, float* weight);
+
+}
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef ORGANIZED_NORMALS_H
+#define ORGANIZED_NORMALS_H
+
+#include <lidar_calibration_lib/lidar_calibration_common.h>
+
+#include <stdint.h>
+#include <vector>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+/**
+ * Scan line structure of an aggregated half scan. Points of one scan message
+ * are consecutive and messages are ordered by actuator angle, so line l
+ * consists of the points [begin[l], begin[l+1]). Each message is one run of
+ * the aggregator with a single base angle; deskewed points have individual
+ * angles, so the lines have to come from the runs.
+ */
+struct ScanLines {
+  size_t size() const {
+    return begin.empty() ? 0 : begin.size() - 1;
+  }
+
+  unsigned int lineBegin(unsigned int line) const {
+    return begin[line];
+  }
+
+  unsigned int lineEnd(unsigned int line) const {
+    return begin[line + 1];
+  }
+
+  std::vector<unsigned int> begin;
+};
+
+// A new line starts wherever the actuator angle of two consecutive points differs.
+// Only valid if the angles are not deskewed, otherwise every point becomes a line.
+ScanLines scanLinesFromAngles(const std::vector<double>& angles);
+// Lines from the runs of a compact scan, points [offsets[r], offsets[r] + counts[r]) have the base angle angles[r].
+// Consecutive runs with the same base angle (e.g. split at a chunk border) form one line.
+ScanLines scanLinesFromRuns(const std::vector<double>& angles, const std::vector<uint32_t>& offsets,
+                            const std::vector<uint32_t>& counts, size_t num_points);
+
+struct OrganizedNeighborhood {
+  OrganizedNeighborhood() {
+    line_window = 2;
+    point_window = 8;
+    search_window = 32;
+    min_neighbors = 6;
+    min_weight = 0.01;
+  }
+
+  // Number of lines before and after the query line that are searched
+  unsigned int line_window;
+  // Number of points before and after the closest point of a line that are taken
+  unsigned int point_window;
+  // Number of points around the estimated position that are searched for the closest point in a neighboring line
+  unsigned int search_window;
+  // Neighborhoods with less points, or with points from a single line, use the spatial search
+  unsigned int min_neighbors;
+  // Neighborhoods with a lower planarity weight are recomputed with the spatial search
+  double min_weight;
+};
+
+/**
+ * Computes normals of an aggregated half scan from its scan line structure
+ * instead of a spatial index. Neighbors are taken from the query line and
+ * the neighboring lines, limited to radius. Where the structure breaks (first
+ * and last line, gaps, depth discontinuities), the normal is computed with a
+ * radius search in fallback_search instead. Its index is only built if at
+ * least one point needs it.
+ * The viewpoint is the origin of the cloud frame.
+ */
+std::vector<WeightedNormal> computeOrganizedNormals(const pcl::PointCloud<pcl::PointXYZ>& cloud,
+                                                    const ScanLines& lines, double radius,
+                                                    NeighborSearch& fallback_search,
+                                                    const OrganizedNeighborhood& neighborhood = OrganizedNeighborhood());
+
+}
+}
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// ros
+#include <ros/ros.h>
+#include <diagnostic_msgs/DiagnosticStatus.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <chrono>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+/**
+ * Process wide collection of stage timings and counters. Disabled by default;
+ * while disabled, ScopedTimer and profileCount only test a flag, so
+ * instrumentation can stay in the code. Stages and counters are reported in
+ * the order they were first recorded.
+ */
+class Profiler : private boost::noncopyable {
+public:
+  static Profiler& instance();
+
+  // Should be set before instrumented code runs
+  void setEnabled(bool enabled);
+  bool enabled() const {
+    return enabled_;
+  }
+
+  void addTime(const char* stage, double seconds);
+  void addCount(const char* counter, uint64_t count);
+  void reset();
+
+  // Stages as "<stage> time/calls/mean/max", counters as "<counter>" with their totals
+  diagnostic_msgs::DiagnosticStatus toDiagnosticStatus(const std::string& name) const;
+  // Publishes a diagnostic_msgs::DiagnosticArray. Does nothing while disabled or without a publisher.
+  void publishDiagnostics(const ros::Publisher& pub, const std::string& name) const;
+  // Table with one row per stage and counter
+  std::string summary() const;
+
+private:
+  Profiler();
+
+  struct StageStats {
+    StageStats() : calls(0), total(0), max(0) {}
+    unsigned long calls;
+    double total;
+    double max;
+  };
+
+  struct CounterStats {
+    CounterStats() : calls(0), total(0) {}
+    unsigned long calls;
+    uint64_t total;
+  };
+
+  bool enabled_;
+  mutable boost::mutex mutex_;
+  std::vector<std::pair<std::string, StageStats> > stages_;
+  std::vector<std::pair<std::string, CounterStats> > counters_;
+  std::map<std::string, size_t> stage_index_;
+  std::map<std::string, size_t> counter_index_;
+};
+
+/**
+ * Adds the wall time between construction and destruction (or stop()) to
+ * a stage of the Profiler.
+ */
+class ScopedTimer : private boost::noncopyable {
+public:
+  explicit ScopedTimer(const char* stage) :
+    stage_(stage),
+    running_(Profiler::instance().enabled())
+  {
+    if (running_) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~ScopedTimer() {
+    stop();
+  }
+
+  void stop() {
+    if (running_) {
+      running_ = false;
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_;
+      Profiler::instance().addTime(stage_, elapsed.count());
+    }
+  }
+
+private:
+  const char* stage_;
+  bool running_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+inline void profileCount(const char* counter, uint64_t count) {
+  Profiler& profiler = Profiler::instance();
+  if (profiler.enabled()) {
+    profiler.addCount(counter, count);
+  }
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef SEARCH_BACKEND_H
+#define SEARCH_BACKEND_H
+
+// pcl
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/kdtree/kdtree_flann.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+enum SearchBackendType {
+  KDTREE,
+  VOXEL_HASH
+};
+
+bool searchBackendFromString(const std::string& name, SearchBackendType& type);
+std::string searchBackendToString(SearchBackendType type);
+
+/**
+ * Interface for spatial queries on a fixed point cloud.
+ * All queries are const and may be called from several threads at once.
+ */
+class SearchBackend {
+public:
+  typedef boost::shared_ptr<SearchBackend> Ptr;
+
+  virtual ~SearchBackend() {}
+
+  virtual void setInputCloud(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& cloud) = 0;
+  virtual int radiusSearch(const pcl::PointXYZ& query, double radius,
+                           std::vector<int>& indices, std::vector<float>& sqr_dists) const = 0;
+  // Result is stored in the first element of each buffer. Backends may ignore
+  // points farther than max_sqr_dist, which callers have to reject anyway.
+  virtual bool nearestSearch(const pcl::PointXYZ& query, double max_sqr_dist,
+                             std::vector<int>& indices, std::vector<float>& sqr_dists) const = 0;
+};
+
+class KdTreeSearchBackend : public SearchBackend {
+public:
+  KdTreeSearchBackend();
+
+  void setInputCloud(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& cloud);
+  int radiusSearch(const pcl::PointXYZ& query, double radius,
+                   std::vector<int>& indices, std::vector<float>& sqr_dists) const;
+  bool nearestSearch(const pcl::PointXYZ& query, double max_sqr_dist,
+                     std::vector<int>& indices, std::vector<float>& sqr_dists) const;
+private:
+  pcl::KdTreeFLANN<pcl::PointXYZ> kdtree_;
+  bool empty_;
+};
+
+/**
+ * Uniform grid stored in a hash table. Points are sorted by cell, so the
+ * points of one cell are contiguous in memory. Fastest when the search radius
+ * is close to the cell size.
+ */
+class VoxelHashSearchBackend : public SearchBackend {
+public:
+  VoxelHashSearchBackend(double cell_size);
+
+  void setInputCloud(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& cloud);
+  int radiusSearch(const pcl::PointXYZ& query, double radius,
+                   std::vector<int>& indices, std::vector<float>& sqr_dists) const;
+  bool nearestSearch(const pcl::PointXYZ& query, double max_sqr_dist,
+                     std::vector<int>& indices, std::vector<float>& sqr_dists) const;
+
+private:
+  struct Cell {
+    uint64_t key;
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  void cellCoordinates(const pcl::PointXYZ& point, int& cx, int& cy, int& cz) const;
+  uint64_t cellKey(int cx, int cy, int cz) const;
+  const Cell* findCell(uint64_t key) const;
+
+  float cell_size_;
+  float inv_cell_size_;
+
+  // Points and their original indices, sorted by cell
+  std::vector<float> x_;
+  std::vector<float> y_;
+  std::vector<float> z_;
+  std::vector<int> indices_;
+
+  // Open addressing hash table with linear probing
+  std::vector<Cell> table_;
+  uint64_t table_mask_;
+};
+
+SearchBackend::Ptr createSearchBackend(SearchBackendType type, double cell_size);
+
+}
+}
+
+#endif
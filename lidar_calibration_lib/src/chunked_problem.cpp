@@ -0,0 +1,46 @@
+#include <lidar_calibration_lib/chunked_problem.h>
+
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+#include <string>
+
+namespace hector_calibration {
+namespace lidar_calibration {
+
+ceres::Solver::Options defaultSolverOptions() {
+  ceres::Solver::Options options;
+  // The jacobian has only a handful of columns, so forming J'J is cheap and stable enough
+  options.linear_solver_type = ceres::DENSE_NORMAL_CHOLESKY;
+  options.num_threads = std::max(1u, boost::thread::hardware_concurrency());
+  return options;
+}
+
+void loadSolverOptions(const ros::NodeHandle& pnh, ceres::Solver::Options& options) {
+  int num_threads;
+  pnh.param<int>("num_threads", num_threads, options.num_threads);
+  options.num_threads = std::max(1, num_threads);
+
+  std::string linear_solver_type;
+  pnh.param<std::string>("linear_solver_type", linear_solver_type,
+                         ceres::LinearSolverTypeToString(options.linear_solver_type));
+  if (!ceres::StringToLinearSolverType(linear_solver_type, &options.linear_solver_type)) {
+    ROS_WARN_STREAM("Unknown linear_solver_type '" << linear_solver_type << "'. Using "
+                    << ceres::LinearSolverTypeToString(options.linear_solver_type) << ".");
+  }
+
+  std::string trust_region_strategy;
+  pnh.param<std::string>("trust_region_strategy", trust_region_strategy,
+                         ceres::TrustRegionStrategyTypeToString(options.trust_region_strategy_type));
+  if (!ceres::StringToTrustRegionStrategyType(trust_region_strategy, &options.trust_region_strategy_type)) {
+    ROS_WARN_STREAM("Unknown trust_region_strategy '" << trust_region_strategy << "'. Using "
+                    << ceres::TrustRegionStrategyTypeToString(options.trust_region_strategy_type) << ".");
+  }
+
+  pnh.param<double>("initial_trust_region_radius", options.initial_trust_region_radius, options.initial_trust_region_radius);
+  pnh.param<int>("max_num_iterations", options.max_num_iterations, options.max_num_iterations);
+  pnh.param<double>("function_tolerance", options.function_tolerance, options.function_tolerance);
+}
+
+}
+}
@@ -0,0 +1,75 @@
+#include <lidar_calibration_lib/cloud_view.h>
+
+#include <sensor_msgs/point_cloud2_iterator.h>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+namespace {
+  bool findFloatField(const sensor_msgs::PointCloud2& cloud, const std::string& name, uint32_t& offset) {
+    for (size_t i = 0; i < cloud.fields.size(); i++) {
+      if (cloud.fields[i].name == name) {
+        offset = cloud.fields[i].offset;
+        return cloud.fields[i].datatype == sensor_msgs::PointField::FLOAT32;
+      }
+    }
+    return false;
+  }
+
+  bool findXYZFields(const sensor_msgs::PointCloud2& cloud, uint32_t offsets[3]) {
+    return findFloatField(cloud, "x", offsets[0]) && findFloatField(cloud, "y", offsets[1])
+        && findFloatField(cloud, "z", offsets[2]);
+  }
+
+  bool hasData(const sensor_msgs::PointCloud2& cloud) {
+    return cloud.data.size() >= (size_t) cloud.width * cloud.height * cloud.point_step;
+  }
+}
+
+ConstXYZView makeXYZView(const sensor_msgs::PointCloud2& cloud) {
+  uint32_t offsets[3];
+  if (!findXYZFields(cloud, offsets) || !hasData(cloud)) {
+    return ConstXYZView();
+  }
+  return ConstXYZView(cloud.data.data(), (size_t) cloud.width * cloud.height, cloud.point_step,
+                      offsets[0], offsets[1], offsets[2]);
+}
+
+XYZView makeXYZView(sensor_msgs::PointCloud2& cloud) {
+  uint32_t offsets[3];
+  if (!findXYZFields(cloud, offsets) || !hasData(cloud)) {
+    return XYZView();
+  }
+  return XYZView(cloud.data.data(), (size_t) cloud.width * cloud.height, cloud.point_step,
+                 offsets[0], offsets[1], offsets[2]);
+}
+
+XYZView resizeXYZCloud(sensor_msgs::PointCloud2& cloud, size_t size) {
+  uint32_t offsets[3];
+  // Only set the fields if the layout changes, resize keeps the capacity of data
+  if (!findXYZFields(cloud, offsets) || cloud.fields.size() != 3) {
+    sensor_msgs::PointCloud2Modifier modifier(cloud);
+    modifier.setPointCloud2FieldsByString(1, "xyz");
+  }
+  cloud.height = 1;
+  cloud.width = size;
+  cloud.row_step = cloud.width * cloud.point_step;
+  cloud.is_dense = false;
+  cloud.data.resize(cloud.row_step);
+  return makeXYZView(cloud);
+}
+
+void toXYZCloud(const pcl::PointCloud<pcl::PointXYZ>& cloud, sensor_msgs::PointCloud2& cloud_msg) {
+  XYZView view = resizeXYZCloud(cloud_msg, cloud.size());
+  const long n = cloud.size();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) shared (view, cloud)
+#endif
+  for (long i = 0; i < n; i++) {
+    view.set(i, cloud[i].x, cloud[i].y, cloud[i].z);
+  }
+}
+
+}
+}
@@ -0,0 +1,77 @@
+#include <lidar_calibration_lib/correspondence_sampling.h>
+
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+namespace {
+  // Normals are sign ambiguous, both directions fall into the bin of the upper hemisphere
+  unsigned int normalBin(const Eigen::Vector3d& normal, unsigned int elevation_bins, unsigned int azimuth_bins) {
+    const bool flip = normal.z() < 0 || (normal.z() == 0 && normal.y() < 0);
+    Eigen::Vector3d n = flip ? Eigen::Vector3d(-normal) : normal;
+    double elevation = std::acos(std::min(std::max(n.z(), 0.0), 1.0));
+    double azimuth = std::atan2(n.y(), n.x()) + M_PI;
+    unsigned int e = std::min((unsigned int) (elevation / (0.5 * M_PI) * elevation_bins), elevation_bins - 1);
+    unsigned int a = std::min((unsigned int) (azimuth / (2 * M_PI) * azimuth_bins), azimuth_bins - 1);
+    return e * azimuth_bins + a;
+  }
+}
+
+void sampleCorrespondences(const std::vector<WeightedNormal>& normals,
+                           const CorrespondenceSamplingOptions& options,
+                           Correspondences& correspondences)
+{
+  const size_t n = correspondences.size();
+  if (options.max_residuals == 0 || n <= options.max_residuals) {
+    return;
+  }
+  const unsigned int elevation_bins = std::max(options.normal_bins, 1u);
+  const unsigned int azimuth_bins = 2 * elevation_bins;
+  const unsigned int num_bins = elevation_bins * azimuth_bins;
+
+  std::vector<unsigned int> bins(n);
+  std::vector<size_t> counts(num_bins, 0);
+  for (size_t i = 0; i < n; i++) {
+    bins[i] = normalBin(normals[correspondences.source[i]].normal, elevation_bins, azimuth_bins);
+    counts[bins[i]]++;
+  }
+
+  // Even share per occupied bin, what small bins leave over goes to the larger ones
+  std::vector<unsigned int> order;
+  for (unsigned int b = 0; b < num_bins; b++) {
+    if (counts[b] > 0) {
+      order.push_back(b);
+    }
+  }
+  std::sort(order.begin(), order.end(), [&counts](unsigned int a, unsigned int b) { return counts[a] < counts[b]; });
+  std::vector<size_t> quotas(num_bins, 0);
+  size_t remaining = options.max_residuals;
+  for (size_t k = 0; k < order.size(); k++) {
+    size_t share = remaining / (order.size() - k);
+    quotas[order[k]] = std::min(counts[order[k]], share);
+    remaining -= quotas[order[k]];
+  }
+
+  // Keep the j-th correspondence of a bin if the even stride passes a new sample
+  std::vector<size_t> seen(num_bins, 0);
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) {
+    unsigned int b = bins[i];
+    uint64_t j = seen[b]++;
+    if ((j + 1) * quotas[b] / counts[b] > j * quotas[b] / counts[b]) {
+      correspondences.source[count] = correspondences.source[i];
+      correspondences.target[count] = correspondences.target[i];
+      correspondences.sqr_dist[count] = correspondences.sqr_dist[i];
+      count++;
+    }
+  }
+  correspondences.resize(count);
+  ROS_INFO_STREAM("Sampled " << count << " of " << n << " correspondences over " << order.size() << " normal bins.");
+}
+
+}
+}
@@ -1,5 +1,7 @@
 #include <lidar_calibration_lib/lidar_calibration_common.h>
 
+#include <limits>
+
 namespace hector_calibration {
 namespace lidar_calibration {
 
@@ -44,17 +46,6 @@ pcl::PointCloud<T> removeInvalidPoints(pcl::PointCloud<T>& cloud) {
   return cleaned_cloud;
 }
 
-template <class Iter, class Incr>
-void safeAdvance(Iter& curr, const Iter& end, Incr n)
-{
-  size_t remaining(std::distance(curr, end));
-  if (remaining < n)
-  {
-    n = remaining;
-  }
-  std::advance(curr, n);
-}
-
 void nanInfToZero(WeightedNormal& normal) {
   if (std::isnan(normal.normal.x()) || std::isnan(normal.normal.y()) || std::isnan(normal.normal.z())
       || std::isinf(normal.normal.x()) || std::isinf(normal.normal.y()) || std::isinf(normal.normal.z())) {
@@ -65,57 +56,110 @@ void nanInfToZero(WeightedNormal& normal) {
 
 
 void publishCloud(const pcl::PointCloud<pcl::PointXYZ>& cloud, const ros::Publisher& pub, std::string frame) {
+  if (!hasSubscribers(pub)) {
+    return;
+  }
   sensor_msgs::PointCloud2 cloud_msg;
-  pcl::toROSMsg(cloud, cloud_msg);
+  toXYZCloud(cloud, cloud_msg);
   publishCloud(cloud_msg, pub, frame);
 }
 
+bool hasSubscribers(const ros::Publisher& pub) {
+  return pub && (pub.getNumSubscribers() > 0 || pub.isLatched());
+}
+
 void publishCloud(sensor_msgs::PointCloud2& cloud, const ros::Publisher& pub, std::string frame) {
+  if (!pub) {
+    return;
+  }
   cloud.header.frame_id = frame;
   cloud.header.stamp = ros::Time::now();
   pub.publish(cloud);
 }
 
-std::map<unsigned int, unsigned int>
-findNeighbors(const pcl::PointCloud<pcl::PointXYZ>& cloud1,
-              const pcl::PointCloud<pcl::PointXYZ>& cloud2,
-              double max_sqr_dist)
+void findNeighbors(const pcl::PointCloud<pcl::PointXYZ>& cloud1,
+                   const pcl::PointCloud<pcl::PointXYZ>& cloud2,
+                   Correspondences& correspondences,
+                   double max_sqr_dist)
 {
-  pcl::KdTreeFLANN<pcl::PointXYZ> kdtree;
-  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud2_ptr(new pcl::PointCloud<pcl::PointXYZ>());
-  pcl::copyPointCloud(cloud2, *cloud2_ptr);
-  kdtree.setInputCloud(cloud2_ptr); // Search in second cloud to retrieve mapping from cloud1 -> cloud2
-
-  std::vector<int> index(1);
-  std::vector<float> sqrt_dist(1);
-
-  std::map<unsigned int, unsigned int> mapping;
-  for (unsigned int i = 0; i < cloud1.size(); i++) {
-    if (kdtree.nearestKSearch(cloud1[i], 1, index, sqrt_dist) > 0) { // Check if number of found neighbours > 0
-      if (sqrt_dist[0] <= max_sqr_dist) { // Only insert if smaller than max distance
-        std::pair<unsigned int, unsigned int> pair(i, index[0]);
-        mapping.insert(pair); // Mapping from cloud1 index to cloud2 index
+  NeighborSearch search;
+  search.setInputCloud(cloud2);
+  findNeighbors(cloud1, search, correspondences, max_sqr_dist);
+}
+
+void findNeighbors(const pcl::PointCloud<pcl::PointXYZ>& cloud1,
+                   const NeighborSearch& cloud2_search,
+                   Correspondences& correspondences,
+                   double max_sqr_dist)
+{
+  findNeighbors(cloud1, cloud2_search, std::vector<WeightedNormal>(), 0.0, correspondences, max_sqr_dist);
+}
+
+void findNeighbors(const pcl::PointCloud<pcl::PointXYZ>& cloud1,
+                   const NeighborSearch& cloud2_search,
+                   const std::vector<WeightedNormal>& normals,
+                   double min_weight,
+                   Correspondences& correspondences,
+                   double max_sqr_dist)
+{
+  // Search in second cloud to retrieve mapping from cloud1 -> cloud2.
+  // Every point writes its own slot, invalid slots are compacted afterwards.
+  const unsigned int no_match = std::numeric_limits<unsigned int>::max();
+  // Points without a usable plane are skipped before the search
+  const bool filter = !normals.empty() && min_weight > 0;
+  correspondences.resize(cloud1.size());
+#ifdef _OPENMP
+#pragma omp parallel shared (correspondences, cloud2_search, cloud1, normals)
+#endif
+  {
+    std::vector<int> index(1);
+    std::vector<float> sqr_dist(1);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for (unsigned int i = 0; i < cloud1.size(); i++) {
+      correspondences.source[i] = i;
+      correspondences.target[i] = no_match;
+      if (filter && !(normals[i].weight >= min_weight)) {
+        continue;
       }
+      if (cloud2_search.nearestSearch(cloud1[i], max_sqr_dist, index, sqr_dist) && sqr_dist[0] <= max_sqr_dist) {
+        correspondences.target[i] = (unsigned int) index[0];
+        correspondences.sqr_dist[i] = sqr_dist[0];
+      }
+    }
+  }
+
+  size_t count = 0;
+  for (size_t i = 0; i < correspondences.size(); i++) {
+    if (correspondences.target[i] != no_match) {
+      correspondences.source[count] = correspondences.source[i];
+      correspondences.target[count] = correspondences.target[i];
+      correspondences.sqr_dist[count] = correspondences.sqr_dist[i];
+      count++;
     }
   }
-  ROS_INFO_STREAM("Found " << mapping.size() << " neighbor matches.");
-  return mapping;
+  correspondences.resize(count);
+  ROS_INFO_STREAM("Found " << correspondences.size() << " neighbor matches.");
 }
 
 void publishNeighbors(const pcl::PointCloud<pcl::PointXYZ>& cloud1,
                       const pcl::PointCloud<pcl::PointXYZ>& cloud2,
-                      const std::map<unsigned int, unsigned int> &mapping,
+                      const Correspondences& correspondences,
                       ros::Publisher& pub,
                       std::string frame,
                       unsigned int number_of_markers)
 {
+  if (!pub) {
+    return;
+  }
   visualization_msgs::MarkerArray marker_array;
-  unsigned int step = floor(mapping.size() / number_of_markers);
+  size_t step = std::max<size_t>(1, correspondences.size() / std::max(1u, number_of_markers));
   unsigned int id_cnt = 0;
-  for (std::map<unsigned int, unsigned int>::const_iterator it = mapping.begin();
-       it != mapping.end();
-       safeAdvance<std::map<unsigned int, unsigned int>::const_iterator, unsigned int>(it, mapping.end(), step))
+  for (size_t i = 0; i < correspondences.size(); i += step)
   {
+    unsigned int source = correspondences.source[i];
+    unsigned int target = correspondences.target[i];
     visualization_msgs::Marker marker;
     marker.header.frame_id = frame;
     marker.header.stamp = ros::Time::now();
@@ -135,13 +179,13 @@ void publishNeighbors(const pcl::PointCloud<pcl::PointXYZ>& cloud1,
     geometry_msgs::Point point1;
     geometry_msgs::Point point2;
 
-    point1.x = (double) cloud1[it->first].x;
-    point1.y = (double) cloud1[it->first].y;
-    point1.z = (double) cloud1[it->first].z;
+    point1.x = (double) cloud1[source].x;
+    point1.y = (double) cloud1[source].y;
+    point1.z = (double) cloud1[source].z;
 
-    point2.x = (double) cloud2[it->second].x;
-    point2.y = (double) cloud2[it->second].y;
-    point2.z = (double) cloud2[it->second].z;
+    point2.x = (double) cloud2[target].x;
+    point2.y = (double) cloud2[target].y;
+    point2.z = (double) cloud2[target].z;
     marker.points.push_back(point1);
     marker.points.push_back(point2);
     marker_array.markers.push_back(marker);
@@ -149,47 +193,55 @@ void publishNeighbors(const pcl::PointCloud<pcl::PointXYZ>& cloud1,
   pub.publish(marker_array);
 }
 
-std::vector<WeightedNormal> computeNormals(const pcl::PointCloud<pcl::PointXYZ>& cloud, double radius)
+std::vector<WeightedNormal> computeNormals(const pcl::PointCloud<pcl::PointXYZ>& cloud, double radius, SearchBackendType backend)
 {
-  pcl::KdTreeFLANN<pcl::PointXYZ> kdtree;
-  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_ptr(new pcl::PointCloud<pcl::PointXYZ>());
-  pcl::copyPointCloud(cloud, *cloud_ptr);
-  kdtree.setInputCloud(cloud_ptr);
+  NeighborSearch search(backend, radius);
+  search.setInputCloud(cloud);
+  return computeNormals(search, radius);
+}
 
+std::vector<WeightedNormal> computeNormals(const NeighborSearch& search, double radius)
+{
+  // Normals are computed in the frame of the index and rotated afterwards
+  const pcl::PointCloud<pcl::PointXYZ>& cloud = search.getIndexedCloud();
+  const Eigen::Affine3d& transform = search.getTransform();
+  Eigen::Vector3f viewpoint = transform.inverse(Eigen::Isometry).translation().cast<float>();
+
+  // Neighborhoods are accumulated for a block of points, which is then solved at once
+  const long num_blocks = (cloud.size() + NORMAL_BLOCK_SIZE - 1) / NORMAL_BLOCK_SIZE;
   std::vector<WeightedNormal> normals(cloud.size());
 #ifdef _OPENMP
-#pragma omp parallel for shared (normals, kdtree, cloud)
+#pragma omp parallel shared (normals, search, cloud)
 #endif
-  for (unsigned int i = 0; i < cloud.size(); i++) {
-    pcl::PointXYZ p = cloud[i];
-
-    // Compute neighbors
+  {
     std::vector<int> indices;
     std::vector<float> sqrt_dist;
-    kdtree.radiusSearch(p, radius, indices, sqrt_dist);
-
-    double weight;
-    Eigen::Vector4f plane_parameters;
-    Eigen::Matrix3f covariance_matrix;
-    Eigen::Vector4f xyz_centroid;
-    if (indices.size () < 3 || pcl::computeMeanAndCovarianceMatrix (cloud, indices, covariance_matrix, xyz_centroid) == 0){
-      plane_parameters.setConstant(0);
-      weight = 0;
-    } else {
-      Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> eig(covariance_matrix);
-      const Eigen::Vector3f& eigen_values(eig.eigenvalues());
-
-      weight = 2* (eigen_values(1) - eigen_values(0)) / eigen_values.sum();
-      plane_parameters.block<3,1>(0, 0) = eig.eigenvectors().col(0);
-      plane_parameters[3] = 1;
-      pcl::flipNormalTowardsViewpoint(cloud[i], 0.0, 0.0, 0.0, plane_parameters);
+    NormalBlock block;
+    float nx[NORMAL_BLOCK_SIZE], ny[NORMAL_BLOCK_SIZE], nz[NORMAL_BLOCK_SIZE], weight[NORMAL_BLOCK_SIZE];
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 64)
+#endif
+    for (long b = 0; b < num_blocks; b++) {
+      const unsigned int begin = b * NORMAL_BLOCK_SIZE;
+      const unsigned int count = std::min<unsigned int>(NORMAL_BLOCK_SIZE, cloud.size() - begin);
+
+      block.clear();
+      for (unsigned int lane = 0; lane < count; lane++) {
+        // Compute neighbors
+        block.setQuery(lane, cloud[begin + lane]);
+        search.radiusSearch(begin + lane, radius, indices, sqrt_dist);
+        block.accumulate(lane, cloud, indices);
+      }
+      solveNormalBlock(block, viewpoint, nx, ny, nz, weight);
+
+      for (unsigned int lane = 0; lane < count; lane++) {
+        WeightedNormal normal;
+        normal.normal = transform.linear() * Eigen::Vector3d(nx[lane], ny[lane], nz[lane]);
+        normal.weight = weight[lane];
+        nanInfToZero(normal);
+        normals[begin + lane] = normal;
+      }
     }
-
-    WeightedNormal normal;
-    normal.normal = Eigen::Vector3d(plane_parameters[0], plane_parameters[1], plane_parameters[2]);
-    normal.weight = weight;
-    nanInfToZero(normal);
-    normals[i] = normal;
   }
 
   return normals;
@@ -230,6 +282,9 @@ void visualizePlanarity(const pcl::PointCloud<pcl::PointXYZ> &cloud,
                         ros::Publisher& pub,
                         std::string frame)
 {
+  if (!pub) {
+    return;
+  }
   if (normals.size() != cloud.size()) {
     ROS_ERROR_STREAM("Size of cloud (" << cloud.size() << ") doesn't match size of normals (" << normals.size() << ").");
     return;
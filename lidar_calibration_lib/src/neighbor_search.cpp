@@ -0,0 +1,100 @@
+#include <lidar_calibration_lib/neighbor_search.h>
+
+namespace hector_calibration {
+namespace lidar_calibration {
+
+NeighborSearch::NeighborSearch(SearchBackendType backend, double cell_size) :
+  cloud_(new pcl::PointCloud<pcl::PointXYZ>()),
+  backend_(createSearchBackend(backend, cell_size)),
+  transform_(Eigen::Affine3d::Identity()),
+  inverse_transform_(Eigen::Affine3f::Identity()),
+  is_identity_(true)
+{
+}
+
+void NeighborSearch::setInputCloud(const pcl::PointCloud<pcl::PointXYZ>& cloud) {
+  // The backend may keep a shared pointer to the cloud, so a new one is needed here
+  cloud_.reset(new pcl::PointCloud<pcl::PointXYZ>(cloud));
+  setTransform(Eigen::Affine3d::Identity());
+  backend_->setInputCloud(cloud_);
+}
+
+void NeighborSearch::updatePoints(const pcl::PointCloud<pcl::PointXYZ>& cloud) {
+  if (cloud.size() != cloud_->size() || cloud_->empty()) {
+    setInputCloud(cloud);
+    return;
+  }
+  std::copy(cloud.points.begin(), cloud.points.end(), cloud_->points.begin());
+  setTransform(Eigen::Affine3d::Identity());
+  backend_->setInputCloud(cloud_);
+}
+
+void NeighborSearch::setTransform(const Eigen::Affine3d& transform) {
+  transform_ = transform;
+  inverse_transform_ = transform.inverse(Eigen::Isometry).cast<float>();
+  is_identity_ = transform.matrix().isIdentity();
+}
+
+const Eigen::Affine3d& NeighborSearch::getTransform() const {
+  return transform_;
+}
+
+size_t NeighborSearch::size() const {
+  return cloud_->size();
+}
+
+bool NeighborSearch::empty() const {
+  return cloud_->empty();
+}
+
+pcl::PointXYZ NeighborSearch::getPoint(unsigned int i) const {
+  if (is_identity_) {
+    return (*cloud_)[i];
+  }
+  Eigen::Vector3f p = transform_.cast<float>() * (*cloud_)[i].getVector3fMap();
+  return pcl::PointXYZ(p.x(), p.y(), p.z());
+}
+
+const pcl::PointCloud<pcl::PointXYZ>& NeighborSearch::getIndexedCloud() const {
+  return *cloud_;
+}
+
+pcl::PointXYZ NeighborSearch::toIndexFrame(const pcl::PointXYZ& point) const {
+  if (is_identity_) {
+    return point;
+  }
+  Eigen::Vector3f p = inverse_transform_ * point.getVector3fMap();
+  return pcl::PointXYZ(p.x(), p.y(), p.z());
+}
+
+int NeighborSearch::radiusSearch(const pcl::PointXYZ& query, double radius,
+                                 std::vector<int>& indices, std::vector<float>& sqr_dists) const
+{
+  return backend_->radiusSearch(toIndexFrame(query), radius, indices, sqr_dists);
+}
+
+int NeighborSearch::radiusSearch(unsigned int index, double radius,
+                                 std::vector<int>& indices, std::vector<float>& sqr_dists) const
+{
+  return backend_->radiusSearch((*cloud_)[index], radius, indices, sqr_dists);
+}
+
+bool NeighborSearch::nearestSearch(const pcl::PointXYZ& query, double max_sqr_dist, int& index, float& sqr_dist) const {
+  std::vector<int> indices(1);
+  std::vector<float> sqr_dists(1);
+  if (nearestSearch(query, max_sqr_dist, indices, sqr_dists)) {
+    index = indices[0];
+    sqr_dist = sqr_dists[0];
+    return true;
+  }
+  return false;
+}
+
+bool NeighborSearch::nearestSearch(const pcl::PointXYZ& query, double max_sqr_dist,
+                                   std::vector<int>& indices, std::vector<float>& sqr_dists) const
+{
+  return backend_->nearestSearch(toIndexFrame(query), max_sqr_dist, indices, sqr_dists);
+}
+
+}
+}
@@ -0,0 +1,194 @@
+#include <lidar_calibration_lib/normal_estimation.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace hector_calibration {
+namespace lidar_calibration {
+
+namespace {
+  // Squared norm below which a cross product is treated as degenerate
+  const float DEGENERATE_SQR_NORM = 1e-6f;
+
+  // By value, std::max returns references to temporaries which block vectorization
+  inline float maxf(float a, float b) {
+    return a > b ? a : b;
+  }
+
+  // atan2(y, x) for y >= 0 with the Cephes atanf polynomial. Written without
+  // branches or library calls so that the lane loop below vectorizes.
+  inline float atan2Positive(float y, float x) {
+    const float ax = std::abs(x);
+    const bool swap = y > ax;
+    const float num = swap ? ax : y;
+    const float den = maxf(swap ? y : ax, 1e-30f);
+    float t = num / den; // in [0, 1]
+    const bool reduce = t > 0.41421356f; // tan(pi/8)
+    const float reduced = (t - 1.0f) / (t + 1.0f);
+    t = reduce ? reduced : t;
+    const float z = t*t;
+    float a = ((((8.05374449538e-2f*z - 1.38776856032e-1f)*z + 1.99777106478e-1f)*z - 3.33329491539e-1f)*z)*t + t;
+    a = reduce ? a + 0.78539816f : a;
+    a = swap ? 1.57079633f - a : a;
+    return x < 0.0f ? 3.14159265f - a : a;
+  }
+
+  // Taylor series for cos and sin, accurate to float precision on [0, pi/3]
+  inline float cosSmall(float x) {
+    const float z = x*x;
+    return 1.0f + z*(-1.0f/2 + z*(1.0f/24 + z*(-1.0f/720 + z*(1.0f/40320 + z*(-1.0f/3628800)))));
+  }
+
+  inline float sinSmall(float x) {
+    const float z = x*x;
+    return x*(1.0f + z*(-1.0f/6 + z*(1.0f/120 + z*(-1.0f/5040 + z*(1.0f/362880 + z*(-1.0f/39916800))))));
+  }
+
+  inline void cross(float ax, float ay, float az, float bx, float by, float bz,
+                    float& cx, float& cy, float& cz) {
+    cx = ay*bz - az*by;
+    cy = az*bx - ax*bz;
+    cz = ax*by - ay*bx;
+  }
+
+  // Cross product of the rows of (m - r*I) with the largest norm. It is
+  // orthogonal to both rows and therefore the eigenvector for r.
+  inline float eigenvectorFromRows(float m00, float m01, float m02, float m11, float m12, float m22, float r,
+                                   float& vx, float& vy, float& vz) {
+    float r0x = m00 - r, r0y = m01, r0z = m02;
+    float r1x = m01, r1y = m11 - r, r1z = m12;
+    float r2x = m02, r2y = m12, r2z = m22 - r;
+
+    float c01x, c01y, c01z, c02x, c02y, c02z, c12x, c12y, c12z;
+    cross(r0x, r0y, r0z, r1x, r1y, r1z, c01x, c01y, c01z);
+    cross(r0x, r0y, r0z, r2x, r2y, r2z, c02x, c02y, c02z);
+    cross(r1x, r1y, r1z, r2x, r2y, r2z, c12x, c12y, c12z);
+    float d01 = c01x*c01x + c01y*c01y + c01z*c01z;
+    float d02 = c02x*c02x + c02y*c02y + c02z*c02z;
+    float d12 = c12x*c12x + c12y*c12y + c12z*c12z;
+
+    bool use01 = (d01 >= d02) & (d01 >= d12);
+    bool use02 = !use01 & (d02 >= d12);
+    vx = use01 ? c01x : (use02 ? c02x : c12x);
+    vy = use01 ? c01y : (use02 ? c02y : c12y);
+    vz = use01 ? c01z : (use02 ? c02z : c12z);
+    return use01 ? d01 : (use02 ? d02 : d12);
+  }
+}
+
+void NormalBlock::clear() {
+  for (unsigned int lane = 0; lane < NORMAL_BLOCK_SIZE; lane++) {
+    setQuery(lane, pcl::PointXYZ(0, 0, 0));
+  }
+}
+
+void NormalBlock::setQuery(unsigned int lane, const pcl::PointXYZ& query) {
+  count[lane] = 0;
+  qx[lane] = query.x; qy[lane] = query.y; qz[lane] = query.z;
+  sx[lane] = 0; sy[lane] = 0; sz[lane] = 0;
+  sxx[lane] = 0; sxy[lane] = 0; sxz[lane] = 0;
+  syy[lane] = 0; syz[lane] = 0; szz[lane] = 0;
+}
+
+void NormalBlock::accumulate(unsigned int lane, const pcl::PointCloud<pcl::PointXYZ>& cloud, const std::vector<int>& indices) {
+  const float ox = qx[lane], oy = qy[lane], oz = qz[lane];
+  float a[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+  for (size_t i = 0; i < indices.size(); i++) {
+    const pcl::PointXYZ& p = cloud[indices[i]];
+    float x = p.x - ox, y = p.y - oy, z = p.z - oz;
+    a[0] += x; a[1] += y; a[2] += z;
+    a[3] += x*x; a[4] += x*y; a[5] += x*z;
+    a[6] += y*y; a[7] += y*z; a[8] += z*z;
+  }
+  count[lane] += (float) indices.size();
+  sx[lane] += a[0]; sy[lane] += a[1]; sz[lane] += a[2];
+  sxx[lane] += a[3]; sxy[lane] += a[4]; sxz[lane] += a[5];
+  syy[lane] += a[6]; syz[lane] += a[7]; szz[lane] += a[8];
+}
+
+void solveNormalBlock(const NormalBlock& block, const Eigen::Vector3f& viewpoint,
+                      float* nx, float* ny, float* nz, float* weight)
+{
+  const float sqrt3 = std::sqrt(3.0f);
+  const float vpx = viewpoint.x(), vpy = viewpoint.y(), vpz = viewpoint.z();
+
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+  for (unsigned int l = 0; l < NORMAL_BLOCK_SIZE; l++) {
+    const bool valid = block.count[l] >= 3;
+    // Divisions are done unconditionally, otherwise the compiler can't if-convert the loop
+    const float inv_n = 1.0f / maxf(block.count[l], 1.0f);
+
+    // Covariance
+    const float mx = block.sx[l]*inv_n, my = block.sy[l]*inv_n, mz = block.sz[l]*inv_n;
+    const float a00 = block.sxx[l]*inv_n - mx*mx;
+    const float a01 = block.sxy[l]*inv_n - mx*my;
+    const float a02 = block.sxz[l]*inv_n - mx*mz;
+    const float a11 = block.syy[l]*inv_n - my*my;
+    const float a12 = block.syz[l]*inv_n - my*mz;
+    const float a22 = block.szz[l]*inv_n - mz*mz;
+
+    // Shift to zero trace and scale to [-1, 1] to avoid over- and underflow
+    const float shift = (a00 + a11 + a22) / 3.0f;
+    const float b00 = a00 - shift, b11 = a11 - shift, b22 = a22 - shift;
+    float scale = maxf(maxf(maxf(std::abs(b00), std::abs(b11)), maxf(std::abs(b22), std::abs(a01))),
+                   maxf(std::abs(a02), std::abs(a12)));
+    const bool isotropic = !(scale > 0.0f);
+    scale = isotropic ? 1.0f : scale;
+    const float inv_scale = 1.0f / scale;
+    const float m00 = b00*inv_scale, m11 = b11*inv_scale, m22 = b22*inv_scale;
+    const float m01 = a01*inv_scale, m02 = a02*inv_scale, m12 = a12*inv_scale;
+
+    // Characteristic polynomial l^3 + c1*l - c0 = 0 (trace is zero), solved with the trigonometric method
+    const float c0 = m00*(m11*m22 - m12*m12) - m01*(m01*m22 - m12*m02) + m02*(m01*m12 - m11*m02);
+    const float c1 = m00*m11 - m01*m01 + m00*m22 - m02*m02 + m11*m22 - m12*m12;
+    const float a_over_3 = maxf(-c1 / 3.0f, 0.0f);
+    const float half_b = 0.5f * c0;
+    const float q = maxf(a_over_3*a_over_3*a_over_3 - half_b*half_b, 0.0f);
+    const float rho = std::sqrt(a_over_3);
+    const float theta = atan2Positive(std::sqrt(q), half_b) / 3.0f; // in [0, pi/3]
+    const float cos_theta = cosSmall(theta);
+    const float sin_theta = sinSmall(theta);
+    const float r0 = -rho*(cos_theta + sqrt3*sin_theta);
+    const float r1 = -rho*(cos_theta - sqrt3*sin_theta);
+    const float r2 = 2.0f*rho*cos_theta;
+
+    // Eigenvector of the smallest eigenvalue. If it is a double root, any
+    // vector orthogonal to the eigenvector of the largest one is valid.
+    float ex, ey, ez;
+    float e_sqr = eigenvectorFromRows(m00, m01, m02, m11, m12, m22, r0, ex, ey, ez);
+    float fx, fy, fz;
+    eigenvectorFromRows(m00, m01, m02, m11, m12, m22, r2, fx, fy, fz);
+    const bool use_xy = fx*fx + fy*fy > DEGENERATE_SQR_NORM * (fx*fx + fy*fy + fz*fz);
+    const float ox = use_xy ? -fy : 0.0f;
+    const float oy = use_xy ? fx : -fz;
+    const float oz = use_xy ? 0.0f : fy;
+    const float o_sqr = ox*ox + oy*oy + oz*oz;
+    const bool degenerate = !(e_sqr > DEGENERATE_SQR_NORM);
+    ex = degenerate ? ox : ex;
+    ey = degenerate ? oy : ey;
+    ez = degenerate ? oz : ez;
+    e_sqr = degenerate ? o_sqr : e_sqr;
+    const bool no_direction = isotropic | !(e_sqr > 0.0f);
+    const float inv_norm = 1.0f / std::sqrt(maxf(e_sqr, 1e-30f));
+    ex = no_direction ? 1.0f : ex*inv_norm;
+    ey = no_direction ? 0.0f : ey*inv_norm;
+    ez = no_direction ? 0.0f : ez*inv_norm;
+
+    // Flip towards viewpoint
+    const float dot = (vpx - block.qx[l])*ex + (vpy - block.qy[l])*ey + (vpz - block.qz[l])*ez;
+    const float sign = dot < 0.0f ? -1.0f : 1.0f;
+
+    const float trace = 3.0f*shift;
+    const float w = trace > 0.0f ? 2.0f*(r1 - r0)*scale / maxf(trace, 1e-30f) : 0.0f;
+
+    nx[l] = valid ? sign*ex : 0.0f;
+    ny[l] = valid ? sign*ey : 0.0f;
+    nz[l] = valid ? sign*ez : 0.0f;
+    weight[l] = valid ? w : 0.0f;
+  }
+}
+
+}
+}
@@ -0,0 +1,287 @@
+#include <lidar_calibration_lib/organized_normals.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdint.h>
+
+namespace hector_calibration {
+namespace lidar_calibration {
+
+namespace {
+  inline bool isFinite(const pcl::PointXYZ& p) {
+    return std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z);
+  }
+
+  // Invalid points are infinitely far away
+  inline float sqrDist(const pcl::PointXYZ& a, const pcl::PointXYZ& b) {
+    float dx = a.x - b.x;
+    float dy = a.y - b.y;
+    float dz = a.z - b.z;
+    float sqr_dist = dx*dx + dy*dy + dz*dz;
+    return std::isfinite(sqr_dist) ? sqr_dist : std::numeric_limits<float>::max();
+  }
+
+  // Closest point to query in [begin, end), searched in a window around guess
+  unsigned int closestInWindow(const pcl::PointCloud<pcl::PointXYZ>& cloud, unsigned int begin, unsigned int end,
+                               unsigned int guess, unsigned int window, const pcl::PointXYZ& query, float& best) {
+    unsigned int first = guess > begin + window ? guess - window : begin;
+    unsigned int last = std::min(end, guess + window + 1);
+    unsigned int closest = first;
+    best = std::numeric_limits<float>::max();
+    for (unsigned int j = first; j < last; j++) {
+      float sqr_dist = sqrDist(cloud[j], query);
+      if (sqr_dist < best) {
+        best = sqr_dist;
+        closest = j;
+      }
+    }
+    return closest;
+  }
+
+  // Walks from start along the line as long as points get closer to query
+  unsigned int descend(const pcl::PointCloud<pcl::PointXYZ>& cloud, unsigned int begin, unsigned int end,
+                       unsigned int start, const pcl::PointXYZ& query, float& best) {
+    unsigned int pos = start;
+    best = sqrDist(cloud[pos], query);
+    while (pos > begin) {
+      float sqr_dist = sqrDist(cloud[pos - 1], query);
+      if (sqr_dist >= best) {
+        break;
+      }
+      best = sqr_dist;
+      pos--;
+    }
+    while (pos + 1 < end) {
+      float sqr_dist = sqrDist(cloud[pos + 1], query);
+      if (sqr_dist >= best) {
+        break;
+      }
+      best = sqr_dist;
+      pos++;
+    }
+    return pos;
+  }
+
+  // Adds all points around center that are within the radius. Returns the number of added points.
+  unsigned int addWindow(const pcl::PointCloud<pcl::PointXYZ>& cloud, unsigned int begin, unsigned int end,
+                         unsigned int center, unsigned int window, const pcl::PointXYZ& query,
+                         float sqr_radius, std::vector<int>& indices) {
+    unsigned int first = center > begin + window ? center - window : begin;
+    unsigned int last = std::min(end, center + window + 1);
+    unsigned int added = 0;
+    for (unsigned int j = first; j < last; j++) {
+      if (sqrDist(cloud[j], query) <= sqr_radius) {
+        indices.push_back(j);
+        added++;
+      }
+    }
+    return added;
+  }
+
+  void storeBlock(const float* nx, const float* ny, const float* nz, const float* weight,
+                  const unsigned int* point_indices, unsigned int count, std::vector<WeightedNormal>& normals) {
+    for (unsigned int lane = 0; lane < count; lane++) {
+      WeightedNormal normal(Eigen::Vector3d(nx[lane], ny[lane], nz[lane]), weight[lane]);
+      nanInfToZero(normal);
+      normals[point_indices[lane]] = normal;
+    }
+  }
+}
+
+ScanLines scanLinesFromAngles(const std::vector<double>& angles) {
+  ScanLines lines;
+  for (unsigned int i = 0; i < angles.size(); i++) {
+    if (i == 0 || angles[i] != angles[i-1]) {
+      lines.begin.push_back(i);
+    }
+  }
+  lines.begin.push_back(angles.size());
+  return lines;
+}
+
+ScanLines scanLinesFromRuns(const std::vector<double>& angles, const std::vector<uint32_t>& offsets,
+                            const std::vector<uint32_t>& counts, size_t num_points)
+{
+  ScanLines lines;
+  size_t num_runs = std::min(angles.size(), std::min(offsets.size(), counts.size()));
+  double line_angle = 0;
+  for (size_t r = 0; r < num_runs; r++) {
+    if (counts[r] == 0 || offsets[r] >= num_points) {
+      continue;
+    }
+    if (lines.begin.empty() || angles[r] != line_angle) {
+      lines.begin.push_back(lines.begin.empty() ? 0 : offsets[r]);
+      line_angle = angles[r];
+    }
+  }
+  lines.begin.push_back(num_points);
+  return lines;
+}
+
+std::vector<WeightedNormal> computeOrganizedNormals(const pcl::PointCloud<pcl::PointXYZ>& cloud,
+                                                    const ScanLines& lines, double radius,
+                                                    NeighborSearch& fallback_search,
+                                                    const OrganizedNeighborhood& neighborhood)
+{
+  std::vector<WeightedNormal> normals(cloud.size(), WeightedNormal(Eigen::Vector3d::Zero(), 0));
+  if (lines.size() == 0 || lines.begin.back() != cloud.size()) {
+    ROS_ERROR_STREAM("Scan lines don't match cloud of size " << cloud.size() << ".");
+    return normals;
+  }
+
+  std::vector<unsigned int> line_of_point(cloud.size());
+  for (unsigned int l = 0; l < lines.size(); l++) {
+    std::fill(line_of_point.begin() + lines.lineBegin(l), line_of_point.begin() + lines.lineEnd(l), l);
+  }
+
+  const float sqr_radius = (float) (radius * radius);
+  const Eigen::Vector3f viewpoint = Eigen::Vector3f::Zero();
+  const int line_window = (int) neighborhood.line_window;
+  const long num_blocks = (cloud.size() + NORMAL_BLOCK_SIZE - 1) / NORMAL_BLOCK_SIZE;
+  std::vector<unsigned char> use_fallback(cloud.size(), 0);
+
+  // Neighborhoods from the scan structure
+#ifdef _OPENMP
+#pragma omp parallel shared (normals, cloud, lines, line_of_point, use_fallback)
+#endif
+  {
+    std::vector<int> indices;
+    NormalBlock block;
+    float nx[NORMAL_BLOCK_SIZE], ny[NORMAL_BLOCK_SIZE], nz[NORMAL_BLOCK_SIZE], weight[NORMAL_BLOCK_SIZE];
+    unsigned int point_indices[NORMAL_BLOCK_SIZE];
+    bool organized[NORMAL_BLOCK_SIZE];
+
+    // Closest point in each neighboring line for the previous query. Consecutive
+    // queries have close neighbors, so the next search starts from there.
+    std::vector<unsigned int> cursors(2*line_window + 1);
+    std::vector<bool> cursor_valid(2*line_window + 1);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 64)
+#endif
+    for (long b = 0; b < num_blocks; b++) {
+      const unsigned int begin = b * NORMAL_BLOCK_SIZE;
+      const unsigned int count = std::min<unsigned int>(NORMAL_BLOCK_SIZE, cloud.size() - begin);
+      std::fill(cursor_valid.begin(), cursor_valid.end(), false);
+      long cursor_line = -1;
+
+      block.clear();
+      for (unsigned int lane = 0; lane < count; lane++) {
+        const unsigned int i = begin + lane;
+        const pcl::PointXYZ& query = cloud[i];
+        point_indices[lane] = i;
+        organized[lane] = false;
+        block.setQuery(lane, query);
+        if (!isFinite(query)) {
+          continue;
+        }
+
+        const long line = line_of_point[i];
+        if (line != cursor_line) {
+          std::fill(cursor_valid.begin(), cursor_valid.end(), false);
+          cursor_line = line;
+        }
+
+        indices.clear();
+        addWindow(cloud, lines.lineBegin(line), lines.lineEnd(line), i, neighborhood.point_window, query, sqr_radius, indices);
+        unsigned int lines_used = 1;
+        for (int direction = -1; direction <= 1; direction += 2) {
+          for (int k = 1; k <= line_window; k++) {
+            const long neighbor_line = line + direction*k;
+            if (neighbor_line < 0 || neighbor_line >= (long) lines.size()) {
+              break;
+            }
+            const unsigned int neighbor_begin = lines.lineBegin(neighbor_line);
+            const unsigned int neighbor_end = lines.lineEnd(neighbor_line);
+            const unsigned int slot = line_window + direction*k;
+
+            float best;
+            unsigned int closest;
+            if (cursor_valid[slot]) {
+              closest = descend(cloud, neighbor_begin, neighbor_end, cursors[slot], query, best);
+            } else {
+              // Lines are sampled alike, so the relative position is a good first guess
+              const unsigned int line_begin = lines.lineBegin(line);
+              const unsigned int line_size = lines.lineEnd(line) - line_begin;
+              const unsigned int guess = neighbor_begin
+                  + (unsigned int) ((uint64_t) (i - line_begin) * (neighbor_end - neighbor_begin) / line_size);
+              closest = closestInWindow(cloud, neighbor_begin, neighbor_end, guess, neighborhood.search_window, query, best);
+            }
+            cursors[slot] = closest;
+            cursor_valid[slot] = best <= sqr_radius;
+            if (best > sqr_radius) {
+              // Structure breaks, lines further away won't be closer
+              break;
+            }
+            if (addWindow(cloud, neighbor_begin, neighbor_end, closest, neighborhood.point_window, query, sqr_radius, indices) > 0) {
+              lines_used++;
+            }
+          }
+        }
+
+        if (indices.size() < neighborhood.min_neighbors || lines_used < 2) {
+          use_fallback[i] = 1;
+          continue;
+        }
+        block.accumulate(lane, cloud, indices);
+        organized[lane] = true;
+      }
+      solveNormalBlock(block, viewpoint, nx, ny, nz, weight);
+      storeBlock(nx, ny, nz, weight, point_indices, count, normals);
+
+      // Close to the rotation axis all lines run through the same points and
+      // the neighborhood degenerates to a line
+      for (unsigned int lane = 0; lane < count; lane++) {
+        if (organized[lane] && weight[lane] < neighborhood.min_weight) {
+          use_fallback[point_indices[lane]] = 1;
+        }
+      }
+    }
+  }
+
+  std::vector<unsigned int> fallback_indices;
+  for (unsigned int i = 0; i < use_fallback.size(); i++) {
+    if (use_fallback[i]) {
+      fallback_indices.push_back(i);
+    }
+  }
+  ROS_DEBUG_STREAM("Organized normals: " << fallback_indices.size() << " of " << cloud.size() << " points use the spatial search.");
+  if (fallback_indices.empty()) {
+    return normals;
+  }
+
+  // Spatial search where the structure breaks
+  fallback_search.updatePoints(cloud);
+  const long num_fallback_blocks = (fallback_indices.size() + NORMAL_BLOCK_SIZE - 1) / NORMAL_BLOCK_SIZE;
+#ifdef _OPENMP
+#pragma omp parallel shared (normals, cloud, fallback_indices, fallback_search)
+#endif
+  {
+    std::vector<int> indices;
+    std::vector<float> sqr_dists;
+    NormalBlock block;
+    float nx[NORMAL_BLOCK_SIZE], ny[NORMAL_BLOCK_SIZE], nz[NORMAL_BLOCK_SIZE], weight[NORMAL_BLOCK_SIZE];
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 64)
+#endif
+    for (long b = 0; b < num_fallback_blocks; b++) {
+      const unsigned int begin = b * NORMAL_BLOCK_SIZE;
+      const unsigned int count = std::min<unsigned int>(NORMAL_BLOCK_SIZE, fallback_indices.size() - begin);
+
+      block.clear();
+      for (unsigned int lane = 0; lane < count; lane++) {
+        const unsigned int i = fallback_indices[begin + lane];
+        block.setQuery(lane, cloud[i]);
+        fallback_search.radiusSearch(i, radius, indices, sqr_dists);
+        block.accumulate(lane, cloud, indices);
+      }
+      solveNormalBlock(block, viewpoint, nx, ny, nz, weight);
+      storeBlock(nx, ny, nz, weight, &fallback_indices[begin], count, normals);
+    }
+  }
+
+  return normals;
+}
+
+}
+}
@@ -0,0 +1,139 @@
+#include <lidar_calibration_lib/profiler.h>
+
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include <diagnostic_msgs/KeyValue.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace hector_calibration {
+namespace lidar_calibration {
+
+namespace {
+  diagnostic_msgs::KeyValue keyValue(const std::string& key, double value) {
+    diagnostic_msgs::KeyValue kv;
+    kv.key = key;
+    std::stringstream ss;
+    ss << value;
+    kv.value = ss.str();
+    return kv;
+  }
+}
+
+Profiler& Profiler::instance() {
+  static Profiler profiler;
+  return profiler;
+}
+
+Profiler::Profiler() :
+  enabled_(false)
+{
+}
+
+void Profiler::setEnabled(bool enabled) {
+  enabled_ = enabled;
+}
+
+void Profiler::addTime(const char* stage, double seconds) {
+  boost::mutex::scoped_lock lock(mutex_);
+  std::map<std::string, size_t>::iterator it = stage_index_.find(stage);
+  if (it == stage_index_.end()) {
+    it = stage_index_.insert(std::make_pair(std::string(stage), stages_.size())).first;
+    stages_.push_back(std::make_pair(std::string(stage), StageStats()));
+  }
+  StageStats& stats = stages_[it->second].second;
+  stats.calls++;
+  stats.total += seconds;
+  stats.max = std::max(stats.max, seconds);
+}
+
+void Profiler::addCount(const char* counter, uint64_t count) {
+  boost::mutex::scoped_lock lock(mutex_);
+  std::map<std::string, size_t>::iterator it = counter_index_.find(counter);
+  if (it == counter_index_.end()) {
+    it = counter_index_.insert(std::make_pair(std::string(counter), counters_.size())).first;
+    counters_.push_back(std::make_pair(std::string(counter), CounterStats()));
+  }
+  CounterStats& stats = counters_[it->second].second;
+  stats.calls++;
+  stats.total += count;
+}
+
+void Profiler::reset() {
+  boost::mutex::scoped_lock lock(mutex_);
+  stages_.clear();
+  counters_.clear();
+  stage_index_.clear();
+  counter_index_.clear();
+}
+
+diagnostic_msgs::DiagnosticStatus Profiler::toDiagnosticStatus(const std::string& name) const {
+  boost::mutex::scoped_lock lock(mutex_);
+  diagnostic_msgs::DiagnosticStatus status;
+  status.level = diagnostic_msgs::DiagnosticStatus::OK;
+  status.name = name;
+  std::stringstream ss;
+  ss << stages_.size() << " stages, " << counters_.size() << " counters";
+  status.message = ss.str();
+  for (size_t i = 0; i < stages_.size(); i++) {
+    const std::string& stage = stages_[i].first;
+    const StageStats& stats = stages_[i].second;
+    status.values.push_back(keyValue(stage + " time [ms]", 1000 * stats.total));
+    status.values.push_back(keyValue(stage + " calls", stats.calls));
+    status.values.push_back(keyValue(stage + " mean [ms]", 1000 * stats.total / stats.calls));
+    status.values.push_back(keyValue(stage + " max [ms]", 1000 * stats.max));
+  }
+  for (size_t i = 0; i < counters_.size(); i++) {
+    status.values.push_back(keyValue(counters_[i].first, counters_[i].second.total));
+  }
+  return status;
+}
+
+void Profiler::publishDiagnostics(const ros::Publisher& pub, const std::string& name) const {
+  if (!enabled_ || !pub) {
+    return;
+  }
+  diagnostic_msgs::DiagnosticArray array;
+  array.header.stamp = ros::Time::now();
+  array.status.push_back(toDiagnosticStatus(name));
+  pub.publish(array);
+}
+
+std::string Profiler::summary() const {
+  boost::mutex::scoped_lock lock(mutex_);
+  size_t width = 8;
+  for (size_t i = 0; i < stages_.size(); i++) {
+    width = std::max(width, stages_[i].first.size());
+  }
+  for (size_t i = 0; i < counters_.size(); i++) {
+    width = std::max(width, counters_[i].first.size());
+  }
+  width += 2;
+
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(2);
+  ss << std::left << std::setw(width) << "Stage" << std::right
+     << std::setw(8) << "Calls" << std::setw(14) << "Total [ms]"
+     << std::setw(12) << "Mean [ms]" << std::setw(12) << "Max [ms]" << "\n";
+  for (size_t i = 0; i < stages_.size(); i++) {
+    const StageStats& stats = stages_[i].second;
+    ss << std::left << std::setw(width) << stages_[i].first << std::right
+       << std::setw(8) << stats.calls << std::setw(14) << 1000 * stats.total
+       << std::setw(12) << 1000 * stats.total / stats.calls << std::setw(12) << 1000 * stats.max << "\n";
+  }
+  if (!counters_.empty()) {
+    ss << std::left << std::setw(width) << "Counter" << std::right
+       << std::setw(8) << "Calls" << std::setw(14) << "Total" << std::setw(12) << "Mean" << "\n";
+    for (size_t i = 0; i < counters_.size(); i++) {
+      const CounterStats& stats = counters_[i].second;
+      ss << std::left << std::setw(width) << counters_[i].first << std::right
+         << std::setw(8) << stats.calls << std::setw(14) << stats.total
+         << std::setw(12) << (double) stats.total / stats.calls << "\n";
+    }
+  }
+  return ss.str();
+}
+
+}
+}
@@ -0,0 +1,283 @@
+#include <lidar_calibration_lib/search_backend.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace hector_calibration {
+namespace lidar_calibration {
+
+namespace {
+  const uint64_t EMPTY_KEY = std::numeric_limits<uint64_t>::max();
+  const int CELL_BITS = 21;
+  const int CELL_OFFSET = 1 << (CELL_BITS - 1);
+  const int CELL_MAX = (1 << CELL_BITS) - 1;
+
+  inline uint64_t hashKey(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+  }
+
+  inline bool isFinite(const pcl::PointXYZ& p) {
+    return std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z);
+  }
+}
+
+bool searchBackendFromString(const std::string& name, SearchBackendType& type) {
+  if (name == "kdtree") {
+    type = KDTREE;
+  } else if (name == "voxel_hash") {
+    type = VOXEL_HASH;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+std::string searchBackendToString(SearchBackendType type) {
+  switch (type) {
+    case VOXEL_HASH: return "voxel_hash";
+    case KDTREE:
+    default: return "kdtree";
+  }
+}
+
+SearchBackend::Ptr createSearchBackend(SearchBackendType type, double cell_size) {
+  if (type == VOXEL_HASH) {
+    return SearchBackend::Ptr(new VoxelHashSearchBackend(cell_size));
+  }
+  return SearchBackend::Ptr(new KdTreeSearchBackend());
+}
+
+// ---------------------------------------------------------------------------
+// KdTreeSearchBackend
+// ---------------------------------------------------------------------------
+
+KdTreeSearchBackend::KdTreeSearchBackend() :
+  empty_(true)
+{
+}
+
+void KdTreeSearchBackend::setInputCloud(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& cloud) {
+  empty_ = cloud->empty();
+  if (!empty_) {
+    kdtree_.setInputCloud(cloud);
+  }
+}
+
+int KdTreeSearchBackend::radiusSearch(const pcl::PointXYZ& query, double radius,
+                                      std::vector<int>& indices, std::vector<float>& sqr_dists) const
+{
+  if (empty_) {
+    indices.clear();
+    sqr_dists.clear();
+    return 0;
+  }
+  return kdtree_.radiusSearch(query, radius, indices, sqr_dists);
+}
+
+bool KdTreeSearchBackend::nearestSearch(const pcl::PointXYZ& query, double /*max_sqr_dist*/,
+                                        std::vector<int>& indices, std::vector<float>& sqr_dists) const
+{
+  if (empty_) {
+    return false;
+  }
+  return kdtree_.nearestKSearch(query, 1, indices, sqr_dists) > 0;
+}
+
+// ---------------------------------------------------------------------------
+// VoxelHashSearchBackend
+// ---------------------------------------------------------------------------
+
+VoxelHashSearchBackend::VoxelHashSearchBackend(double cell_size) :
+  cell_size_((float) cell_size),
+  inv_cell_size_((float) (1.0 / cell_size)),
+  table_mask_(0)
+{
+}
+
+void VoxelHashSearchBackend::cellCoordinates(const pcl::PointXYZ& point, int& cx, int& cy, int& cz) const {
+  cx = (int) std::floor(point.x * inv_cell_size_);
+  cy = (int) std::floor(point.y * inv_cell_size_);
+  cz = (int) std::floor(point.z * inv_cell_size_);
+}
+
+uint64_t VoxelHashSearchBackend::cellKey(int cx, int cy, int cz) const {
+  uint64_t x = (uint64_t) std::min(std::max(cx + CELL_OFFSET, 0), CELL_MAX);
+  uint64_t y = (uint64_t) std::min(std::max(cy + CELL_OFFSET, 0), CELL_MAX);
+  uint64_t z = (uint64_t) std::min(std::max(cz + CELL_OFFSET, 0), CELL_MAX);
+  return (x << (2*CELL_BITS)) | (y << CELL_BITS) | z;
+}
+
+const VoxelHashSearchBackend::Cell* VoxelHashSearchBackend::findCell(uint64_t key) const {
+  if (table_.empty()) {
+    return NULL;
+  }
+  uint64_t slot = hashKey(key) & table_mask_;
+  while (true) {
+    const Cell& cell = table_[slot];
+    if (cell.key == key) {
+      return &cell;
+    }
+    if (cell.key == EMPTY_KEY) {
+      return NULL;
+    }
+    slot = (slot + 1) & table_mask_;
+  }
+}
+
+void VoxelHashSearchBackend::setInputCloud(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& cloud) {
+  // Sort valid points by cell key
+  std::vector<std::pair<uint64_t, int> > keyed;
+  keyed.reserve(cloud->size());
+  for (unsigned int i = 0; i < cloud->size(); i++) {
+    const pcl::PointXYZ& p = (*cloud)[i];
+    if (!isFinite(p)) {
+      continue;
+    }
+    int cx, cy, cz;
+    cellCoordinates(p, cx, cy, cz);
+    keyed.push_back(std::make_pair(cellKey(cx, cy, cz), (int) i));
+  }
+  std::sort(keyed.begin(), keyed.end());
+
+  x_.resize(keyed.size());
+  y_.resize(keyed.size());
+  z_.resize(keyed.size());
+  indices_.resize(keyed.size());
+  size_t num_cells = 0;
+  for (size_t i = 0; i < keyed.size(); i++) {
+    const pcl::PointXYZ& p = (*cloud)[keyed[i].second];
+    x_[i] = p.x;
+    y_[i] = p.y;
+    z_[i] = p.z;
+    indices_[i] = keyed[i].second;
+    if (i == 0 || keyed[i].first != keyed[i-1].first) {
+      num_cells++;
+    }
+  }
+
+  // Table is kept at most half full
+  size_t capacity = 16;
+  while (capacity < 2*num_cells) {
+    capacity *= 2;
+  }
+  Cell empty_cell;
+  empty_cell.key = EMPTY_KEY;
+  empty_cell.begin = 0;
+  empty_cell.end = 0;
+  table_.assign(capacity, empty_cell);
+  table_mask_ = capacity - 1;
+
+  size_t begin = 0;
+  while (begin < keyed.size()) {
+    size_t end = begin;
+    while (end < keyed.size() && keyed[end].first == keyed[begin].first) {
+      end++;
+    }
+    uint64_t slot = hashKey(keyed[begin].first) & table_mask_;
+    while (table_[slot].key != EMPTY_KEY) {
+      slot = (slot + 1) & table_mask_;
+    }
+    table_[slot].key = keyed[begin].first;
+    table_[slot].begin = (uint32_t) begin;
+    table_[slot].end = (uint32_t) end;
+    begin = end;
+  }
+}
+
+int VoxelHashSearchBackend::radiusSearch(const pcl::PointXYZ& query, double radius,
+                                         std::vector<int>& indices, std::vector<float>& sqr_dists) const
+{
+  indices.clear();
+  sqr_dists.clear();
+  if (!isFinite(query)) {
+    return 0;
+  }
+
+  const float sqr_radius = (float) (radius * radius);
+  const int rings = std::max(1, (int) std::ceil(radius * inv_cell_size_));
+  int cx, cy, cz;
+  cellCoordinates(query, cx, cy, cz);
+
+  for (int dx = -rings; dx <= rings; dx++) {
+    for (int dy = -rings; dy <= rings; dy++) {
+      for (int dz = -rings; dz <= rings; dz++) {
+        const Cell* cell = findCell(cellKey(cx + dx, cy + dy, cz + dz));
+        if (!cell) {
+          continue;
+        }
+        for (uint32_t j = cell->begin; j < cell->end; j++) {
+          float ddx = x_[j] - query.x;
+          float ddy = y_[j] - query.y;
+          float ddz = z_[j] - query.z;
+          float sqr_dist = ddx*ddx + ddy*ddy + ddz*ddz;
+          if (sqr_dist <= sqr_radius) {
+            indices.push_back(indices_[j]);
+            sqr_dists.push_back(sqr_dist);
+          }
+        }
+      }
+    }
+  }
+  return (int) indices.size();
+}
+
+bool VoxelHashSearchBackend::nearestSearch(const pcl::PointXYZ& query, double max_sqr_dist,
+                                           std::vector<int>& indices, std::vector<float>& sqr_dists) const
+{
+  if (!isFinite(query)) {
+    return false;
+  }
+  const int max_rings = std::max(1, (int) std::ceil(std::sqrt(max_sqr_dist) * inv_cell_size_));
+  int cx, cy, cz;
+  cellCoordinates(query, cx, cy, cz);
+
+  int best_index = -1;
+  float best_sqr_dist = std::numeric_limits<float>::max();
+  // Visit shells of cells with growing distance to the query cell
+  for (int k = 0; k <= max_rings; k++) {
+    for (int dx = -k; dx <= k; dx++) {
+      for (int dy = -k; dy <= k; dy++) {
+        for (int dz = -k; dz <= k; dz++) {
+          if (std::max(std::abs(dx), std::max(std::abs(dy), std::abs(dz))) != k) {
+            continue;
+          }
+          const Cell* cell = findCell(cellKey(cx + dx, cy + dy, cz + dz));
+          if (!cell) {
+            continue;
+          }
+          for (uint32_t j = cell->begin; j < cell->end; j++) {
+            float ddx = x_[j] - query.x;
+            float ddy = y_[j] - query.y;
+            float ddz = z_[j] - query.z;
+            float sqr_dist = ddx*ddx + ddy*ddy + ddz*ddz;
+            if (sqr_dist < best_sqr_dist) {
+              best_sqr_dist = sqr_dist;
+              best_index = indices_[j];
+            }
+          }
+        }
+      }
+    }
+    // Points in the next shell are at least k cells away
+    float shell_dist = k * cell_size_;
+    if (best_index >= 0 && best_sqr_dist <= shell_dist * shell_dist) {
+      break;
+    }
+  }
+
+  if (best_index < 0 || best_sqr_dist > max_sqr_dist) {
+    return false;
+  }
+  indices.resize(1);
+  sqr_dists.resize(1);
+  indices[0] = best_index;
+  sqr_dists[0] = best_sqr_dist;
+  return true;
+}
+
+}
+}
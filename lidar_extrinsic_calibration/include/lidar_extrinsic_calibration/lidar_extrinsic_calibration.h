@@ -3,6 +3,7 @@
 
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud2.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
 
 #include <pcl_conversions/pcl_conversions.h>
 #include <pcl/filters/passthrough.h>
@@ -13,13 +14,22 @@
 #include <tf/transform_listener.h>
 #include <tf_conversions/tf_eigen.h>
 
+#include <lidar_calibration_lib/profiler.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include <atomic>
+
 namespace hector_calibration {
   class LidarExtrinsicCalibration {
   public:
-    LidarExtrinsicCalibration(ros::NodeHandle& nh);
+    // Parameters are read from pnh
+    LidarExtrinsicCalibration(const ros::NodeHandle& nh, const ros::NodeHandle& pnh = ros::NodeHandle("~"));
 
     void calibrateGround();
     void publishLastResult();
+    // Makes calibrateGround() stop waiting for a cloud, e.g. when its nodelet is unloaded. Thread safe.
+    void stop();
   private:
     void pointCloudCb(const sensor_msgs::PointCloud2ConstPtr& cloud_ptr);
     Eigen::Affine3d getTransform(std::string frame_base, std::string frame_target) const;
@@ -30,9 +40,12 @@ namespace hector_calibration {
     ros::Subscriber cloud_sub_;
     ros::Publisher result_pub_;
     ros::Publisher ground_plane_pub_;
+    ros::Publisher diagnostics_pub_;
 
+    boost::mutex cloud_mutex_;
     sensor_msgs::PointCloud2ConstPtr last_cloud_ptr_;
     bool first_cloud_;
+    std::atomic<bool> stop_requested_;
 
     std::string ground_frame_;
     ros::Duration tf_wait_duration_;
@@ -2,50 +2,77 @@
 
 namespace hector_calibration {
 
-LidarExtrinsicCalibration::LidarExtrinsicCalibration(ros::NodeHandle &nh) :
+LidarExtrinsicCalibration::LidarExtrinsicCalibration(const ros::NodeHandle &nh, const ros::NodeHandle &pnh) :
 nh_(nh),
-first_cloud_(true) {
+first_cloud_(true),
+stop_requested_(false) {
   cloud_sub_ = nh_.subscribe("cloud", 1000, &LidarExtrinsicCalibration::pointCloudCb, this);
   //result_pub_ = nh_.advertise<sensor_msgs::PointCloud2>("result", 1000);
   ground_plane_pub_ = nh_.advertise<sensor_msgs::PointCloud2>("ground_plane", 1000);
 
-  ros::NodeHandle pnh("~");
   pnh.param<std::string>("ground_frame", ground_frame_, "base_link");
   double duration;
   pnh.param<double>("tf_wait_duration", duration, 10.0);
   tf_wait_duration_ = ros::Duration(duration);
+
+  bool profiling;
+  pnh.param<bool>("profiling", profiling, false);
+  if (profiling) {
+    lidar_calibration::Profiler::instance().setEnabled(true);
+    diagnostics_pub_ = nh_.advertise<diagnostic_msgs::DiagnosticArray>("diagnostics", 10);
+  }
 }
 
 void LidarExtrinsicCalibration::calibrateGround() {
-  // wait for cloud
+  // wait for cloud, callbacks are processed by the spinner of the node or nodelet manager
   ROS_INFO_STREAM("Waiting for point cloud..");
-  while (!last_cloud_ptr_ && ros::ok()) {
-    ros::spinOnce();
-    ros::Duration(1).sleep();
+  sensor_msgs::PointCloud2ConstPtr cloud_ptr;
+  while (ros::ok() && !stop_requested_) {
+    {
+      boost::mutex::scoped_lock lock(cloud_mutex_);
+      cloud_ptr = last_cloud_ptr_;
+    }
+    if (cloud_ptr) {
+      break;
+    }
+    ros::WallDuration(0.1).sleep();
   }
+  if (!cloud_ptr) {
+    return;
+  }
+
+  lidar_calibration::ScopedTimer total_timer("total");
 
   // convert msg to pointcloud
+  lidar_calibration::ScopedTimer convert_timer("convert");
   pcl::PointCloud<pcl::PointXYZ>::Ptr pcl_cloud_ptr(new pcl::PointCloud<pcl::PointXYZ>());
-  pcl::fromROSMsg(*last_cloud_ptr_, *pcl_cloud_ptr);
+  pcl::fromROSMsg(*cloud_ptr, *pcl_cloud_ptr);
+  convert_timer.stop();
 
   ROS_INFO_STREAM("Point cloud size: " << pcl_cloud_ptr->size());
+  lidar_calibration::profileCount("points", pcl_cloud_ptr->size());
 
   // Transform to ground frame
-  Eigen::Affine3d plane_transform = getTransform(ground_frame_, last_cloud_ptr_->header.frame_id);
+  Eigen::Affine3d plane_transform = getTransform(ground_frame_, cloud_ptr->header.frame_id);
+  lidar_calibration::ScopedTimer transform_timer("transform");
   pcl::transformPointCloud(*pcl_cloud_ptr, *pcl_cloud_ptr, plane_transform);
+  transform_timer.stop();
 
   // Cut off top part
+  lidar_calibration::ScopedTimer crop_timer("crop");
   pcl::PassThrough<pcl::PointXYZ> pass;
   pass.setInputCloud(pcl_cloud_ptr);
   pass.setFilterFieldName("z");
   pass.setFilterLimits(-std::numeric_limits<float>::max() , 0);
   pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_part(new pcl::PointCloud<pcl::PointXYZ>());
   pass.filter(*cloud_part);
+  crop_timer.stop();
 
   // Transform back
   //pcl::transformPointCloud(*cloud_part, *cloud_part, plane_transform.inverse());
 
   // init segmentation
+  lidar_calibration::ScopedTimer segmentation_timer("segmentation");
   pcl::ModelCoefficients coefficients;
   pcl::PointIndices::Ptr inliers(new pcl::PointIndices());
 
@@ -70,6 +97,8 @@ void LidarExtrinsicCalibration::calibrateGround() {
 
   pcl::PointCloud<pcl::PointXYZ>::Ptr ground_plane(new pcl::PointCloud<pcl::PointXYZ>());
   extract.filter(*ground_plane);
+  segmentation_timer.stop();
+  lidar_calibration::profileCount("ground_plane_points", ground_plane->size());
 
   // Publish plane
   sensor_msgs::PointCloud2 ground_plane_msg;
@@ -90,10 +119,22 @@ void LidarExtrinsicCalibration::calibrateGround() {
 
   ROS_INFO_STREAM("Detected ground plane: " << offset);
   ROS_INFO_STREAM("Rotated: " << rotated_offset);
-  ROS_INFO_STREAM("Add these values to your mount frame: " << last_cloud_ptr_->header.frame_id);
+  ROS_INFO_STREAM("Add these values to your mount frame: " << cloud_ptr->header.frame_id);
+
+  total_timer.stop();
+  lidar_calibration::Profiler& profiler = lidar_calibration::Profiler::instance();
+  if (profiler.enabled()) {
+    profiler.publishDiagnostics(diagnostics_pub_, "lidar_extrinsic_calibration");
+    ROS_INFO_STREAM("Profiling summary:\n" << profiler.summary());
+  }
+}
+
+void LidarExtrinsicCalibration::stop() {
+  stop_requested_ = true;
 }
 
 void LidarExtrinsicCalibration::pointCloudCb(const sensor_msgs::PointCloud2ConstPtr& cloud_ptr) {
+  boost::mutex::scoped_lock lock(cloud_mutex_);
   if (first_cloud_) {
     first_cloud_ = false;
     return;
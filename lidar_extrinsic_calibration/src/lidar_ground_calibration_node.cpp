@@ -1,17 +1,13 @@
 #include <ros/ros.h>
-#include <lidar_extrinsic_calibration/lidar_extrinsic_calibration.h>
-
-#include <stdio.h>
+#include <nodelet/loader.h>
 
 int main(int argc, char** argv) {
-  printf("test");
   ros::init(argc, argv, "lidar_ground_calibration_node");
 
-  ROS_INFO_STREAM("Starting ground calibration");
-
-  ros::NodeHandle nh;
-  hector_calibration::LidarExtrinsicCalibration calibration(nh);
-  calibration.calibrateGround();
+  nodelet::Loader nodelet;
+  nodelet::M_string remap(ros::names::getRemappings());
+  nodelet::V_string nargv;
+  nodelet.load(ros::this_node::getName(), "lidar_extrinsic_calibration/LidarGroundCalibrationNodelet", remap, nargv);
   ros::spin();
   return 0;
 }
@@ -0,0 +1,40 @@
+#include <lidar_extrinsic_calibration/lidar_extrinsic_calibration.h>
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <boost/thread.hpp>
+
+namespace hector_calibration {
+
+/**
+ * Runs the ground calibration in its own thread, the cloud callback is processed by the nodelet manager.
+ */
+class LidarGroundCalibrationNodelet : public nodelet::Nodelet {
+public:
+  virtual ~LidarGroundCalibrationNodelet() {
+    if (calibration_) {
+      calibration_->stop();
+    }
+    if (worker_.joinable()) {
+      worker_.join();
+    }
+  }
+
+private:
+  virtual void onInit() {
+    NODELET_INFO_STREAM("Starting ground calibration");
+    calibration_.reset(new LidarExtrinsicCalibration(getNodeHandle(), getPrivateNodeHandle()));
+    worker_ = boost::thread(&LidarGroundCalibrationNodelet::run, this);
+  }
+
+  void run() {
+    calibration_->calibrateGround();
+  }
+
+  boost::shared_ptr<LidarExtrinsicCalibration> calibration_;
+  boost::thread worker_;
+};
+
+}
+
+PLUGINLIB_EXPORT_CLASS(hector_calibration::LidarGroundCalibrationNodelet, nodelet::Nodelet)
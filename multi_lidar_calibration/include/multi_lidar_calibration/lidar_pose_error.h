@@ -31,6 +31,8 @@
 
 #include <ceres/ceres.h>
 #include <pcl/point_types.h>
+#include <cmath>
+#include <vector>
 
 namespace hector_calibration {
 
@@ -83,6 +85,166 @@ struct LidarPoseError {
   WeightedNormal normal_;
 };
 
+/**
+ * Rotation Rz(yaw)*Ry(pitch)*Rx(roll) and its partial derivatives.
+ */
+struct PoseRotation {
+  PoseRotation(double roll, double pitch, double yaw) {
+    double cr = std::cos(roll), sr = std::sin(roll);
+    double cp = std::cos(pitch), sp = std::sin(pitch);
+    double cy = std::cos(yaw), sy = std::sin(yaw);
+    Eigen::Matrix3d rx, ry, rz, drx, dry, drz;
+    rx << 1,  0,   0,
+          0, cr, -sr,
+          0, sr,  cr;
+    ry <<  cp, 0, sp,
+            0, 1,  0,
+          -sp, 0, cp;
+    rz << cy, -sy, 0,
+          sy,  cy, 0,
+           0,   0, 1;
+    drx << 0,   0,   0,
+           0, -sr, -cr,
+           0,  cr, -sr;
+    dry << -sp, 0,  cp,
+             0, 0,   0,
+           -cp, 0, -sp;
+    drz << -sy, -cy, 0,
+            cy, -sy, 0,
+             0,   0, 0;
+    rotation = rz * ry * rx;
+    d_roll = rz * ry * drx;
+    d_pitch = rz * dry * rx;
+    d_yaw = drz * ry * rx;
+  }
+
+  Eigen::Matrix3d rotation;
+  Eigen::Matrix3d d_roll;
+  Eigen::Matrix3d d_pitch;
+  Eigen::Matrix3d d_yaw;
+};
+
+// Number of correspondences evaluated by one LidarPoseChunkError
+const unsigned int POSE_RESIDUAL_CHUNK_SIZE = 1024;
+
+/**
+ * Evaluates a span of LidarPoseError residuals in one residual block with
+ * analytic jacobians. With m = w*n, the residual is
+ * r = m'*x1 - sum(R .* (m*x2')) - m'*t, so each term is stored as the
+ * coefficients m'*x1, m*x2' and m in structure of arrays layout.
+ */
+class LidarPoseChunkError : public ceres::CostFunction {
+public:
+  LidarPoseChunkError(unsigned int capacity = POSE_RESIDUAL_CHUNK_SIZE) {
+    mutable_parameter_block_sizes()->push_back(3);
+    mutable_parameter_block_sizes()->push_back(3);
+    set_num_residuals(0);
+    for (unsigned int c = 0; c < NUM_COEFFS; c++) {
+      coeffs_[c].reserve(capacity);
+    }
+  }
+
+  // Adds a residual. All residuals have to be added before the chunk is added to a problem.
+  void add(const Eigen::Vector3d& x1, const Eigen::Vector3d& x2, const WeightedNormal& normal) {
+    resize(size() + 1);
+    set(size() - 1, x1, x2, normal);
+  }
+
+  // Sets a fixed number of residuals, which are then filled with set() and setZero()
+  void resize(size_t n) {
+    for (unsigned int c = 0; c < NUM_COEFFS; c++) {
+      coeffs_[c].resize(n);
+    }
+    set_num_residuals(n);
+  }
+
+  void set(size_t i, const Eigen::Vector3d& x1, const Eigen::Vector3d& x2, const WeightedNormal& normal) {
+    Eigen::Vector3d m = normal.weight * normal.normal;
+    Eigen::Matrix3d b = m * x2.transpose();
+    coeffs_[0][i] = m.dot(x1);
+    for (unsigned int j = 0; j < 9; j++) {
+      coeffs_[1 + j][i] = b(j / 3, j % 3);
+    }
+    for (unsigned int j = 0; j < 3; j++) {
+      coeffs_[10 + j][i] = m(j);
+    }
+  }
+
+  // A zero term has zero residual and jacobian
+  void setZero(size_t i) {
+    for (unsigned int c = 0; c < NUM_COEFFS; c++) {
+      coeffs_[c][i] = 0;
+    }
+  }
+
+  size_t size() const {
+    return coeffs_[0].size();
+  }
+
+  virtual bool Evaluate(double const* const* parameters, double* residuals, double** jacobians) const {
+    PoseRotation rotation(parameters[0][0], parameters[0][1], parameters[0][2]);
+    const double* t = parameters[1];
+    const double* c = coeffs_[0].data();
+    const double* b[9];
+    for (unsigned int j = 0; j < 9; j++) {
+      b[j] = coeffs_[1 + j].data();
+    }
+    const double* mx = coeffs_[10].data(); const double* my = coeffs_[11].data(); const double* mz = coeffs_[12].data();
+    const int n = (int) size();
+
+    // Row major copies of the rotation and its derivatives
+    double r[9], dr[3][9];
+    for (unsigned int j = 0; j < 9; j++) {
+      r[j] = rotation.rotation(j / 3, j % 3);
+      dr[0][j] = rotation.d_roll(j / 3, j % 3);
+      dr[1][j] = rotation.d_pitch(j / 3, j % 3);
+      dr[2][j] = rotation.d_yaw(j / 3, j % 3);
+    }
+
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for (int i = 0; i < n; i++) {
+      residuals[i] = c[i] - mx[i]*t[0] - my[i]*t[1] - mz[i]*t[2]
+                   - r[0]*b[0][i] - r[1]*b[1][i] - r[2]*b[2][i]
+                   - r[3]*b[3][i] - r[4]*b[4][i] - r[5]*b[5][i]
+                   - r[6]*b[6][i] - r[7]*b[7][i] - r[8]*b[8][i];
+    }
+
+    if (jacobians == NULL) {
+      return true;
+    }
+    if (jacobians[0] != NULL) {
+      // Row major n x 3
+      double* j = jacobians[0];
+      for (unsigned int k = 0; k < 3; k++) {
+        const double* d = dr[k];
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+        for (int i = 0; i < n; i++) {
+          j[3*i + k] = -(d[0]*b[0][i] + d[1]*b[1][i] + d[2]*b[2][i]
+                       + d[3]*b[3][i] + d[4]*b[4][i] + d[5]*b[5][i]
+                       + d[6]*b[6][i] + d[7]*b[7][i] + d[8]*b[8][i]);
+        }
+      }
+    }
+    if (jacobians[1] != NULL) {
+      double* j = jacobians[1];
+      for (int i = 0; i < n; i++) {
+        j[3*i] = -mx[i];
+        j[3*i + 1] = -my[i];
+        j[3*i + 2] = -mz[i];
+      }
+    }
+    return true;
+  }
+
+private:
+  static const unsigned int NUM_COEFFS = 13;
+  std::vector<double> coeffs_[NUM_COEFFS];
+};
+
 }
 }
 
@@ -2,6 +2,11 @@
 #define MULTI_LIDAR_CALIBRATION_H
 
 #include <lidar_calibration_lib/lidar_calibration_common.h>
+#include <lidar_calibration_lib/chunked_problem.h>
+#include <lidar_calibration_lib/profiler.h>
+
+// standard
+#include <atomic>
 
 // pcl
 #include <pcl_ros/point_cloud.h>
@@ -13,6 +18,7 @@
 // ros
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud2.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
 
 // tf
 #include <tf/transform_listener.h>
@@ -27,10 +33,44 @@ namespace lidar_calibration {
 
 class MultiLidarCalibration {
 public:
+  struct CalibrationOptions {
+    CalibrationOptions() {
+      max_sqr_dist = 0.0025;
+      normals_radius = 0.07;
+      normals_search_backend = KDTREE;
+      crop_dist = 1.0;
+      voxel_leaf_size = 0.01;
+      max_iterations = 20;
+      parameter_diff_thres = 1e-3;
+      solver_options = defaultSolverOptions();
+    }
+
+    double max_sqr_dist;
+    double normals_radius;
+    SearchBackendType normals_search_backend;
+    double crop_dist;
+    double voxel_leaf_size;
+    int max_iterations;
+    double parameter_diff_thres;
+    ceres::Solver::Options solver_options;
+  };
+
+  // Without a ROS graph: no topics or tf. For offline tools and benchmarks.
+  MultiLidarCalibration();
   MultiLidarCalibration(ros::NodeHandle nh);
+  // Parameters are read from pnh, used by the nodelet
+  MultiLidarCalibration(ros::NodeHandle nh, ros::NodeHandle pnh);
+
+  void setOptions(const CalibrationOptions& options);
+  // Frame that is calibrated and its current transform from the base frame. Only needed for saving without tf.
+  void setTargetFrame(const std::string& target_frame, const Eigen::Affine3d& transform);
+  // Saves the result of calibrate() as urdf origin-block if a target frame is set, empty to disable
+  void setSavePath(const std::string& path);
   Eigen::Affine3d calibrate(pcl::PointCloud<pcl::PointXYZ> cloud1, pcl::PointCloud<pcl::PointXYZ> cloud2);
   Eigen::Affine3d calibrate(const sensor_msgs::PointCloud2& cloud1_msg, const sensor_msgs::PointCloud2& cloud2_msg);
-private:
+  // Makes a running calibrate() return after the current iteration, e.g. when its nodelet is unloaded. Thread safe.
+  void stop();
+protected:
   void preprocessClouds(pcl::PointCloud<pcl::PointXYZ>& cloud1, pcl::PointCloud<pcl::PointXYZ>& cloud2);
   void cropCloud(pcl::PointCloud<pcl::PointXYZ>& cloud, double distance);
   void downsampleCloud(pcl::PointCloud<pcl::PointXYZ>& cloud, float leaf_size);
@@ -38,8 +78,10 @@ private:
   Eigen::Affine3d optimize(const pcl::PointCloud<pcl::PointXYZ>& cloud1,
                 const pcl::PointCloud<pcl::PointXYZ>& cloud2,
                 const std::vector<WeightedNormal>& normals,
-                const std::map<unsigned int, unsigned int>& mapping,
+                const Correspondences& correspondences,
                 const Eigen::Affine3d &initial_calibration);
+  // ros::ok() and not stopped, without a ROS graph only stop() ends the calibration
+  bool ok() const;
   bool maxIterationsReached(unsigned int current_iterations) const;
   bool checkConvergence(const Eigen::Affine3d& prev_calibration, const Eigen::Affine3d& current_calibration) const;
   bool saveToDisk(std::string path, const Eigen::Affine3d& calibration) const;
@@ -53,25 +95,24 @@ private:
   ros::Publisher preprocessed_pub_[2];
   ros::Publisher mapping_pub_;
   ros::Publisher result_pub_[2];
+  ros::Publisher diagnostics_pub_;
 
-  tf::TransformListener tfl_;
+  boost::shared_ptr<tf::TransformListener> tfl_;
   ros::Duration tf_wait_duration_;
 
   std::string save_path_;
 
-  ros::NodeHandle nh_;
+  boost::shared_ptr<ros::NodeHandle> nh_;
   std::string base_frame_;
   std::string target_frame_;
   Eigen::Affine3d old_transform_;
 
-  double max_sqr_dist_;
+  CalibrationOptions options_;
   int neighbor_mapping_vis_count_;
-  double normals_radius_;
-  double crop_dist_;
-  double voxel_leaf_size_;
-  int max_iterations_;
-  double parameter_diff_thres_;
 
+  typedef ChunkedProblem<LidarPoseChunkError, 3, 3> LidarPoseProblem;
+  LidarPoseProblem ceres_problem_;
+  std::atomic<bool> stop_requested_;
 };
 
 }
@@ -3,32 +3,85 @@
 namespace hector_calibration {
 namespace lidar_calibration {
 
+MultiLidarCalibration::MultiLidarCalibration() :
+  tf_wait_duration_(1.0),
+  save_path_(""),
+  base_frame_("base_link"),
+  target_frame_(""),
+  old_transform_(Eigen::Affine3d::Identity()),
+  neighbor_mapping_vis_count_(100),
+  ceres_problem_(POSE_RESIDUAL_CHUNK_SIZE),
+  stop_requested_(false)
+{
+}
+
 MultiLidarCalibration::MultiLidarCalibration(ros::NodeHandle nh) :
-  nh_(nh)
+  MultiLidarCalibration(nh, ros::NodeHandle("~"))
 {
+}
+
+MultiLidarCalibration::MultiLidarCalibration(ros::NodeHandle nh, ros::NodeHandle pnh) :
+  MultiLidarCalibration()
+{
+  nh_.reset(new ros::NodeHandle(nh));
+  tfl_.reset(new tf::TransformListener());
   // Init publishers
   for (unsigned int i = 0; i < 2; i++) {
-    raw_pub_[i] = nh_.advertise<sensor_msgs::PointCloud2>("raw_cloud" + std::to_string(i), 1000);
-    preprocessed_pub_[i] = nh_.advertise<sensor_msgs::PointCloud2>("preprocessed_cloud" + std::to_string(i), 1000);
-    result_pub_[i] = nh_.advertise<sensor_msgs::PointCloud2>("result_cloud" + std::to_string(i), 1000);
+    raw_pub_[i] = nh_->advertise<sensor_msgs::PointCloud2>("raw_cloud" + std::to_string(i), 1000);
+    preprocessed_pub_[i] = nh_->advertise<sensor_msgs::PointCloud2>("preprocessed_cloud" + std::to_string(i), 1000);
+    result_pub_[i] = nh_->advertise<sensor_msgs::PointCloud2>("result_cloud" + std::to_string(i), 1000);
+  }
+  mapping_pub_ = nh_->advertise<visualization_msgs::MarkerArray>("neighbor_mapping", 1000);
+  // Load parameters, defaults are set by the default constructor
+  pnh.param<std::string>("base_frame", base_frame_, base_frame_);
+  pnh.param<double>("max_sqr_dist", options_.max_sqr_dist, options_.max_sqr_dist);
+  pnh.param<int>("neighbor_mapping_vis_count", neighbor_mapping_vis_count_, neighbor_mapping_vis_count_);
+  pnh.param<double>("normals_radius", options_.normals_radius, options_.normals_radius);
+  std::string normals_search_backend;
+  pnh.param<std::string>("normals_search_backend", normals_search_backend, searchBackendToString(options_.normals_search_backend));
+  if (!searchBackendFromString(normals_search_backend, options_.normals_search_backend)) {
+    ROS_WARN_STREAM("Unknown normals_search_backend '" << normals_search_backend << "'. Using kdtree.");
+    options_.normals_search_backend = KDTREE;
   }
-  mapping_pub_ = nh_.advertise<visualization_msgs::MarkerArray>("neighbor_mapping", 1000);
-  // Load parameters
-  ros::NodeHandle pnh("~");
-  pnh.param<std::string>("base_frame", base_frame_, "base_link");
-  pnh.param<double>("max_sqr_dist", max_sqr_dist_, 0.0025);
-  pnh.param<int>("neighbor_mapping_vis_count", neighbor_mapping_vis_count_, 100);
-  pnh.param<double>("normals_radius", normals_radius_, 0.07);
-  pnh.param<double>("crop_dist", crop_dist_, 1.0);
-  pnh.param<double>("voxel_leaf_size", voxel_leaf_size_, 0.01);
-  pnh.param<int>("max_iterations", max_iterations_, 20);
-  pnh.param<double>("parameter_diff_thres", parameter_diff_thres_, 1e-3);
-
-  pnh.param<std::string>("target_frame", target_frame_, "");
+  pnh.param<double>("crop_dist", options_.crop_dist, options_.crop_dist);
+  pnh.param<double>("voxel_leaf_size", options_.voxel_leaf_size, options_.voxel_leaf_size);
+  pnh.param<int>("max_iterations", options_.max_iterations, options_.max_iterations);
+  pnh.param<double>("parameter_diff_thres", options_.parameter_diff_thres, options_.parameter_diff_thres);
+  loadSolverOptions(pnh, options_.solver_options);
+
+  pnh.param<std::string>("target_frame", target_frame_, target_frame_);
   double wait_duration;
-  pnh.param<double>("tf_wait_duration", wait_duration, 1.0);
+  pnh.param<double>("tf_wait_duration", wait_duration, tf_wait_duration_.toSec());
   tf_wait_duration_ = ros::Duration(wait_duration);
-  pnh.param<std::string>("save_path", save_path_, "");
+  pnh.param<std::string>("save_path", save_path_, save_path_);
+
+  bool profiling;
+  pnh.param<bool>("profiling", profiling, false);
+  if (profiling) {
+    Profiler::instance().setEnabled(true);
+    diagnostics_pub_ = nh_->advertise<diagnostic_msgs::DiagnosticArray>("diagnostics", 10);
+  }
+}
+
+void MultiLidarCalibration::setOptions(const CalibrationOptions& options) {
+  options_ = options;
+}
+
+void MultiLidarCalibration::setTargetFrame(const std::string& target_frame, const Eigen::Affine3d& transform) {
+  target_frame_ = target_frame;
+  old_transform_ = transform;
+}
+
+void MultiLidarCalibration::setSavePath(const std::string& path) {
+  save_path_ = path;
+}
+
+void MultiLidarCalibration::stop() {
+  stop_requested_ = true;
+}
+
+bool MultiLidarCalibration::ok() const {
+  return !stop_requested_ && (!nh_ || ros::ok());
 }
 
 Eigen::Affine3d
@@ -57,7 +110,8 @@ Eigen::Affine3d
 MultiLidarCalibration::calibrate(pcl::PointCloud<pcl::PointXYZ> cloud1,
                                  pcl::PointCloud<pcl::PointXYZ> cloud2)
 {
-  if (target_frame_ != "")
+  ScopedTimer total_timer("total");
+  if (target_frame_ != "" && tfl_)
     old_transform_ = getTransform(base_frame_, target_frame_);
 
   ROS_INFO_STREAM("Starting calibration");
@@ -68,12 +122,27 @@ MultiLidarCalibration::calibrate(pcl::PointCloud<pcl::PointXYZ> cloud1,
   ROS_INFO_STREAM("Cloud 2 raw size: " << cloud2.size());
 
   ROS_INFO_STREAM("Preprocessing clouds");
-  preprocessClouds(cloud1, cloud2);
+  {
+    ScopedTimer timer("preprocess");
+    preprocessClouds(cloud1, cloud2);
+  }
+  profileCount("points", cloud1.size() + cloud2.size());
   ROS_INFO_STREAM("Cloud 1 preprocessed size: " << cloud1.size());
   ROS_INFO_STREAM("Cloud 2 preprocessed size: " << cloud2.size());
 
   ROS_INFO_STREAM("Computing Normals");
-  std::vector<WeightedNormal> normals = computeNormals(cloud1, normals_radius_);
+  ScopedTimer normals_timer("normals");
+  NeighborSearch cloud1_search(options_.normals_search_backend, options_.normals_radius);
+  cloud1_search.setInputCloud(cloud1);
+  std::vector<WeightedNormal> normals = computeNormals(cloud1_search, options_.normals_radius);
+  normals_timer.stop();
+
+  // cloud2 only moves rigidly, so its index is built once and the calibration is applied to the queries
+  ScopedTimer index_timer("build_index");
+  NeighborSearch cloud2_search(KDTREE);
+  cloud2_search.setInputCloud(cloud2);
+  index_timer.stop();
+  Correspondences correspondences;
 
   Eigen::Affine3d calibration = Eigen::Affine3d::Identity();
   Eigen::Affine3d prev_calibration = Eigen::Affine3d::Identity();
@@ -84,33 +153,55 @@ MultiLidarCalibration::calibrate(pcl::PointCloud<pcl::PointXYZ> cloud1,
   publishCloud(cloud2_transformed, result_pub_[1], base_frame_);
 
   unsigned int iteration_counter = 0;
-  double max_distance = max_sqr_dist_;
+  double max_distance = options_.max_sqr_dist;
   do {
     ROS_INFO_STREAM("-------------- Starting iteration " << (iteration_counter+1) << "--------------");
+    ScopedTimer iteration_timer("iteration");
     ROS_INFO_STREAM("Searching neighbors with max dist of " << std::sqrt(max_distance));
-    std::map<unsigned int, unsigned int> neighbor_mapping = findNeighbors(cloud1, cloud2_transformed, max_distance);
-    publishNeighbors(cloud1, cloud2_transformed, neighbor_mapping, mapping_pub_, base_frame_, neighbor_mapping_vis_count_);
+    {
+      ScopedTimer timer("neighbors");
+      cloud2_search.setTransform(calibration);
+      findNeighbors(cloud1, cloud2_search, correspondences, max_distance);
+    }
+    profileCount("residuals", correspondences.size());
+    {
+      ScopedTimer timer("publish");
+      publishNeighbors(cloud1, cloud2_transformed, correspondences, mapping_pub_, base_frame_, neighbor_mapping_vis_count_);
+    }
     max_distance *= 0.5;
 
     ROS_INFO_STREAM("Starting calibration");
     prev_calibration = calibration;
-    calibration = optimize(cloud1, cloud2, normals, neighbor_mapping, calibration);
-    pcl::transformPointCloud(cloud2, cloud2_transformed, calibration);
-    publishCloud(cloud1, result_pub_[0], base_frame_);
-    publishCloud(cloud2_transformed, result_pub_[1], base_frame_);
+    {
+      ScopedTimer timer("optimize");
+      calibration = optimize(cloud1, cloud2, normals, correspondences, calibration);
+    }
+    {
+      ScopedTimer timer("publish");
+      pcl::transformPointCloud(cloud2, cloud2_transformed, calibration);
+      publishCloud(cloud1, result_pub_[0], base_frame_);
+      publishCloud(cloud2_transformed, result_pub_[1], base_frame_);
+    }
 
     iteration_counter++;
-  } while (ros::ok() && !maxIterationsReached(iteration_counter) && !checkConvergence(prev_calibration, calibration));
+    iteration_timer.stop();
+    Profiler::instance().publishDiagnostics(diagnostics_pub_, "multi_lidar_calibration");
+  } while (ok() && !maxIterationsReached(iteration_counter) && !checkConvergence(prev_calibration, calibration));
 
   if (target_frame_ != "" && save_path_ != "") {
     saveToDisk(save_path_, calibration);
   }
 
+  total_timer.stop();
+  if (Profiler::instance().enabled()) {
+    Profiler::instance().publishDiagnostics(diagnostics_pub_, "multi_lidar_calibration");
+    ROS_INFO_STREAM("Profiling summary:\n" << Profiler::instance().summary());
+  }
   return calibration;
 }
 
 bool MultiLidarCalibration::maxIterationsReached(unsigned int current_iterations) const {
-  if (current_iterations < max_iterations_) {
+  if (current_iterations < options_.max_iterations) {
     return false;
   }  else {
     ROS_INFO_STREAM("-------- MAX ITERATIONS REACHED ---------");
@@ -133,7 +224,7 @@ bool MultiLidarCalibration::checkConvergence(const Eigen::Affine3d& prev_calibra
     cum_sqrt_diff += std::pow(prev_xyz(i) - current_xyz(i), 2);
   }
   ROS_INFO_STREAM("Squared change in parameters: " << cum_sqrt_diff);
-  if (cum_sqrt_diff < parameter_diff_thres_) {
+  if (cum_sqrt_diff < options_.parameter_diff_thres) {
     ROS_INFO_STREAM("-------------- CONVERGENCE --------------");
     return true;
   } else {
@@ -145,10 +236,10 @@ void MultiLidarCalibration::preprocessClouds(pcl::PointCloud<pcl::PointXYZ>& clo
                                              pcl::PointCloud<pcl::PointXYZ>& cloud2)
 
 {
-  cropCloud(cloud1, crop_dist_);
-  cropCloud(cloud2, crop_dist_);
-  // downsampleCloud(cloud1, (float) voxel_leaf_size_);
-  // downsampleCloud(cloud2, (float) voxel_leaf_size_);
+  cropCloud(cloud1, options_.crop_dist);
+  cropCloud(cloud2, options_.crop_dist);
+  // downsampleCloud(cloud1, (float) options_.voxel_leaf_size);
+  // downsampleCloud(cloud2, (float) options_.voxel_leaf_size);
 
   publishCloud(cloud1, preprocessed_pub_[0], base_frame_);
   publishCloud(cloud2, preprocessed_pub_[1], base_frame_);
@@ -189,7 +280,7 @@ Eigen::Affine3d
 MultiLidarCalibration::optimize(const pcl::PointCloud<pcl::PointXYZ> &cloud1,
               const pcl::PointCloud<pcl::PointXYZ> &cloud2,
               const std::vector<WeightedNormal> &normals,
-              const std::map<unsigned int, unsigned int> &mapping,
+              const Correspondences &correspondences,
               const Eigen::Affine3d& initial_calibration)
 {
   if (cloud1.size() != normals.size()) {
@@ -197,36 +288,34 @@ MultiLidarCalibration::optimize(const pcl::PointCloud<pcl::PointXYZ> &cloud1,
     return Eigen::Affine3d::Identity();
   }
 
-  ceres::Problem problem;
-
   Eigen::Vector3d ypr = initial_calibration.linear().eulerAngles(2, 1, 0);
   Eigen::Vector3d xyz = initial_calibration.translation();
 
-  double translation[3];
-  double rotation[3];
+  // The problem persists over iterations, only the residual data is replaced
+  double* translation = ceres_problem_.translation();
+  double* rotation = ceres_problem_.rotation();
   for (unsigned int i = 0; i < 3; i++) {
     translation[i] = xyz(i);
     rotation[i] = ypr(2-i);
   }
 
-  unsigned int residual_count = 0;
-  for(std::map<unsigned int, unsigned int>::const_iterator it = mapping.begin(); it != mapping.end(); it++) {
-    unsigned int x1_index = it->first;
-    unsigned int x2_index = it->second;
+  ceres_problem_.resize(correspondences.size());
+  const unsigned int chunk_size = ceres_problem_.chunkSize();
+#ifdef _OPENMP
+#pragma omp parallel for shared (correspondences, cloud1, cloud2, normals)
+#endif
+  for (long i = 0; i < (long) correspondences.size(); i++) {
+    unsigned int x1_index = correspondences.source[i];
+    unsigned int x2_index = correspondences.target[i];
     Eigen::Vector3d x1(cloud1[x1_index].x, cloud1[x1_index].y, cloud1[x1_index].z);
     Eigen::Vector3d x2(cloud2[x2_index].x, cloud2[x2_index].y, cloud2[x2_index].z);
-
-    ceres::CostFunction* cost_function = LidarPoseError::Create(x1, x2, normals[x1_index]);
-
-    problem.AddResidualBlock(cost_function, NULL, rotation, translation);
-    residual_count++;
+    ceres_problem_.chunkOf(i).set(i % chunk_size, x1, x2, normals[x1_index]);
   }
-  ROS_INFO_STREAM("Number of residuals: " << residual_count);
+  ROS_INFO_STREAM("Number of residuals: " << correspondences.size() << " in "
+                  << (correspondences.size() + chunk_size - 1) / chunk_size << " blocks");
 
-  ceres::Solver::Options options;
-  //options.minimizer_progress_to_stdout = true;
   ceres::Solver::Summary summary;
-  ceres::Solve(options, &problem, &summary);
+  ceres_problem_.solve(options_.solver_options, &summary);
   //std::cout << summary.BriefReport() << "\n";
 
   Eigen::Affine3d calibration(
@@ -241,10 +330,14 @@ MultiLidarCalibration::optimize(const pcl::PointCloud<pcl::PointXYZ> &cloud1,
 }
 
 Eigen::Affine3d MultiLidarCalibration::getTransform(std::string frame_base, std::string frame_target) const {
+  if (!tfl_) {
+    ROS_WARN_STREAM("No tf available. Using identity from " << frame_base << " to " << frame_target << ".");
+    return Eigen::Affine3d::Identity();
+  }
   ros::Time now = ros::Time::now();
-  if (tfl_.waitForTransform(frame_base, frame_target, now, tf_wait_duration_)) {
+  if (tfl_->waitForTransform(frame_base, frame_target, now, tf_wait_duration_)) {
     tf::StampedTransform transform;
-    tfl_.lookupTransform(frame_base, frame_target, now, transform);
+    tfl_->lookupTransform(frame_base, frame_target, now, transform);
 
     Eigen::Affine3d transform_eigen;
     tf::transformTFToEigen(transform, transform_eigen);
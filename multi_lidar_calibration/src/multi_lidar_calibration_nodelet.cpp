@@ -0,0 +1,112 @@
+#include <multi_lidar_calibration/multi_lidar_calibration.h>
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+
+namespace hector_calibration {
+
+namespace lidar_calibration {
+
+/**
+ * Waits for the second cloud on cloud1 and cloud2 and calibrates them in its own thread.
+ * The clouds are kept as ConstPtr, in a nodelet manager they are not copied.
+ * With the argument --exit_after_calibration (set by multi_lidar_calibration_node) the
+ * node shuts down when the calibration is done.
+ */
+class MultiLidarCalibrationNodelet : public nodelet::Nodelet {
+public:
+  MultiLidarCalibrationNodelet() :
+    cloud1_counter_(0),
+    cloud2_counter_(0),
+    exit_after_calibration_(false)
+  {
+  }
+
+  virtual ~MultiLidarCalibrationNodelet() {
+    {
+      // No callback may start the worker after it was joined
+      boost::mutex::scoped_lock lock(mutex_);
+      cloud1_sub_.shutdown();
+      cloud2_sub_.shutdown();
+    }
+    if (calibration_) {
+      calibration_->stop();
+    }
+    if (worker_.joinable()) {
+      worker_.join();
+    }
+  }
+
+private:
+  virtual void onInit() {
+    ros::NodeHandle& nh = getNodeHandle();
+    calibration_.reset(new MultiLidarCalibration(nh, getPrivateNodeHandle()));
+    const std::vector<std::string>& argv = getMyArgv();
+    exit_after_calibration_ = std::find(argv.begin(), argv.end(), "--exit_after_calibration") != argv.end();
+    cloud1_sub_ = nh.subscribe("cloud1", 10, &MultiLidarCalibrationNodelet::cloud1Callback, this);
+    cloud2_sub_ = nh.subscribe("cloud2", 10, &MultiLidarCalibrationNodelet::cloud2Callback, this);
+    NODELET_INFO_STREAM("Multi lidar calibration started. Waiting for point clouds.");
+  }
+
+  void cloud1Callback(const sensor_msgs::PointCloud2ConstPtr& cloud_msg_ptr) {
+    boost::mutex::scoped_lock lock(mutex_);
+    cloudCallback(cloud_msg_ptr, "cloud1", cloud1_counter_, cloud1_);
+  }
+
+  void cloud2Callback(const sensor_msgs::PointCloud2ConstPtr& cloud_msg_ptr) {
+    boost::mutex::scoped_lock lock(mutex_);
+    cloudCallback(cloud_msg_ptr, "cloud2", cloud2_counter_, cloud2_);
+  }
+
+  // The first cloud is thrown away, it may be incomplete
+  void cloudCallback(const sensor_msgs::PointCloud2ConstPtr& cloud_msg_ptr, const std::string& name,
+                     unsigned int& counter, sensor_msgs::PointCloud2ConstPtr& cloud) {
+    if (counter == 0) {
+      counter++;
+      NODELET_INFO_STREAM("Received first " << name << ". Throwing away..");
+      return;
+    }
+    if (counter == 1) {
+      cloud = cloud_msg_ptr;
+      counter++;
+      NODELET_INFO_STREAM("Received second " << name << ".");
+    }
+    if (cloud1_counter_ == 2 && cloud2_counter_ == 2) {
+      cloud1_counter_++;
+      cloud2_counter_++;
+      cloud1_sub_.shutdown();
+      cloud2_sub_.shutdown();
+      NODELET_INFO_STREAM("Received both point clouds");
+      worker_ = boost::thread(&MultiLidarCalibrationNodelet::run, this);
+    }
+  }
+
+  void run() {
+    calibration_->calibrate(*cloud1_, *cloud2_);
+    if (exit_after_calibration_) {
+      ros::requestShutdown();
+    }
+  }
+
+  boost::shared_ptr<MultiLidarCalibration> calibration_;
+  ros::Subscriber cloud1_sub_;
+  ros::Subscriber cloud2_sub_;
+
+  boost::mutex mutex_;
+  unsigned int cloud1_counter_;
+  unsigned int cloud2_counter_;
+  sensor_msgs::PointCloud2ConstPtr cloud1_;
+  sensor_msgs::PointCloud2ConstPtr cloud2_;
+  // Standalone node, in a nodelet manager the process keeps running
+  bool exit_after_calibration_;
+
+  boost::thread worker_;
+};
+
+}
+}
+
+PLUGINLIB_EXPORT_CLASS(hector_calibration::lidar_calibration::MultiLidarCalibrationNodelet, nodelet::Nodelet)